@@ -0,0 +1,39 @@
+// Asynchronous (non-blocking) transactions
+SYSTEM_MODE(MANUAL);
+
+#include "ModbusMaster-Particle.h"
+
+SerialLogHandler logHandler(9600,LOG_LEVEL_WARN, {
+    {"app", LOG_LEVEL_TRACE},
+    {"system", LOG_LEVEL_INFO}
+});
+
+ModbusMaster slave;
+unsigned long lastRequest = 0;
+
+void completed(uint8_t result) {
+    if (!result) {
+        Log.info("Received: %0x", slave.getResponseBuffer(0));
+    } else {
+        Log.warn("Read error: %0x", result);
+    }
+}
+
+void setup() {
+    slave.begin(1,Serial1); // slaveID=1, serial=Serial1
+    slave.setSpeed(9600,SERIAL_8N1);
+    slave.transactionComplete(completed);
+    slave.enableAsync(); // function calls return ku8MBTransactionPending
+}
+
+void loop() {
+    // start a new read every second; never waits for the slave
+    if (!slave.busy() && millis() - lastRequest >= 1000) {
+        lastRequest = millis();
+        slave.readHoldingRegisters(8000,1);
+    }
+
+    slave.poll(); // advances the transaction; calls completed() when done
+
+    // ... other work (HTTP push, display, ...) keeps running here
+}
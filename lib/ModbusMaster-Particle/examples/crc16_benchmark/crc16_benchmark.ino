@@ -0,0 +1,60 @@
+// CRC-16/Modbus kernel benchmark
+SYSTEM_MODE(MANUAL);
+
+#include "ModbusMaster-Particle.h"
+
+SerialLogHandler logHandler(9600,LOG_LEVEL_WARN, {
+    {"app", LOG_LEVEL_TRACE},
+    {"system", LOG_LEVEL_INFO}
+});
+
+const size_t kFrameSizes[] = { 8, 16, 64, 256 }; // request, short and full ADUs
+const uint32_t kIterations = 2000;
+
+uint8_t frame[256];
+
+uint16_t bitwise(uint16_t crc, const uint8_t *data, size_t len) {
+    while (len--) {
+        crc = crc16_update(crc, *data++);
+    }
+    return crc;
+}
+
+void run(const char *name, uint16_t (*kernel)(uint16_t, const uint8_t *, size_t), size_t len) {
+    volatile uint16_t crc = 0;
+    uint32_t start = micros();
+    for (uint32_t i = 0; i < kIterations; i++) {
+        crc = kernel(0xFFFF, frame, len);
+    }
+    uint32_t elapsed = micros() - start;
+    Log.info("%-9s %3u bytes: %5lu ns/frame crc=%04x", name, (unsigned) len,
+        (unsigned long) (elapsed * 1000UL / kIterations), (unsigned) crc);
+}
+
+void setup() {
+    for (size_t i = 0; i < sizeof(frame); i++) {
+        frame[i] = (uint8_t) (i * 31 + 7);
+    }
+
+    // all kernels must agree before timing means anything
+    for (size_t len = 0; len <= sizeof(frame); len++) {
+        uint16_t expected = bitwise(0xFFFF, frame, len);
+        if (crc16_modbus_bytewise(0xFFFF, frame, len) != expected ||
+            crc16_modbus_slice4(0xFFFF, frame, len) != expected ||
+            crc16_modbus_slice8(0xFFFF, frame, len) != expected) {
+            Log.error("CRC mismatch at %u bytes", (unsigned) len);
+            return;
+        }
+    }
+
+    for (size_t len : kFrameSizes) {
+        run("bitwise", bitwise, len);
+        run("table", crc16_modbus_bytewise, len);
+        run("slice-4", crc16_modbus_slice4, len);
+        run("slice-8", crc16_modbus_slice8, len);
+    }
+}
+
+void loop() {
+    // do nothing :P
+}
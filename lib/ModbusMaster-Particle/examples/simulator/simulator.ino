@@ -0,0 +1,65 @@
+// Exercise every function code against the built-in slave simulator
+SYSTEM_MODE(MANUAL);
+
+#include "ModbusMaster-Particle.h"
+#include "ModbusSlaveSimulator.h"
+
+SerialLogHandler logHandler(9600,LOG_LEVEL_WARN, {
+    {"app", LOG_LEVEL_TRACE},
+    {"system", LOG_LEVEL_INFO}
+});
+
+ModbusLoopbackSerial bus;       // in-memory RS-485 bus
+ModbusSlaveSimulator meter(1);  // simulated slave with ID 1
+ModbusMaster node;
+
+void report(const char *name, uint32_t start, uint8_t result) {
+    Log.info("%-34s %2x %6lu us", name, result, (unsigned long) (micros() - start));
+}
+
+void setup() {
+    meter.attach(bus);
+    for (uint16_t i = 0; i < 125; i++) {
+        meter.setHoldingRegister(i, i);
+        meter.setInputRegister(i, 1000 + i);
+        meter.setDiscreteInput(i, i % 3 == 0);
+    }
+    meter.setLatency(5); // slave processing time
+
+    node.begin(1, bus);
+    node.setSpeed(9600);
+    node.setResponseTimeout(50);
+
+    uint32_t start;
+    start = micros(); report("0x01 readCoils(0,16)", start, node.readCoils(0, 16));
+    start = micros(); report("0x02 readDiscreteInputs(0,64)", start, node.readDiscreteInputs(0, 64));
+    start = micros(); report("0x03 readHoldingRegisters(0,64)", start, node.readHoldingRegisters(0, 64));
+    start = micros(); report("0x04 readInputRegisters(0,10)", start, node.readInputRegisters(0, 10));
+    start = micros(); report("0x05 writeSingleCoil(3,1)", start, node.writeSingleCoil(3, 1));
+    start = micros(); report("0x06 writeSingleRegister(7,9)", start, node.writeSingleRegister(7, 9));
+    node.setTransmitBuffer(0, 0xA5A5);
+    start = micros(); report("0x0F writeMultipleCoils(0,16)", start, node.writeMultipleCoils(0, 16));
+    node.setTransmitBuffer(0, 1);
+    node.setTransmitBuffer(1, 2);
+    start = micros(); report("0x10 writeMultipleRegisters(20,2)", start, node.writeMultipleRegisters(20, 2));
+    start = micros(); report("0x16 maskWriteRegister(7,..)", start, node.maskWriteRegister(7, 0x00F0, 0x0001));
+    start = micros(); report("0x17 readWriteMultiple(0,8,30,2)", start, node.readWriteMultipleRegisters(0, 8, 30, 2));
+
+    // fault injection
+    meter.setException(ModbusMaster::ku8MBSlaveDeviceFailure);
+    start = micros(); report("exception reply", start, node.readHoldingRegisters(0, 1));
+    meter.setException(0);
+    meter.setCorruptRate(100);
+    start = micros(); report("corrupted CRC", start, node.readHoldingRegisters(0, 1));
+    meter.setCorruptRate(0);
+    meter.setOnline(false);
+    start = micros(); report("offline slave", start, node.readHoldingRegisters(0, 1));
+    meter.setOnline(true);
+    meter.setDropRate(20);
+    start = micros(); report("dropped bytes", start, node.readHoldingRegisters(0, 32));
+    meter.setDropRate(0);
+}
+
+void loop() {
+    // do nothing :P
+}
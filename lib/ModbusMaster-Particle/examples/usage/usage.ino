@@ -25,6 +25,7 @@ void idle() {
 
 void setup() {
     slave.begin(1,Serial1); // slaveID=1, serial=Serial1
+    // slave.begin(1,Serial1,D2); // same, with the transceiver DE/RE pins on D2 driven by the library
     slave.setSpeed(9600,SERIAL_8N1);
     // slave.setSpeed(9600); // same as above
     slave.enableDebug(); // to catch the logs
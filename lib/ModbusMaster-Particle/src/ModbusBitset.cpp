@@ -0,0 +1,263 @@
+/**
+@file
+Bit-packed coil/discrete input sets.
+*/
+/*
+
+  ModbusBitset.cpp - Bit-packed coil/discrete input sets for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusBitset.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+/**
+Constructor.
+
+Creates an empty set.
+
+@ingroup bitset
+*/
+ModbusBitset::ModbusBitset()
+{
+  clear();
+}
+
+/**
+Empty the set.
+
+@ingroup bitset
+*/
+void ModbusBitset::clear(void)
+{
+  memset(_u16Words, 0, sizeof(_u16Words));
+  _u16Size = 0;
+}
+
+/**
+Change the number of bits; new bits are 0.
+
+@param u16Size number of bits (clamped to ku16MaxBits)
+@ingroup bitset
+*/
+void ModbusBitset::resize(uint16_t u16Size)
+{
+  _u16Size = (u16Size > ku16MaxBits) ? ku16MaxBits : u16Size;
+  trim();
+}
+
+/**
+Copy packed words, e.g. from a response buffer.
+
+@param pu16Words bits, 16 per word, LSB first
+@param u16Size number of bits (clamped to ku16MaxBits)
+@ingroup bitset
+*/
+void ModbusBitset::assign(const uint16_t *pu16Words, uint16_t u16Size)
+{
+  _u16Size = (u16Size > ku16MaxBits) ? ku16MaxBits : u16Size;
+  memcpy(_u16Words, pu16Words, wordCount() * sizeof(uint16_t));
+  trim();
+}
+
+/**
+State of one bit.
+
+@param u16Index bit index (0..size() - 1)
+@return state; false out of range
+@ingroup bitset
+*/
+bool ModbusBitset::get(uint16_t u16Index) const
+{
+  return u16Index < _u16Size && ((_u16Words[u16Index >> 4] >> (u16Index & 0x0F)) & 1);
+}
+
+/**
+Change one bit.
+
+@param u16Index bit index (0..size() - 1); ignored out of range
+@param state new state
+@ingroup bitset
+*/
+void ModbusBitset::set(uint16_t u16Index, bool state)
+{
+  if (u16Index >= _u16Size)
+  {
+    return;
+  }
+  if (state)
+  {
+    _u16Words[u16Index >> 4] |= (uint16_t) (1U << (u16Index & 0x0F));
+  }
+  else
+  {
+    _u16Words[u16Index >> 4] &= (uint16_t) ~(1U << (u16Index & 0x0F));
+  }
+}
+
+/**
+Number of bits set.
+
+@ingroup bitset
+*/
+uint16_t ModbusBitset::count(void) const
+{
+  uint8_t i;
+  uint16_t u16Count = 0;
+
+  for (i = 0; i < wordCount(); i++)
+  {
+    u16Count += __builtin_popcount(_u16Words[i]);
+  }
+  return u16Count;
+}
+
+/**
+Index of the first bit set at or after a position.
+
+Skips whole words of zeros, so walking a sparse set, e.g. the result of
+diff(), costs one step per word plus one per bit set:
+
+@code
+for (int16_t i = changed.next(0); i >= 0; i = changed.next(i + 1))
+@endcode
+
+@param u16From first index to consider
+@return bit index; -1 if there is none
+@ingroup bitset
+*/
+int16_t ModbusBitset::next(uint16_t u16From) const
+{
+  uint8_t i;
+  uint16_t u16Word;
+
+  if (u16From >= _u16Size)
+  {
+    return -1;
+  }
+
+  i = u16From >> 4;
+  u16Word = _u16Words[i] & (uint16_t) (0xFFFF << (u16From & 0x0F));
+  while (!u16Word)
+  {
+    if (++i >= wordCount())
+    {
+      return -1;
+    }
+    u16Word = _u16Words[i];
+  }
+  return (int16_t) ((i << 4) + __builtin_ctz(u16Word));
+}
+
+/**
+Unpack into one bool per bit.
+
+@param pbDest destination array
+@param u16Max capacity of the destination array
+@return number of bits unpacked (at most size())
+@ingroup bitset
+*/
+uint16_t ModbusBitset::unpack(bool *pbDest, uint16_t u16Max) const
+{
+  uint16_t i, u16Qty = (u16Max < _u16Size) ? u16Max : _u16Size;
+  uint16_t u16Word = 0;
+
+  for (i = 0; i < u16Qty; i++)
+  {
+    if (!(i & 0x0F))
+    {
+      u16Word = _u16Words[i >> 4];
+    }
+    pbDest[i] = u16Word & 1;
+    u16Word >>= 1;
+  }
+  return u16Qty;
+}
+
+/**
+Unpack into one byte (0 or 1) per bit.
+
+@param pu8Dest destination array
+@param u16Max capacity of the destination array
+@return number of bits unpacked (at most size())
+@ingroup bitset
+*/
+uint16_t ModbusBitset::unpack(uint8_t *pu8Dest, uint16_t u16Max) const
+{
+  uint16_t i, u16Qty = (u16Max < _u16Size) ? u16Max : _u16Size;
+  uint16_t u16Word = 0;
+
+  for (i = 0; i < u16Qty; i++)
+  {
+    if (!(i & 0x0F))
+    {
+      u16Word = _u16Words[i >> 4];
+    }
+    pu8Dest[i] = u16Word & 1;
+    u16Word >>= 1;
+  }
+  return u16Qty;
+}
+
+/**
+Bits that differ from another set (XOR), e.g. from the previous scan.
+
+@param previous set to compare with; bits past its size() count as 0
+@param changed receives the differing bits; same size as this set (may
+be previous itself)
+@return number of differing bits
+@ingroup bitset
+*/
+uint16_t ModbusBitset::diff(const ModbusBitset &previous, ModbusBitset &changed) const
+{
+  uint8_t i;
+  uint16_t u16Count = 0;
+
+  for (i = 0; i < wordCount(); i++)
+  {
+    changed._u16Words[i] = _u16Words[i] ^ previous._u16Words[i];
+    u16Count += __builtin_popcount(changed._u16Words[i]);
+  }
+  for (; i < changed.wordCount(); i++)
+  {
+    changed._u16Words[i] = 0;
+  }
+  changed._u16Size = _u16Size;
+  return u16Count;
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+/**
+Clear the bits past size(), which every word-wide operation relies on.
+*/
+void ModbusBitset::trim(void)
+{
+  uint8_t i = wordCount();
+
+  if (_u16Size & 0x0F)
+  {
+    _u16Words[i - 1] &= (uint16_t) ((1U << (_u16Size & 0x0F)) - 1);
+  }
+  for (; i < ku8MaxWords; i++)
+  {
+    _u16Words[i] = 0;
+  }
+}
@@ -0,0 +1,83 @@
+/**
+@file
+Bit-packed coil/discrete input sets.
+
+@defgroup bitset ModbusMaster Coil Bitsets
+*/
+/*
+
+  ModbusBitset.h - Bit-packed coil/discrete input sets for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusBitset_h
+#define ModbusBitset_h
+
+/* _____STANDARD INCLUDES____________________________________________________ */
+// include types & constants of Wiring core API
+#include "application.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Up to 2000 coil or discrete input states, the most a single 0x01/0x02
+request returns or a 0x0F request writes.
+
+Bits are packed 16 per word, LSB first, as in the response buffer: bit
+i is the state of the i-th coil of the request. Bits past size() are
+always 0, so every operation works a whole word at a time: unpack() into
+one bool/byte per coil, count() of the coils set, and diff() against the
+previous scan, which yields the coils that changed, walked with next().
+A panel reading 1500 inputs per cycle thus only visits the few that
+changed.
+
+Filled by ModbusMaster::getResponseBits() or
+ModbusRequest::getResponseBits(); written by ModbusMaster::writeCoils().
+
+@ingroup bitset
+*/
+class ModbusBitset
+{
+  public:
+    static const uint16_t ku16MaxBits                    = 2000; ///< coils per request (protocol limit)
+    static const uint8_t  ku8MaxWords                    = 125;  ///< words holding ku16MaxBits
+
+    ModbusBitset();
+
+    void     clear(void);
+    void     resize(uint16_t);
+    void     assign(const uint16_t *, uint16_t);
+
+    uint16_t size(void) const { return _u16Size; }
+    uint8_t  wordCount(void) const { return (uint8_t) ((_u16Size + 15) >> 4); }
+    const uint16_t *words(void) const { return _u16Words; }
+
+    bool     get(uint16_t) const;
+    void     set(uint16_t, bool);
+    uint16_t count(void) const;
+    int16_t  next(uint16_t) const;
+    uint16_t unpack(bool *, uint16_t) const;
+    uint16_t unpack(uint8_t *, uint16_t) const;
+    uint16_t diff(const ModbusBitset &, ModbusBitset &) const;
+
+  private:
+    uint16_t _u16Words[ku8MaxWords];                             ///< bits, 16 per word, LSB first
+    uint16_t _u16Size;                                           ///< number of bits
+
+    void     trim(void);
+};
+#endif
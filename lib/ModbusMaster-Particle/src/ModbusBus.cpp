@@ -0,0 +1,800 @@
+/**
+@file
+Multi-slave bus manager: one serial port, many slave IDs.
+*/
+/*
+
+  ModbusBus.cpp - Multi-slave bus manager for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusBus.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+/**
+Constructor.
+
+@ingroup bus
+*/
+ModbusBus::ModbusBus()
+{
+  _u8Slaves = 0;
+  _u8OfflineThreshold = 3;
+  _u32MinBackoff = 1000;
+  _u32MaxBackoff = 60000;
+  _active = NULL;
+  _activePlan = false;
+  _u8Requests = 0;
+  _u32Sequence = 0;
+  _requestActive = false;
+  _latch = NULL;
+}
+
+/**
+Attach the bus to a hardware UART.
+
+Configure the port speed through master().setSpeed() afterwards.
+
+@ingroup bus
+*/
+void ModbusBus::begin(USARTSerial &serial)
+{
+  _node.begin(1, serial);
+  _node.enableAsync();
+}
+
+/**
+Attach the bus to any ModbusSerial port.
+
+@ingroup bus
+*/
+void ModbusBus::begin(ModbusSerial &serial)
+{
+  _node.begin(1, serial);
+  _node.enableAsync();
+}
+
+/**
+Shared transaction engine, for speed and callback configuration.
+
+Do not start transactions on it directly; queue them with submit().
+
+@ingroup bus
+*/
+ModbusMaster &ModbusBus::master(void)
+{
+  return _node;
+}
+
+/**
+Register a slave on the bus.
+
+@param u8Slave Modbus slave ID (1..247)
+@param u8Weight share of the bus relative to other busy slaves (1..)
+@param u16Timeout response timeout [milliseconds]; 0 for the master default
+@param u8Retries extra attempts for requests that timed out or arrived corrupted
+@return false if the slave is already registered or the bus is full
+@ingroup bus
+*/
+bool ModbusBus::addSlave(uint8_t u8Slave, uint8_t u8Weight, uint16_t u16Timeout,
+  uint8_t u8Retries)
+{
+  if (_u8Slaves >= ku8MaxSlaves || find(u8Slave))
+  {
+    return false;
+  }
+
+  Slave &slave = _slaves[_u8Slaves++];
+  slave.u8ID = u8Slave;
+  slave.u8Weight = u8Weight ? u8Weight : 1;
+  slave.i16Current = 0;
+  slave.u16Timeout = u16Timeout;
+  slave.u8Retries = u8Retries;
+  slave.u8Health = ku8HealthOnline;
+  slave.u8Misses = 0;
+  slave.u32LastSeen = 0;
+  slave.u32Backoff = _u32MinBackoff;
+  slave.u32NextProbe = 0;
+  slave.u32Transactions = 0;
+  slave.u32Failures = 0;
+  slave.u8Head = 0;
+  slave.u8Count = 0;
+  slave.plan = NULL;
+  return true;
+}
+
+/**
+Attach a poll plan to a registered slave.
+
+The plan's due points are read whenever the slave's request queue is
+empty and it is the slave's turn on the bus.
+
+@return false if the slave is not registered
+@ingroup bus
+*/
+bool ModbusBus::attachPlan(uint8_t u8Slave, ModbusPollPlan &plan)
+{
+  Slave *slave = find(u8Slave);
+
+  if (!slave)
+  {
+    return false;
+  }
+  plan.setSlave(u8Slave);
+  slave->plan = &plan;
+  return true;
+}
+
+/**
+Set how many consecutive missed responses demote a slave to offline.
+
+@param u8Misses missed responses (default 3)
+@ingroup bus
+*/
+void ModbusBus::setOfflineThreshold(uint8_t u8Misses)
+{
+  _u8OfflineThreshold = u8Misses ? u8Misses : 1;
+}
+
+/**
+Set the probe back-off of offline slaves.
+
+The first probe happens u32Min after demotion; each failed probe doubles
+the period, up to u32Max.
+
+@param u32Min first back-off period [milliseconds] (default 1000)
+@param u32Max longest back-off period [milliseconds] (default 60000)
+@ingroup bus
+*/
+void ModbusBus::setBackoff(uint32_t u32Min, uint32_t u32Max)
+{
+  _u32MinBackoff = u32Min;
+  _u32MaxBackoff = (u32Max > u32Min) ? u32Max : u32Min;
+}
+
+/**
+Queue a request for a slave.
+
+@param u8Slave registered slave ID
+@param u8Function Modbus function 0x01..0x06
+@param u16Address first coil/register (0x0000..0xFFFF)
+@param u16Value quantity to read (0x01..0x04); value to write (0x05, 0x06)
+@param callback called when the request completes; may be NULL
+@param context passed to the callback
+@return ModbusMaster::ku8MBTransactionPending if queued;
+ModbusMaster::ku8MBBusy if the slave's queue is full;
+ModbusMaster::ku8MBSlaveOffline if the slave is offline and in back-off;
+ModbusMaster::ku8MBInvalidSlaveID if the slave is not registered;
+ModbusMaster::ku8MBIllegalFunction if the function is not supported
+@ingroup bus
+*/
+uint8_t ModbusBus::submit(uint8_t u8Slave, uint8_t u8Function, uint16_t u16Address,
+  uint16_t u16Value, Callback callback, void *context)
+{
+  Slave *slave = find(u8Slave);
+
+  if (!slave)
+  {
+    return ModbusMaster::ku8MBInvalidSlaveID;
+  }
+  if (u8Function < 0x01 || u8Function > 0x06)
+  {
+    return ModbusMaster::ku8MBIllegalFunction;
+  }
+  if (slave->u8Health == ku8HealthOffline && (int32_t) (millis() - slave->u32NextProbe) < 0)
+  {
+    return ModbusMaster::ku8MBSlaveOffline;
+  }
+  if (slave->u8Count >= ku8QueueSize)
+  {
+    return ModbusMaster::ku8MBBusy;
+  }
+
+  Job &job = slave->jobs[(slave->u8Head + slave->u8Count++) % ku8QueueSize];
+  job.u8Function = u8Function;
+  job.u8Attempts = 0;
+  job.u16Address = u16Address;
+  job.u16Value = u16Value;
+  job.callback = callback;
+  job.context = context;
+  return ModbusMaster::ku8MBTransactionPending;
+}
+
+/**
+Queue a request object.
+
+Request objects are served before the slave queues and poll plans, most
+urgent priority first and in submission order within a priority, except
+ku8PriorityBackground ones which only run when no slave has work. The
+slave does not have to be registered; if it is, its response timeout
+and health apply as for submit() by slave ID (but not its retry count:
+use ModbusMaster::setRetryPolicy()).
+
+The request must stay valid until it completes; its status() reads
+ModbusMaster::ku8MBTransactionPending until then.
+
+@param request request built with one of its function methods
+@param u8Priority ModbusBus::ku8PriorityControl ..
+ModbusBus::ku8PriorityBackground
+@param callback called when the request completes; may be NULL
+@param context passed to the callback
+@return ModbusMaster::ku8MBTransactionPending if queued;
+ModbusMaster::ku8MBBusy if the queue is full;
+ModbusMaster::ku8MBSlaveOffline if the slave is offline and in back-off;
+ModbusMaster::ku8MBIllegalFunction if the request was not built
+@ingroup bus
+*/
+uint8_t ModbusBus::submit(ModbusRequest &request, uint8_t u8Priority,
+  RequestCallback callback, void *context)
+{
+  Slave *slave = find(request.slave());
+
+  if (!request.valid())
+  {
+    return ModbusMaster::ku8MBIllegalFunction;
+  }
+  if (slave && slave->u8Health == ku8HealthOffline &&
+    (int32_t) (millis() - slave->u32NextProbe) < 0)
+  {
+    return ModbusMaster::ku8MBSlaveOffline;
+  }
+  if (_u8Requests >= ku8RequestQueueSize)
+  {
+    return ModbusMaster::ku8MBBusy;
+  }
+
+  Pending &pending = _requests[_u8Requests++];
+  pending.request = &request;
+  pending.u8Priority = u8Priority;
+  pending.u32Sequence = _u32Sequence++;
+  pending.callback = callback;
+  pending.context = context;
+  request.setStatus(ModbusMaster::ku8MBTransactionPending);
+  return ModbusMaster::ku8MBTransactionPending;
+}
+
+/**
+Take a synchronised snapshot of every slave's values.
+
+Queues a broadcast write (slave ID ModbusMaster::ku8MBBroadcast) ahead of
+everything else; the register or coil it writes is device specific, e.g.
+a "latch measurements" command that makes every slave freeze its values
+at the instant it receives the frame. Once the broadcast has been sent
+every attached poll plan is made due, so the next scan reads the frozen
+values. Fleet-wide latch or clock writes thus cost one frame instead of
+one round trip per slave.
+
+@param latch broadcast write built with one of its function methods
+@param callback called when the broadcast has completed; may be NULL
+@param context passed to the callback
+@return ModbusMaster::ku8MBTransactionPending if queued;
+ModbusMaster::ku8MBInvalidSlaveID if the request is not a broadcast;
+otherwise as submit()
+@ingroup bus
+*/
+uint8_t ModbusBus::snapshot(ModbusRequest &latch, RequestCallback callback, void *context)
+{
+  uint8_t u8Status;
+
+  if (latch.valid() && latch.slave() != ModbusMaster::ku8MBBroadcast)
+  {
+    return ModbusMaster::ku8MBInvalidSlaveID;
+  }
+  u8Status = submit(latch, ku8PriorityControl, callback, context);
+  if (u8Status == ModbusMaster::ku8MBTransactionPending)
+  {
+    _latch = &latch;
+  }
+  return u8Status;
+}
+
+/**
+Remove a request object from the queue.
+
+A removed request completes with ModbusMaster::ku8MBCancelled and its
+callback is called before this returns, so a caller waiting on it (see
+ModbusBusWorker::execute()) is released.
+
+@return true if the request was queued; false if it is already in
+progress (it completes normally) or was never queued
+@ingroup bus
+*/
+bool ModbusBus::cancel(ModbusRequest &request)
+{
+  uint8_t i;
+  Pending pending;
+
+  for (i = 0; i < _u8Requests; i++)
+  {
+    if (_requests[i].request == &request)
+    {
+      pending = _requests[i];
+      _requests[i] = _requests[--_u8Requests];
+      if (_latch == &request)
+      {
+        _latch = NULL;
+      }
+      request.complete(ModbusMaster::ku8MBCancelled, NULL);
+      if (pending.callback)
+      {
+        pending.callback(request, pending.context);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+Advance the bus by one step, without blocking.
+
+Call it as often as possible from loop() or a worker thread.
+
+@ingroup bus
+*/
+void ModbusBus::service(void)
+{
+  uint8_t i, u8Status;
+  int8_t i8Request;
+  uint32_t u32Now = millis();
+  Slave *slave;
+
+  if (_requestActive)
+  {
+    u8Status = _node.poll();
+    if (u8Status != ModbusMaster::ku8MBTransactionPending)
+    {
+      finishRequest(u8Status);
+    }
+    return;
+  }
+
+  if (_active)
+  {
+    u8Status = _activePlan ? _active->plan->service(_node) : _node.poll();
+    if (u8Status != ModbusMaster::ku8MBTransactionPending)
+    {
+      complete(*_active, u8Status);
+    }
+    return;
+  }
+
+  // don't keep callers waiting on slaves that are known to be gone
+  for (i = 0; i < _u8Slaves; i++)
+  {
+    if (_slaves[i].u8Health == ku8HealthOffline && _slaves[i].u8Count &&
+      (int32_t) (u32Now - _slaves[i].u32NextProbe) < 0)
+    {
+      failQueued(_slaves[i]);
+    }
+  }
+
+  // request objects jump the round robin; background ones fill its gaps
+  i8Request = nextRequest(false);
+  if (i8Request >= 0)
+  {
+    startRequest(i8Request);
+    return;
+  }
+
+  slave = pick(u32Now);
+  if (slave)
+  {
+    start(*slave);
+    return;
+  }
+
+  i8Request = nextRequest(true);
+  if (i8Request >= 0)
+  {
+    startRequest(i8Request);
+  }
+}
+
+/**
+Check whether the bus has nothing in progress and nothing queued.
+
+Poll plans are not taken into account.
+
+@ingroup bus
+*/
+bool ModbusBus::idle(void)
+{
+  uint8_t i;
+
+  if (_active || _requestActive || _u8Requests)
+  {
+    return false;
+  }
+  for (i = 0; i < _u8Slaves; i++)
+  {
+    if (_slaves[i].u8Count)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+Health of a slave.
+
+@return ModbusBus::ku8HealthOnline, ModbusBus::ku8HealthSuspect or
+ModbusBus::ku8HealthOffline (also for unregistered slaves)
+@ingroup bus
+*/
+uint8_t ModbusBus::health(uint8_t u8Slave)
+{
+  Slave *slave = find(u8Slave);
+  return slave ? slave->u8Health : ku8HealthOffline;
+}
+
+/**
+Time of the last response from a slave.
+
+@return millis() at the time of the response; 0 if it never answered
+@ingroup bus
+*/
+uint32_t ModbusBus::lastSeen(uint8_t u8Slave)
+{
+  Slave *slave = find(u8Slave);
+  return slave ? slave->u32LastSeen : 0;
+}
+
+uint32_t ModbusBus::transactions(uint8_t u8Slave)
+{
+  Slave *slave = find(u8Slave);
+  return slave ? slave->u32Transactions : 0;
+}
+
+uint32_t ModbusBus::failures(uint8_t u8Slave)
+{
+  Slave *slave = find(u8Slave);
+  return slave ? slave->u32Failures : 0;
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+
+ModbusBus::Slave *ModbusBus::find(uint8_t u8Slave)
+{
+  uint8_t i;
+
+  for (i = 0; i < _u8Slaves; i++)
+  {
+    if (_slaves[i].u8ID == u8Slave)
+    {
+      return &_slaves[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+Check whether a slave has a transaction to run now.
+*/
+bool ModbusBus::hasWork(Slave &slave, uint32_t u32Now)
+{
+  if (slave.u8Health == ku8HealthOffline && (int32_t) (u32Now - slave.u32NextProbe) < 0)
+  {
+    return false;
+  }
+  return slave.u8Count || (slave.plan && slave.plan->due());
+}
+
+/**
+Smooth weighted round robin over the slaves that have work.
+
+Every candidate earns its weight in credit, the richest one is picked and
+pays back the total. Over time each busy slave gets a share of the
+transactions proportional to its weight, interleaved rather than in
+bursts; slaves without work earn nothing.
+
+@return next slave to serve; NULL if none has work
+*/
+ModbusBus::Slave *ModbusBus::pick(uint32_t u32Now)
+{
+  uint8_t i;
+  int16_t i16Total = 0;
+  Slave *best = NULL;
+
+  for (i = 0; i < _u8Slaves; i++)
+  {
+    Slave &slave = _slaves[i];
+    if (!hasWork(slave, u32Now))
+    {
+      continue;
+    }
+    slave.i16Current += slave.u8Weight;
+    i16Total += slave.u8Weight;
+    if (!best || slave.i16Current > best->i16Current)
+    {
+      best = &slave;
+    }
+  }
+
+  if (best)
+  {
+    best->i16Current -= i16Total;
+  }
+  return best;
+}
+
+/**
+Start the slave's next transaction: its oldest queued request, or else
+the next block of its poll plan.
+*/
+void ModbusBus::start(Slave &slave)
+{
+  uint8_t u8Status = ModbusMaster::ku8MBIllegalFunction;
+
+  _active = &slave;
+  _node.setSlave(slave.u8ID);
+  if (slave.u16Timeout)
+  {
+    _node.setRequestTimeout(slave.u16Timeout);
+  }
+
+  if (slave.u8Count)
+  {
+    Job &job = slave.jobs[slave.u8Head];
+    _activePlan = false;
+    job.u8Attempts++;
+    switch (job.u8Function)
+    {
+      case 0x01:
+        u8Status = _node.readCoils(job.u16Address, job.u16Value);
+        break;
+
+      case 0x02:
+        u8Status = _node.readDiscreteInputs(job.u16Address, job.u16Value);
+        break;
+
+      case 0x03:
+        u8Status = _node.readHoldingRegisters(job.u16Address, job.u16Value);
+        break;
+
+      case 0x04:
+        u8Status = _node.readInputRegisters(job.u16Address, job.u16Value);
+        break;
+
+      case 0x05:
+        u8Status = _node.writeSingleCoil(job.u16Address, job.u16Value);
+        break;
+
+      case 0x06:
+        u8Status = _node.writeSingleRegister(job.u16Address, job.u16Value);
+        break;
+    }
+  }
+  else
+  {
+    _activePlan = true;
+    u8Status = slave.plan->service(_node);
+  }
+
+  if (u8Status != ModbusMaster::ku8MBTransactionPending)
+  {
+    // nothing was armed (rejected, busy or no block due): the override
+    // must not leak into the next, unrelated transaction
+    _node.setRequestTimeout(0);
+    complete(slave, u8Status);
+  }
+}
+
+/**
+Update the slave's health from the outcome of its transaction.
+
+Only a missing (or foreign) response counts as a miss; exception replies
+and corrupted frames prove the slave is alive.
+*/
+void ModbusBus::complete(Slave &slave, uint8_t u8Status)
+{
+  _active = NULL;
+  updateHealth(slave, u8Status);
+  if (!_activePlan)
+  {
+    finishJob(slave, u8Status);
+  }
+}
+
+/**
+Count the slave's transaction and update its health.
+*/
+void ModbusBus::updateHealth(Slave &slave, uint8_t u8Status)
+{
+  uint32_t u32Now = millis();
+
+  slave.u32Transactions++;
+  if (u8Status != ModbusMaster::ku8MBSuccess)
+  {
+    slave.u32Failures++;
+  }
+
+  if (u8Status == ModbusMaster::ku8MBResponseTimedOut ||
+    u8Status == ModbusMaster::ku8MBInvalidSlaveID)
+  {
+    if (slave.u8Misses < 0xFF)
+    {
+      slave.u8Misses++;
+    }
+    if (slave.u8Health == ku8HealthOffline || slave.u8Misses >= _u8OfflineThreshold)
+    {
+      if (slave.u8Health == ku8HealthOffline)
+      {
+        slave.u32Backoff = (slave.u32Backoff * 2 < _u32MaxBackoff) ? slave.u32Backoff * 2 : _u32MaxBackoff;
+      }
+      slave.u8Health = ku8HealthOffline;
+      slave.u32NextProbe = u32Now + slave.u32Backoff;
+    }
+    else
+    {
+      slave.u8Health = ku8HealthSuspect;
+    }
+  }
+  else
+  {
+    slave.u8Misses = 0;
+    slave.u8Health = ku8HealthOnline;
+    slave.u32Backoff = _u32MinBackoff;
+    slave.u32LastSeen = u32Now;
+  }
+}
+
+/**
+Most urgent queued request object.
+
+@param background true to consider ku8PriorityBackground requests too
+@return index in _requests; -1 if none
+*/
+int8_t ModbusBus::nextRequest(bool background)
+{
+  uint8_t i;
+  int8_t i8Best = -1;
+
+  for (i = 0; i < _u8Requests; i++)
+  {
+    const Pending &pending = _requests[i];
+    if (!background && pending.u8Priority >= ku8PriorityBackground)
+    {
+      continue;
+    }
+    if (i8Best < 0 || pending.u8Priority < _requests[i8Best].u8Priority ||
+      (pending.u8Priority == _requests[i8Best].u8Priority &&
+      (int32_t) (pending.u32Sequence - _requests[i8Best].u32Sequence) < 0))
+    {
+      i8Best = i;
+    }
+  }
+  return i8Best;
+}
+
+/**
+Dequeue a request object and start it, unless its slave is offline.
+*/
+void ModbusBus::startRequest(uint8_t u8Index)
+{
+  uint8_t u8Status;
+  Slave *slave;
+
+  _request = _requests[u8Index];
+  _requests[u8Index] = _requests[--_u8Requests];
+
+  slave = find(_request.request->slave());
+  if (slave && slave->u8Health == ku8HealthOffline &&
+    (int32_t) (millis() - slave->u32NextProbe) < 0)
+  {
+    _request.request->complete(ModbusMaster::ku8MBSlaveOffline, NULL);
+    if (_request.callback)
+    {
+      _request.callback(*_request.request, _request.context);
+    }
+    return;
+  }
+  if (slave && slave->u16Timeout)
+  {
+    _node.setRequestTimeout(slave->u16Timeout);
+  }
+
+  _requestActive = true;
+  u8Status = _node.issue(*_request.request);
+  if (u8Status != ModbusMaster::ku8MBTransactionPending)
+  {
+    _node.setRequestTimeout(0);
+    finishRequest(u8Status);
+  }
+}
+
+/**
+Account for the completed request object and report it to its callback.
+*/
+void ModbusBus::finishRequest(uint8_t u8Status)
+{
+  uint8_t i;
+  Slave *slave = find(_request.request->slave());
+
+  _requestActive = false;
+  if (slave)
+  {
+    updateHealth(*slave, u8Status);
+  }
+  if (_request.request == _latch)
+  {
+    _latch = NULL;
+    if (u8Status == ModbusMaster::ku8MBSuccess)
+    {
+      for (i = 0; i < _u8Slaves; i++)
+      {
+        if (_slaves[i].plan)
+        {
+          _slaves[i].plan->trigger();
+        }
+      }
+    }
+  }
+  if (!_request.request->done())
+  {
+    _request.request->complete(u8Status, NULL);
+  }
+  if (_request.callback)
+  {
+    _request.callback(*_request.request, _request.context);
+  }
+}
+
+/**
+Retry the slave's current request or report it to its callback.
+*/
+void ModbusBus::finishJob(Slave &slave, uint8_t u8Status)
+{
+  Job job = slave.jobs[slave.u8Head];
+
+  if ((u8Status == ModbusMaster::ku8MBResponseTimedOut ||
+    u8Status == ModbusMaster::ku8MBInvalidCRC ||
+    u8Status == ModbusMaster::ku8MBInvalidFrame) &&
+    job.u8Attempts <= slave.u8Retries && slave.u8Health != ku8HealthOffline)
+  {
+    return; // left at the head of the queue
+  }
+
+  slave.u8Head = (slave.u8Head + 1) % ku8QueueSize;
+  slave.u8Count--;
+  if (job.callback)
+  {
+    job.callback(slave.u8ID, u8Status, _node, job.context);
+  }
+}
+
+/**
+Fail every queued request of an offline slave.
+*/
+void ModbusBus::failQueued(Slave &slave)
+{
+  while (slave.u8Count)
+  {
+    Job job = slave.jobs[slave.u8Head];
+    slave.u8Head = (slave.u8Head + 1) % ku8QueueSize;
+    slave.u8Count--;
+    if (job.callback)
+    {
+      job.callback(slave.u8ID, ModbusMaster::ku8MBSlaveOffline, _node, job.context);
+    }
+  }
+}
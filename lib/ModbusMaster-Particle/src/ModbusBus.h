@@ -0,0 +1,199 @@
+/**
+@file
+Multi-slave bus manager: one serial port, many slave IDs.
+
+@defgroup bus ModbusMaster Multi-Slave Bus Manager
+*/
+/*
+
+  ModbusBus.h - Multi-slave bus manager for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusBus_h
+#define ModbusBus_h
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusMaster-Particle.h"
+#include "ModbusPollPlan.h"
+#include "ModbusRequest.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Schedules transactions for many slaves sharing one serial port.
+
+Every slave has its own request queue, optional poll plan, response
+timeout, retry count and health. Each service() call advances at most one
+transaction on the shared ModbusMaster (run in asynchronous mode) and,
+when the bus is free, picks the next slave by smooth weighted round
+robin among the slaves that have work: a slave with weight 2 gets twice
+the transactions of a slave with weight 1 when both are busy, and idle
+slaves cost nothing.
+
+Request objects (ModbusRequest) go through a separate priority queue
+that is served ahead of the round robin: a control write or on-demand
+read only waits for the transaction already on the wire, however busy
+the slave queues and poll plans are. Background priority requests, on
+the contrary, only run when no slave has work.
+
+A slave that fails to answer ku8OfflineThreshold times in a row is
+demoted to offline. Its queued requests then fail immediately with
+ModbusMaster::ku8MBSlaveOffline instead of each burning a response
+timeout, and only one probe transaction is allowed per back-off period
+(doubling up to the configured maximum) until it answers again.
+
+@ingroup bus
+*/
+class ModbusBus
+{
+  public:
+    static const uint8_t ku8MaxSlaves                    = 32;   ///< slaves per bus
+    static const uint8_t ku8QueueSize                    = 8;    ///< queued requests per slave
+    static const uint8_t ku8RequestQueueSize             = 16;   ///< queued request objects, all slaves
+
+    // request object priorities, most urgent first
+    static const uint8_t ku8PriorityControl              = 0;    ///< control writes
+    static const uint8_t ku8PriorityInteractive          = 1;    ///< on-demand reads
+    static const uint8_t ku8PriorityBackground           = 2;    ///< bulk transfers; yield to the slave queues and poll plans
+
+    // slave health
+    static const uint8_t ku8HealthOnline                 = 0;    ///< answered the last transaction
+    static const uint8_t ku8HealthSuspect                = 1;    ///< missed at least one response
+    static const uint8_t ku8HealthOffline                = 2;    ///< demoted; probed once per back-off period
+
+    /**
+    Request completion callback.
+
+    @param u8Slave slave the request was sent to
+    @param u8Status 0 on success; exception number on failure
+    @param node master holding the response (valid during the call only)
+    @param context pointer passed when the request was queued
+    */
+    typedef void (*Callback)(uint8_t u8Slave, uint8_t u8Status, ModbusMaster &node, void *context);
+
+    /**
+    Request object completion callback.
+
+    @param request completed request; its status() and response are set
+    @param context pointer passed when the request was queued
+    */
+    typedef void (*RequestCallback)(ModbusRequest &request, void *context);
+
+    ModbusBus();
+
+    void begin(USARTSerial &serial);
+    void begin(ModbusSerial &serial);
+    ModbusMaster &master(void);
+
+    bool addSlave(uint8_t, uint8_t = 1, uint16_t = 0, uint8_t = 0);
+    bool attachPlan(uint8_t, ModbusPollPlan &);
+    void setOfflineThreshold(uint8_t);
+    void setBackoff(uint32_t, uint32_t);
+
+    uint8_t submit(uint8_t, uint8_t, uint16_t, uint16_t, Callback = NULL, void * = NULL);
+    uint8_t submit(ModbusRequest &, uint8_t = ku8PriorityInteractive, RequestCallback = NULL, void * = NULL);
+    bool    cancel(ModbusRequest &);
+    uint8_t snapshot(ModbusRequest &, RequestCallback = NULL, void * = NULL);
+
+    void service(void);
+    bool idle(void);
+
+    uint8_t  health(uint8_t);
+    uint32_t lastSeen(uint8_t);
+    uint32_t transactions(uint8_t);
+    uint32_t failures(uint8_t);
+
+  private:
+    /**
+    Queued request.
+    */
+    struct Job
+    {
+      uint8_t  u8Function;                                       ///< Modbus function 0x01..0x06
+      uint8_t  u8Attempts;                                       ///< attempts made so far
+      uint16_t u16Address;                                       ///< first coil/register
+      uint16_t u16Value;                                         ///< quantity to read, or value to write
+      Callback callback;                                         ///< completion callback; may be NULL
+      void*    context;                                          ///< passed to the callback
+    };
+
+    /**
+    Per-slave scheduling and health state.
+    */
+    struct Slave
+    {
+      uint8_t  u8ID;                                             ///< Modbus slave ID
+      uint8_t  u8Weight;                                         ///< share of the bus when busy
+      int16_t  i16Current;                                       ///< smooth weighted round robin credit
+      uint16_t u16Timeout;                                       ///< response timeout; 0 for the master default
+      uint8_t  u8Retries;                                        ///< extra attempts for timed out/corrupted requests
+      uint8_t  u8Health;                                         ///< ku8Health*
+      uint8_t  u8Misses;                                         ///< consecutive transactions without response
+      uint32_t u32LastSeen;                                      ///< time of the last response [milliseconds]
+      uint32_t u32Backoff;                                       ///< current back-off period [milliseconds]
+      uint32_t u32NextProbe;                                     ///< earliest probe while offline [milliseconds]
+      uint32_t u32Transactions;                                  ///< transactions completed
+      uint32_t u32Failures;                                      ///< transactions failed
+      Job      jobs[ku8QueueSize];                               ///< request queue (ring buffer)
+      uint8_t  u8Head;                                           ///< index of the oldest queued request
+      uint8_t  u8Count;                                          ///< number of queued requests
+      ModbusPollPlan* plan;                                      ///< poll plan serviced when the queue is empty
+    };
+
+    /**
+    Queued request object.
+    */
+    struct Pending
+    {
+      ModbusRequest*  request;                                   ///< request to run
+      uint8_t         u8Priority;                                ///< ku8Priority*
+      uint32_t        u32Sequence;                               ///< submission order, FIFO within a priority
+      RequestCallback callback;                                  ///< completion callback; may be NULL
+      void*           context;                                   ///< passed to the callback
+    };
+
+    ModbusMaster _node;                                          ///< shared transaction engine
+    Slave    _slaves[ku8MaxSlaves];                              ///< registered slaves
+    uint8_t  _u8Slaves;                                          ///< number of registered slaves
+    uint8_t  _u8OfflineThreshold;                                ///< misses before a slave is demoted
+    uint32_t _u32MinBackoff;                                     ///< first back-off period [milliseconds]
+    uint32_t _u32MaxBackoff;                                     ///< longest back-off period [milliseconds]
+
+    Slave*   _active;                                            ///< slave of the transaction in progress; NULL if idle
+    bool     _activePlan;                                        ///< true if the transaction belongs to the slave's plan
+
+    Pending  _requests[ku8RequestQueueSize];                     ///< queued request objects, unordered
+    uint8_t  _u8Requests;                                        ///< number of queued request objects
+    uint32_t _u32Sequence;                                       ///< sequence number of the next submission
+    Pending  _request;                                           ///< request object in progress
+    bool     _requestActive;                                     ///< true while _request is in progress
+    ModbusRequest* _latch;                                       ///< queued snapshot() broadcast; NULL if none
+
+    Slave*  find(uint8_t u8Slave);
+    bool    hasWork(Slave &slave, uint32_t u32Now);
+    Slave*  pick(uint32_t u32Now);
+    void    start(Slave &slave);
+    void    complete(Slave &slave, uint8_t u8Status);
+    void    updateHealth(Slave &slave, uint8_t u8Status);
+    int8_t  nextRequest(bool background);
+    void    startRequest(uint8_t u8Index);
+    void    finishRequest(uint8_t u8Status);
+    void    finishJob(Slave &slave, uint8_t u8Status);
+    void    failQueued(Slave &slave);
+};
+#endif
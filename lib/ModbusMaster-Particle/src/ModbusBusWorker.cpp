@@ -0,0 +1,331 @@
+/**
+@file
+Bus worker: runs one ModbusBus on its own thread.
+*/
+/*
+
+  ModbusBusWorker.cpp - Threaded bus runtime for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusBusWorker.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+/**
+Constructor.
+
+@ingroup worker
+*/
+ModbusBusWorker::ModbusBusWorker()
+{
+  _store = NULL;
+  _u8Bus = 0;
+  _running = false;
+}
+
+/**
+Attach the worker to a hardware UART.
+
+@param u8Bus index stored with the published values (e.g. 1 for Serial1)
+@param serial port the bus is wired to
+@param store where the values read by attached plans are published
+@ingroup worker
+*/
+void ModbusBusWorker::begin(uint8_t u8Bus, USARTSerial &serial, ModbusRegisterStore &store)
+{
+  _u8Bus = u8Bus;
+  _store = &store;
+  _bus.begin(serial);
+}
+
+/**
+Attach the worker to any ModbusSerial port.
+
+@ingroup worker
+*/
+void ModbusBusWorker::begin(uint8_t u8Bus, ModbusSerial &serial, ModbusRegisterStore &store)
+{
+  _u8Bus = u8Bus;
+  _store = &store;
+  _bus.begin(serial);
+}
+
+/**
+Bus driven by the worker, for configuration before start().
+
+@ingroup worker
+*/
+ModbusBus &ModbusBusWorker::bus(void)
+{
+  return _bus;
+}
+
+/**
+Attach a poll plan to a slave and publish its values to the store.
+
+Registers the slave with default settings if needed; call
+bus().addSlave() first for a different weight, timeout or retry count.
+Must be called before start().
+
+@return false if the slave cannot be registered
+@ingroup worker
+*/
+bool ModbusBusWorker::attachPlan(uint8_t u8Slave, ModbusPollPlan &plan)
+{
+  _bus.addSlave(u8Slave);
+  if (!_bus.attachPlan(u8Slave, plan))
+  {
+    return false;
+  }
+  plan.onUpdate(publish, this);
+  return true;
+}
+
+/**
+Start the worker thread.
+
+@param priority thread priority
+@param stackSize thread stack size [bytes]
+@return false if already running or the thread could not be created
+@ingroup worker
+*/
+bool ModbusBusWorker::start(os_thread_prio_t priority, size_t stackSize)
+{
+  if (_running)
+  {
+    return false;
+  }
+  _thread = Thread("modbus", run, this, priority, stackSize);
+  _running = _thread.isValid();
+  return _running;
+}
+
+/**
+Check whether the worker thread is running.
+
+@ingroup worker
+*/
+bool ModbusBusWorker::running(void)
+{
+  return _running;
+}
+
+/**
+Queue a request on the bus, from any thread.
+
+@see ModbusBus::submit()
+@ingroup worker
+*/
+uint8_t ModbusBusWorker::submit(uint8_t u8Slave, uint8_t u8Function, uint16_t u16Address,
+  uint16_t u16Value, ModbusBus::Callback callback, void *context)
+{
+  uint8_t u8Status;
+
+  _mutex.lock();
+  u8Status = _bus.submit(u8Slave, u8Function, u16Address, u16Value, callback, context);
+  _mutex.unlock();
+  return u8Status;
+}
+
+/**
+Queue a request object on the bus, from any thread.
+
+@see ModbusBus::submit(ModbusRequest &, uint8_t, ModbusBus::RequestCallback, void *)
+@ingroup worker
+*/
+uint8_t ModbusBusWorker::submit(ModbusRequest &request, uint8_t u8Priority,
+  ModbusBus::RequestCallback callback, void *context)
+{
+  uint8_t u8Status;
+
+  _mutex.lock();
+  u8Status = _bus.submit(request, u8Priority, callback, context);
+  _mutex.unlock();
+  return u8Status;
+}
+
+/**
+Queue a latch broadcast followed by a scan of every plan, from any thread.
+
+@see ModbusBus::snapshot()
+@ingroup worker
+*/
+uint8_t ModbusBusWorker::snapshot(ModbusRequest &latch, ModbusBus::RequestCallback callback,
+  void *context)
+{
+  uint8_t u8Status;
+
+  _mutex.lock();
+  u8Status = _bus.snapshot(latch, callback, context);
+  _mutex.unlock();
+  return u8Status;
+}
+
+/**
+Run a request object and wait for its completion.
+
+Blocks the calling thread (not the bus) on a semaphore released by the
+worker thread. Must not be called from the worker thread itself, i.e.
+from a completion callback.
+
+@param request request built with one of its function methods
+@param u8Priority ModbusBus::ku8PriorityControl ..
+ModbusBus::ku8PriorityBackground
+@return final status of the request (0 on success; exception number on
+failure; ModbusMaster::ku8MBCancelled if another thread cancelled it), or
+the reason it could not be queued
+@ingroup worker
+*/
+uint8_t ModbusBusWorker::execute(ModbusRequest &request, uint8_t u8Priority)
+{
+  uint8_t u8Status;
+  os_semaphore_t semaphore;
+
+  if (os_semaphore_create(&semaphore, 1, 0))
+  {
+    return ModbusMaster::ku8MBBusy;
+  }
+
+  u8Status = submit(request, u8Priority, signal, semaphore);
+  if (u8Status == ModbusMaster::ku8MBTransactionPending)
+  {
+    os_semaphore_take(semaphore, CONCURRENT_WAIT_FOREVER, false);
+    u8Status = request.status();
+  }
+  os_semaphore_destroy(semaphore);
+  return u8Status;
+}
+
+/**
+Remove a queued request object, from any thread.
+
+The request's callback, if any, runs on the calling thread.
+
+@see ModbusBus::cancel()
+@ingroup worker
+*/
+bool ModbusBusWorker::cancel(ModbusRequest &request)
+{
+  bool cancelled;
+
+  _mutex.lock();
+  cancelled = _bus.cancel(request);
+  _mutex.unlock();
+  return cancelled;
+}
+
+/**
+Copy the instrumentation of the bus, from any thread.
+
+@see ModbusMaster::getStats()
+@ingroup worker
+*/
+void ModbusBusWorker::getStats(ModbusMasterStats &stats)
+{
+  _mutex.lock();
+  _bus.master().getStats(stats);
+  _mutex.unlock();
+}
+
+/**
+Reset the instrumentation of the bus, from any thread.
+
+@ingroup worker
+*/
+void ModbusBusWorker::clearStats(void)
+{
+  _mutex.lock();
+  _bus.master().clearStats();
+  _mutex.unlock();
+}
+
+/**
+Health of a slave on the bus, from any thread.
+
+@see ModbusBus::health()
+@ingroup worker
+*/
+uint8_t ModbusBusWorker::health(uint8_t u8Slave)
+{
+  uint8_t u8Health;
+
+  _mutex.lock();
+  u8Health = _bus.health(u8Slave);
+  _mutex.unlock();
+  return u8Health;
+}
+
+/**
+Advance the bus by one step.
+
+Called in a loop by the worker thread; can be called from loop() instead
+of start() on single-threaded builds.
+
+@ingroup worker
+*/
+void ModbusBusWorker::service(void)
+{
+  _mutex.lock();
+  _bus.service();
+  _mutex.unlock();
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+os_thread_return_t ModbusBusWorker::run(void *param)
+{
+  ModbusBusWorker *worker = (ModbusBusWorker *) param;
+  bool idle, transmitting;
+
+  for (;;)
+  {
+    worker->_mutex.lock();
+    worker->_bus.service();
+    idle = worker->_bus.idle();
+    transmitting = worker->_bus.master().transmitting();
+    worker->_mutex.unlock();
+
+    // only the driver turnaround needs a tight loop; while the response
+    // is awaited the port buffers it, so block and leave the CPU to the
+    // other threads (and workers)
+    if (transmitting)
+    {
+      os_thread_yield();
+    }
+    else
+    {
+      delay(idle ? ku32IdleDelay : ku32PendingDelay);
+    }
+  }
+}
+
+void ModbusBusWorker::publish(ModbusPollPlan &plan, uint8_t u8Point, void *context)
+{
+  ModbusBusWorker *worker = (ModbusBusWorker *) context;
+
+  worker->_store->publish(worker->_u8Bus, plan.slave(), plan.function(u8Point),
+    plan.address(u8Point), plan.status(u8Point), plan.getDouble(u8Point));
+}
+
+void ModbusBusWorker::signal(ModbusRequest &request, void *context)
+{
+  (void) request;
+  os_semaphore_give((os_semaphore_t) context, false);
+}
@@ -0,0 +1,99 @@
+/**
+@file
+Bus worker: runs one ModbusBus on its own thread.
+
+@defgroup worker ModbusMaster Bus Worker
+*/
+/*
+
+  ModbusBusWorker.h - Threaded bus runtime for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusBusWorker_h
+#define ModbusBusWorker_h
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusBus.h"
+#include "ModbusRegisterStore.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Drives one ModbusBus (one UART, its own slaves, queues and poll plans)
+from a dedicated thread.
+
+A controller with meters on several UARTs runs one worker per port, so
+the buses are polled in parallel and an acquisition cycle takes as long
+as the slowest bus instead of the sum of all of them. Every value read
+by an attached poll plan is published to a shared ModbusRegisterStore,
+tagged with the worker's bus index.
+
+Configure the bus (speed, slaves, plans) before start(). Afterwards the
+worker thread owns it: use only the thread-safe calls below. Callbacks of
+submitted requests run on the worker thread (on the calling thread for a
+request removed by cancel()).
+
+Any thread (loop(), cloud function handlers, ...) can share the bus
+through request objects: submit() queues one by priority and returns,
+with the request itself acting as the future (done(), status()) or a
+callback reporting its completion; execute() blocks the calling thread
+until the response is in. Control and interactive requests only wait
+for the transaction already on the wire, see ModbusBus::submit().
+
+@ingroup worker
+*/
+class ModbusBusWorker
+{
+  public:
+    static const uint32_t ku32IdleDelay                  = 1;    ///< sleep when the bus has nothing in progress [milliseconds]
+    static const uint32_t ku32PendingDelay               = 1;    ///< sleep while a response is awaited [milliseconds]
+
+    ModbusBusWorker();
+
+    void begin(uint8_t, USARTSerial &, ModbusRegisterStore &);
+    void begin(uint8_t, ModbusSerial &, ModbusRegisterStore &);
+    ModbusBus &bus(void);
+    bool attachPlan(uint8_t, ModbusPollPlan &);
+    bool start(os_thread_prio_t = OS_THREAD_PRIORITY_DEFAULT, size_t = OS_THREAD_STACK_SIZE_DEFAULT);
+    bool running(void);
+
+    // thread-safe once started
+    uint8_t submit(uint8_t, uint8_t, uint16_t, uint16_t, ModbusBus::Callback = NULL, void * = NULL);
+    uint8_t submit(ModbusRequest &, uint8_t = ModbusBus::ku8PriorityInteractive,
+      ModbusBus::RequestCallback = NULL, void * = NULL);
+    uint8_t execute(ModbusRequest &, uint8_t = ModbusBus::ku8PriorityInteractive);
+    bool    cancel(ModbusRequest &);
+    uint8_t snapshot(ModbusRequest &, ModbusBus::RequestCallback = NULL, void * = NULL);
+    void    getStats(ModbusMasterStats &);
+    void    clearStats(void);
+    uint8_t health(uint8_t);
+    void    service(void);
+
+  private:
+    ModbusBus            _bus;                                   ///< the bus driven by this worker
+    ModbusRegisterStore* _store;                                 ///< where plan values are published
+    uint8_t              _u8Bus;                                 ///< bus index stored with the values
+    RecursiveMutex       _mutex;                                 ///< held while the bus is touched
+    Thread               _thread;                                ///< worker thread, once started
+    bool                 _running;                               ///< true once start() succeeded
+
+    static os_thread_return_t run(void *param);
+    static void publish(ModbusPollPlan &plan, uint8_t u8Point, void *context);
+    static void signal(ModbusRequest &request, void *context);
+};
+#endif
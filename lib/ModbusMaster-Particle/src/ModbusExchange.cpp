@@ -0,0 +1,290 @@
+/**
+@file
+Write-then-read exchanges fused into function 0x17 where supported.
+*/
+/*
+
+  ModbusExchange.cpp - Fused write/read exchanges for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusExchange.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+/**
+Constructor.
+
+Creates a helper without a transport; call begin() before exchanging.
+
+@ingroup exchange
+*/
+ModbusExchange::ModbusExchange()
+{
+  _worker = NULL;
+  _node = NULL;
+  _u8Priority = ModbusBus::ku8PriorityControl;
+  _u32Fused = 0;
+  _u32Split = 0;
+  clearSupport();
+}
+
+/**
+Exchange through a bus worker.
+
+@param worker bus worker the slaves are on
+@param u8Priority ModbusBus::ku8PriorityControl ..
+ModbusBus::ku8PriorityBackground
+@ingroup exchange
+*/
+void ModbusExchange::begin(ModbusBusWorker &worker, uint8_t u8Priority)
+{
+  _worker = &worker;
+  _node = NULL;
+  _u8Priority = u8Priority;
+}
+
+/**
+Exchange through a master directly.
+
+An asynchronous master is polled until each request completes.
+
+@param node master the slaves are on
+@ingroup exchange
+*/
+void ModbusExchange::begin(ModbusMaster &node)
+{
+  _worker = NULL;
+  _node = &node;
+}
+
+/**
+Write a block of holding registers, then read a block, blocking until
+done.
+
+@param u8Slave slave ID (1..247)
+@param u16WriteAddress first register to write
+@param u16WriteQty registers to write (1..121)
+@param pu16Values values to write
+@param u16ReadAddress first register to read
+@param u16ReadQty registers to read (1..125)
+@param pu16Dest receives the registers read
+@return 0 on success; exception number on failure (of the write if the
+exchange was split, in which case nothing is read);
+ModbusMaster::ku8MBIllegalDataValue for out of range quantities;
+ModbusMaster::ku8MBIllegalFunction before begin()
+@ingroup exchange
+*/
+uint8_t ModbusExchange::exchange(uint8_t u8Slave, uint16_t u16WriteAddress, uint16_t u16WriteQty,
+  const uint16_t *pu16Values, uint16_t u16ReadAddress, uint16_t u16ReadQty, uint16_t *pu16Dest)
+{
+  uint8_t u8Status;
+  Slave *slave;
+
+  // without a transport every request would look unsupported
+  if (!_worker && !_node)
+  {
+    return ModbusMaster::ku8MBIllegalFunction;
+  }
+
+  slave = find(u8Slave, true);
+  if (!slave || slave->u8Support != ku8SupportSplit)
+  {
+    u8Status = _request.readWriteMultipleRegisters(u8Slave, u16ReadAddress, u16ReadQty,
+      u16WriteAddress, u16WriteQty, pu16Values);
+    if (u8Status)
+    {
+      return u8Status;
+    }
+
+    u8Status = run();
+    if (u8Status != ModbusMaster::ku8MBIllegalFunction)
+    {
+      if (u8Status == ModbusMaster::ku8MBSuccess)
+      {
+        if (slave)
+        {
+          slave->u8Support = ku8SupportFused;
+        }
+        _u32Fused++;
+        u8Status = collect(u16ReadQty, pu16Dest);
+      }
+      return u8Status;
+    }
+    if (slave)
+    {
+      slave->u8Support = ku8SupportSplit;
+    }
+  }
+
+  // 0x17 not supported: write, then read, within the same limits
+  if (u16ReadQty < 1 || u16ReadQty > 125 || u16WriteQty > 121)
+  {
+    return ModbusMaster::ku8MBIllegalDataValue;
+  }
+  _u32Split++;
+  u8Status = _request.writeMultipleRegisters(u8Slave, u16WriteAddress, u16WriteQty, pu16Values);
+  if (!u8Status)
+  {
+    u8Status = run();
+  }
+  if (u8Status)
+  {
+    return u8Status;
+  }
+  _request.readHoldingRegisters(u8Slave, u16ReadAddress, u16ReadQty);
+  u8Status = run();
+  if (u8Status)
+  {
+    return u8Status;
+  }
+  return collect(u16ReadQty, pu16Dest);
+}
+
+/**
+Learned 0x17 support of a slave.
+
+@param u8Slave slave ID
+@return ModbusExchange::ku8SupportUnknown, ModbusExchange::ku8SupportFused
+or ModbusExchange::ku8SupportSplit
+@ingroup exchange
+*/
+uint8_t ModbusExchange::support(uint8_t u8Slave)
+{
+  Slave *slave = find(u8Slave, false);
+
+  return slave ? slave->u8Support : ku8SupportUnknown;
+}
+
+/**
+Declare the 0x17 support of a slave instead of learning it.
+
+@param u8Slave slave ID
+@param u8Support ModbusExchange::ku8SupportUnknown (learn again),
+ModbusExchange::ku8SupportFused or ModbusExchange::ku8SupportSplit
+@ingroup exchange
+*/
+void ModbusExchange::setSupport(uint8_t u8Slave, uint8_t u8Support)
+{
+  Slave *slave = find(u8Slave, true);
+
+  if (slave)
+  {
+    slave->u8Support = u8Support;
+  }
+}
+
+/**
+Forget the learned support of every slave, e.g. after replacing devices.
+
+@ingroup exchange
+*/
+void ModbusExchange::clearSupport(void)
+{
+  _u8Slaves = 0;
+}
+
+/**
+Number of exchanges done as one 0x17 transaction.
+
+@ingroup exchange
+*/
+uint32_t ModbusExchange::fused(void)
+{
+  return _u32Fused;
+}
+
+/**
+Number of exchanges done as a 0x10 write followed by a 0x03 read.
+
+@ingroup exchange
+*/
+uint32_t ModbusExchange::split(void)
+{
+  return _u32Split;
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+/**
+Support entry of a slave.
+
+@param u8Slave slave ID
+@param create true to take a free entry if the slave has none
+@return entry; NULL if the slave has none (and the table is full)
+*/
+ModbusExchange::Slave *ModbusExchange::find(uint8_t u8Slave, bool create)
+{
+  uint8_t i;
+
+  for (i = 0; i < _u8Slaves; i++)
+  {
+    if (_slaves[i].u8Slave == u8Slave)
+    {
+      return &_slaves[i];
+    }
+  }
+  if (!create || _u8Slaves >= ku8MaxSlaves)
+  {
+    return NULL;
+  }
+  _slaves[_u8Slaves].u8Slave = u8Slave;
+  _slaves[_u8Slaves].u8Support = ku8SupportUnknown;
+  return &_slaves[_u8Slaves++];
+}
+
+/**
+Run _request on the transport, blocking until it completes.
+*/
+uint8_t ModbusExchange::run(void)
+{
+  uint8_t u8Status;
+
+  if (_worker)
+  {
+    return _worker->execute(_request, _u8Priority);
+  }
+
+  u8Status = _node->issue(_request);
+  while (u8Status == ModbusMaster::ku8MBTransactionPending)
+  {
+    u8Status = _node->poll();
+  }
+  return u8Status;
+}
+
+/**
+Copy the registers read by _request.
+
+@return 0, or ModbusMaster::ku8MBInvalidFrame if the response is short
+*/
+uint8_t ModbusExchange::collect(uint16_t u16ReadQty, uint16_t *pu16Dest)
+{
+  uint8_t i;
+
+  if (_request.getResponseLength() < u16ReadQty)
+  {
+    return ModbusMaster::ku8MBInvalidFrame;
+  }
+  for (i = 0; i < u16ReadQty; i++)
+  {
+    pu16Dest[i] = _request.getResponseBuffer(i);
+  }
+  return ModbusMaster::ku8MBSuccess;
+}
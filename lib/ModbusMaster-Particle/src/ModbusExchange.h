@@ -0,0 +1,99 @@
+/**
+@file
+Write-then-read exchanges fused into function 0x17 where supported.
+
+@defgroup exchange ModbusMaster Write/Read Exchange
+*/
+/*
+
+  ModbusExchange.h - Fused write/read exchanges for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusExchange_h
+#define ModbusExchange_h
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusBusWorker.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Control-loop helper: write a command block, then read a status block.
+
+exchange() sends both halves as one 0x17 Read/Write Multiple Registers
+transaction, which the slave executes write first, so a control cycle
+costs one round trip instead of two. Support for 0x17 is learned per
+slave: the first exchange tries it, and a slave answering with exception
+ModbusMaster::ku8MBIllegalFunction (which means nothing was written) is
+remembered as unsupported and served with a 0x10 write followed by a
+0x03 read from then on, that first cycle included. Other failures teach
+nothing.
+
+Requests go through a ModbusBusWorker (from any thread but the worker's
+own) or a ModbusMaster (from the thread owning it). The helper itself is
+not thread-safe: use one per control loop.
+
+@ingroup exchange
+*/
+class ModbusExchange
+{
+  public:
+    static const uint8_t ku8MaxSlaves                    = 32;   ///< slaves whose support is remembered
+
+    // 0x17 support of a slave
+    static const uint8_t ku8SupportUnknown               = 0;    ///< not tried yet; the next exchange tries 0x17
+    static const uint8_t ku8SupportFused                 = 1;    ///< answered a 0x17 request
+    static const uint8_t ku8SupportSplit                 = 2;    ///< rejected 0x17; exchanges use 0x10 then 0x03
+
+    ModbusExchange();
+
+    void    begin(ModbusBusWorker &, uint8_t = ModbusBus::ku8PriorityControl);
+    void    begin(ModbusMaster &);
+
+    uint8_t exchange(uint8_t, uint16_t, uint16_t, const uint16_t *, uint16_t, uint16_t, uint16_t *);
+    uint8_t support(uint8_t);
+    void    setSupport(uint8_t, uint8_t);
+    void    clearSupport(void);
+
+    uint32_t fused(void);
+    uint32_t split(void);
+
+  private:
+    /**
+    Learned support of one slave.
+    */
+    struct Slave
+    {
+      uint8_t  u8Slave;                                          ///< slave ID
+      uint8_t  u8Support;                                        ///< ku8Support*
+    };
+
+    Slave    _slaves[ku8MaxSlaves];                              ///< learned support, first come first served
+    uint8_t  _u8Slaves;                                          ///< number of slaves in _slaves
+    ModbusBusWorker* _worker;                                    ///< transport; NULL if _node is used
+    ModbusMaster*    _node;                                      ///< transport; NULL if _worker is used
+    uint8_t  _u8Priority;                                        ///< request priority on the worker
+    ModbusRequest _request;                                      ///< request in progress
+    uint32_t _u32Fused;                                          ///< exchanges done as one 0x17 transaction
+    uint32_t _u32Split;                                          ///< exchanges done as 0x10 + 0x03
+
+    Slave*  find(uint8_t u8Slave, bool create);
+    uint8_t run(void);
+    uint8_t collect(uint16_t u16ReadQty, uint16_t *pu16Dest);
+};
+#endif
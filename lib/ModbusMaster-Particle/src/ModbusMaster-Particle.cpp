@@ -34,6 +34,7 @@ Arduino library for communicating with Modbus slaves over RS232/485 (via RTU pro
 /* _____PROJECT INCLUDES_____________________________________________________ */
 #include "util/arduino-electron-fixes.h"
 #include "ModbusMaster-Particle.h"
+#include "ModbusRequest.h"
 
 // Fix to define word type conversion function
 uint16_t word(uint8_t low) {
@@ -60,12 +61,60 @@ Creates class object; initialize it using ModbusMaster::begin().
 */
 ModbusMaster::ModbusMaster(void)
 {
+  _serial = NULL;
+  _debugMode = false;
+  _u8ResponseBufferLength = 0;
+  _u8ResponseBufferIndex = 0;
+  _responseDecoded = true;
+  _pu8RequestADU = _u8RequestADU;
+  _u8RequestSent = 0;
+  _u8ExpectedSize = 0;
+  _pRequest = NULL;
+  _pu8ResponseADU = _u8ResponseFrame[0];
+  _pu8LastResponse = NULL;
+  _u16ResponseBits = 0;
+  _u8State = ku8StateIdle;
+  _asyncMode = false;
+  _u8MBStatus = ku8MBSuccess;
+  _responseTimeoutSet = false;
+  _u16RequestTimeout = 0;
+  _u16TurnaroundDelay = ku16MBTurnaroundDelay;
+  _u32LastBusActivity = 0;
+  setFrameTiming(9600);
+  _driverEnable = false;
+  _u16PreGuard = 0;
+  _u16PostGuard = 0;
+  _guardActive = false;
+  _adaptiveTimeout = false;
+  _u16TimeoutFloor = 50;
+  _u16TimeoutCeiling = 0;
+  clearRttEstimates();
+  setRetryPolicy(1);
+  clearRetryStats();
+  clearStats();
   _idle = NULL;
   _preTransmission = NULL;
   _postTransmission = NULL;
+  _transactionComplete = NULL;
 }
 
 void ModbusMaster::begin(uint8_t slave, USARTSerial &serial)
+{
+  _usartSerial.attach(serial);
+  begin(slave, _usartSerial);
+}
+
+/**
+Initialize class object with any ModbusSerial port.
+
+Use this to run the master over something other than a hardware UART,
+e.g. a ModbusLoopbackSerial connected to a ModbusSlaveSimulator.
+
+@param slave Modbus slave ID (1..255)
+@param serial port the slave is attached to
+@ingroup setup
+*/
+void ModbusMaster::begin(uint8_t slave, ModbusSerial &serial)
 {
 //  txBuffer = (uint16_t*) calloc(ku8MaxBufferSize, sizeof(uint16_t));
   setSlave(slave);
@@ -74,6 +123,77 @@ void ModbusMaster::begin(uint8_t slave, USARTSerial &serial)
   u16TransmitBufferLength = 0;
 }
 
+/**
+Initialize class object with a hardware UART and an RS-485 transceiver
+whose DE/RE pins are driven by the library.
+
+@see ModbusMaster::setDriverEnable()
+@param slave Modbus slave ID (1..255)
+@param serial UART the transceiver is attached to
+@param dePin pin wired to the transceiver DE and /RE inputs
+@param deActive level of dePin that enables the driver (HIGH or LOW)
+@ingroup setup
+*/
+void ModbusMaster::begin(uint8_t slave, USARTSerial &serial, pin_t dePin,
+  uint8_t deActive)
+{
+  begin(slave, serial);
+  setDriverEnable(dePin, deActive);
+}
+
+/**
+Initialize class object with any ModbusSerial port and a driver enable pin.
+
+@see ModbusMaster::begin(uint8_t, USARTSerial &, pin_t, uint8_t)
+@ingroup setup
+*/
+void ModbusMaster::begin(uint8_t slave, ModbusSerial &serial, pin_t dePin,
+  uint8_t deActive)
+{
+  begin(slave, serial);
+  setDriverEnable(dePin, deActive);
+}
+
+/**
+Drive an RS-485 transceiver's DE/RE pins from the transaction engine.
+
+The driver is enabled just before a request is written and disabled as
+soon as the port reports the last stop bit sent (see
+ModbusSerial::transmitComplete()), without waiting on a blocking flush.
+This replaces the usual preTransmission()/postTransmission() pair, which
+remain available for anything else.
+
+@param dePin pin wired to the transceiver DE and /RE inputs
+@param deActive level of dePin that enables the driver (HIGH or LOW)
+@ingroup setup
+*/
+void ModbusMaster::setDriverEnable(pin_t dePin, uint8_t deActive)
+{
+  _dePin = dePin;
+  _u8DEActive = deActive;
+  _driverEnable = true;
+  pinMode(_dePin, OUTPUT);
+  driveBus(false);
+}
+
+/**
+Set the guard times around the driver enable window.
+
+The pre guard lets the transceiver's driver settle before the first start
+bit; the post guard keeps the line driven after the last stop bit, e.g.
+for transceivers with a slow output stage. Both default to 0 and are
+also applied with preTransmission()/postTransmission() callbacks.
+
+@param u16PreGuard delay between driver enable and the request [microseconds]
+@param u16PostGuard delay between the end of the request and driver disable [microseconds]
+@ingroup setup
+*/
+void ModbusMaster::setGuardTimes(uint16_t u16PreGuard, uint16_t u16PostGuard)
+{
+  _u16PreGuard = u16PreGuard;
+  _u16PostGuard = u16PostGuard;
+}
+
 // NOTE: This method only changes the slaveID used by other methods, but
 // does NOT update the slaveID defined in the slave itself.
 // This can be useful if you plan to scan slave IDs using only one instance
@@ -82,20 +202,271 @@ void ModbusMaster::setSlave(uint8_t slave) {
     _u8MBSlave = slave;
 }
 
-void ModbusMaster::setSpeed(uint16_t speed) {
+/**
+Set the baud rate (8N1) of the serial port.
+
+All derived timing follows the real baud rate: t3.5 inter-frame silence,
+the character time used to detect the end of transmission and, unless set
+with setResponseTimeout(), the default response timeout.
+
+@param speed baud rate, e.g. 9600, 115200, 460800
+@ingroup setup
+*/
+void ModbusMaster::setSpeed(uint32_t speed) {
     _serial->begin(speed);
-    delay(10);
-    _serial->write(0xa5);
-    _serial->flush();
+    setFrameTiming(speed);
+    // the port was just opened: let the line settle for t3.5 before the
+    // first request
+    _u32LastBusActivity = micros();
 }
 
-void ModbusMaster::setSpeed(uint16_t speed, uint32_t config) {
+/**
+Set the baud rate and frame format of the serial port.
+
+@see ModbusMaster::setSpeed(uint32_t)
+@param speed baud rate
+@param config frame format, e.g. SERIAL_8N1, SERIAL_8E1
+@ingroup setup
+*/
+void ModbusMaster::setSpeed(uint32_t speed, uint32_t config) {
     _serial->begin(speed, config);
-    delay(10);
-    _serial->write(0xa5);
-    _serial->flush();
+    setFrameTiming(speed);
+    _u32LastBusActivity = micros();
+}
+
+/**
+Set the response timeout of this instance.
+
+The slave must start answering within this time after the request has been
+sent; once the first byte has been received the end of the response is
+detected by the t3.5 inter-frame silence instead.
+
+Until this is called the timeout follows the baud rate: a slave processing
+allowance (ModbusMaster::ku16MBProcessingTime) plus the time of a maximum
+size frame: 500 ms at 9600 baud, 231 ms at 115200 baud.
+
+@param u16Timeout time to first response byte [milliseconds]
+@see ModbusMaster::setRequestTimeout()
+@ingroup setup
+*/
+void ModbusMaster::setResponseTimeout(uint16_t u16Timeout) {
+    _u16ResponseTimeout = u16Timeout;
+    _responseTimeoutSet = true;
+}
+
+uint16_t ModbusMaster::getResponseTimeout(void) {
+    return _u16ResponseTimeout;
+}
+
+/**
+Override the response timeout for the next transaction only.
+
+Useful for slaves or function codes known to answer slower (or faster)
+than the instance default set by setResponseTimeout().
+
+@param u16Timeout time to first response byte [milliseconds]; 0 drops an
+override not used yet
+@ingroup setup
+*/
+void ModbusMaster::setRequestTimeout(uint16_t u16Timeout) {
+    _u16RequestTimeout = u16Timeout;
+}
+
+/**
+Set the turnaround delay of broadcast writes.
+
+No slave answers a broadcast (slave ID ModbusMaster::ku8MBBroadcast), so
+instead of waiting for a response timeout the master keeps the bus silent
+for this delay, long enough for every slave to execute the request, and
+then reports success. The Modbus serial line specification suggests 100
+to 200 ms; slow devices (EEPROM writes) may need more.
+
+@param u16Delay bus silence after a broadcast [milliseconds]
+@ingroup setup
+*/
+void ModbusMaster::setTurnaroundDelay(uint16_t u16Delay) {
+    _u16TurnaroundDelay = u16Delay;
+}
+
+/**
+Derive each slave's response timeout from its observed turnaround times.
+
+The time from the end of a request to the first response byte is sampled
+on every first attempt answered by the slave (with data or an exception)
+and smoothed as TCP does for its retransmission timeout (RFC 6298): the
+mean SRTT with gain 1/8, the mean deviation RTTVAR with gain 1/4. Each
+request then waits SRTT + 4 * RTTVAR (at least 1 ms above SRTT), clamped
+to [u16Floor, u16Ceiling], so a dead 15 ms meter costs the floor instead
+of the full default timeout while a 300 ms gateway keeps the time it
+needs. Every timeout doubles the slave's next timeouts (up to a factor 8,
+still within the ceiling) until it answers again, in case it just got
+slower.
+
+Slaves without a sample yet, and slaves beyond the ku8RttSlaves first
+ones seen, use the instance timeout (see setResponseTimeout()).
+setRequestTimeout() still overrides the timeout of one transaction.
+
+@param u16Floor shortest timeout [milliseconds] (default 50)
+@param u16Ceiling longest timeout [milliseconds]; 0 (default) for the
+instance timeout
+@ingroup setup
+*/
+void ModbusMaster::enableAdaptiveTimeout(uint16_t u16Floor, uint16_t u16Ceiling)
+{
+  _adaptiveTimeout = true;
+  _u16TimeoutFloor = u16Floor;
+  _u16TimeoutCeiling = u16Ceiling;
+}
+
+/**
+Use the instance response timeout for every slave again (default).
+
+The estimates are kept and keep being updated.
+
+@ingroup setup
+*/
+void ModbusMaster::disableAdaptiveTimeout(void)
+{
+  _adaptiveTimeout = false;
+}
+
+/**
+Response timeout the next request to a slave would use.
+
+@param u8Slave slave ID
+@return time to first response byte [milliseconds], ignoring a pending
+setRequestTimeout()
+@ingroup setup
+*/
+uint16_t ModbusMaster::getSlaveTimeout(uint8_t u8Slave)
+{
+  ModbusRttEstimate *rtt = rttEstimate(u8Slave, false);
+  uint16_t u16Ceiling = _u16TimeoutCeiling ? _u16TimeoutCeiling : _u16ResponseTimeout;
+  uint32_t u32Timeout;
+
+  if (!_adaptiveTimeout || !rtt)
+  {
+    return _u16ResponseTimeout;
+  }
+
+  u32Timeout = rtt->u32Srtt + ((4 * rtt->u32RttVar > 1000) ? 4 * rtt->u32RttVar : 1000);
+  u32Timeout = ((u32Timeout + 999) / 1000) << rtt->u8Backoff;
+  if (u32Timeout < _u16TimeoutFloor)
+  {
+    u32Timeout = _u16TimeoutFloor;
+  }
+  return (u32Timeout < u16Ceiling) ? (uint16_t) u32Timeout : u16Ceiling;
+}
+
+/**
+Retrieve the round-trip time estimate of a slave.
+
+@param u8Slave slave ID
+@param rtt receives the estimate
+@return false if the slave has not been sampled
+@ingroup setup
+*/
+bool ModbusMaster::getRttEstimate(uint8_t u8Slave, ModbusRttEstimate &rtt)
+{
+  ModbusRttEstimate *estimate = rttEstimate(u8Slave, false);
+
+  if (!estimate)
+  {
+    return false;
+  }
+  rtt = *estimate;
+  return true;
+}
+
+/**
+Forget the round-trip time estimates of all slaves.
+
+@ingroup setup
+*/
+void ModbusMaster::clearRttEstimates(void)
+{
+  memset(_rtt, 0, sizeof(_rtt));
+}
+
+
+/**
+Set the retry policy applied to every transaction.
+
+A transaction that fails with a status of one of the retriable classes is
+sent again, unchanged, after a back-off delay that doubles with each retry
+(u16Backoff, 2 * u16Backoff, ...) up to u16MaxBackoff. The caller, the
+transaction complete callback and poll() only see the final status. Protocol
+exceptions such as illegal data address are never retried: the slave would
+answer the same way again.
+
+Retries are disabled by default (one attempt).
+
+@param u8Attempts attempts per transaction, first one included (1 disables retries)
+@param u16Backoff delay before the first retry [milliseconds]
+@param u16MaxBackoff cap of the delay [milliseconds]; equal to u16Backoff for a constant delay
+@param u8RetryOn retriable classes, ORed ModbusMaster::ku8RetryOn* values
+@ingroup setup
+*/
+void ModbusMaster::setRetryPolicy(uint8_t u8Attempts, uint16_t u16Backoff,
+  uint16_t u16MaxBackoff, uint8_t u8RetryOn)
+{
+  _u8RetryAttempts = u8Attempts ? u8Attempts : 1;
+  _u16RetryBackoff = u16Backoff;
+  _u16RetryMaxBackoff = (u16MaxBackoff > u16Backoff) ? u16MaxBackoff : u16Backoff;
+  _u8RetryOn = u8RetryOn;
+}
+
+
+/**
+Retrieve the retry policy counters.
+
+@ingroup setup
+*/
+ModbusRetryStats ModbusMaster::getRetryStats(void)
+{
+  return _retryStats;
+}
+
+
+/**
+Reset the retry policy counters.
+
+@ingroup setup
+*/
+void ModbusMaster::clearRetryStats(void)
+{
+  memset(&_retryStats, 0, sizeof(_retryStats));
+}
+
+
+/**
+Take a snapshot of the instrumentation counters.
+
+Counts per function code and per slave, errors per status, bytes on the
+wire and log2 latency histograms of each transaction phase, all
+accumulated since the last clearStats().
+
+@param stats receives the snapshot
+@ingroup stats
+*/
+void ModbusMaster::getStats(ModbusMasterStats &stats)
+{
+  stats = _stats;
+}
+
+
+/**
+Reset the instrumentation counters.
+
+@ingroup stats
+*/
+void ModbusMaster::clearStats(void)
+{
+  memset(&_stats, 0, sizeof(_stats));
+  _stats.u32Since = millis();
 }
 
+
 void ModbusMaster::enableDebug(void) {
     _debugMode = true;
 }
@@ -159,12 +530,14 @@ void ModbusMaster::send(uint8_t data)
 
 uint8_t ModbusMaster::available(void)
 {
+  decodeResponseWords();
   return _u8ResponseBufferLength - _u8ResponseBufferIndex;
 }
 
 
 uint16_t ModbusMaster::receive(void)
 {
+  decodeResponseWords();
   if (_u8ResponseBufferIndex < _u8ResponseBufferLength)
   {
     return _u16ResponseBuffer[_u8ResponseBufferIndex++];
@@ -235,12 +608,13 @@ void ModbusMaster::postTransmission(void (*postTransmission)())
 Retrieve data from response buffer.
 
 @see ModbusMaster::clearResponseBuffer()
-@param u8Index index of response buffer array (0x00..0x3F)
+@param u8Index index of response buffer array (0x00..0x7C)
 @return value in position u8Index of response buffer (0x0000..0xFFFF)
 @ingroup buffer
 */
 uint16_t ModbusMaster::getResponseBuffer(uint8_t u8Index)
 {
+  decodeResponseWords();
   if (u8Index < ku8MaxBufferSize)
   {
     return _u16ResponseBuffer[u8Index];
@@ -253,128 +627,328 @@ uint16_t ModbusMaster::getResponseBuffer(uint8_t u8Index)
 
 
 /**
-Clear Modbus response buffer.
+Read-only view over the words decoded from the last response.
 
-@see ModbusMaster::getResponseBuffer(uint8_t u8Index)
+The view points into the response buffer: it is valid until the next
+transaction completes and costs no copy beyond the one-time disassembly
+of the response into words.
+
+@see ModbusMaster::copyResponse()
+@return view of getResponseLength() words
 @ingroup buffer
 */
-void ModbusMaster::clearResponseBuffer()
+ModbusResponseView ModbusMaster::getResponseView(void)
 {
-  uint8_t i;
-
-  for (i = 0; i < ku8MaxBufferSize; i++)
-  {
-    _u16ResponseBuffer[i] = 0;
-  }
+  decodeResponseWords();
+  return ModbusResponseView(_u16ResponseBuffer, _u8ResponseBufferLength);
 }
 
 
 /**
-Place data in transmit buffer.
+Number of words decoded from the last response.
+
+Registers for functions 0x03, 0x04 and 0x17; coils/discrete inputs packed
+16 per word for functions 0x01 and 0x02; 0 for write functions.
 
-@see ModbusMaster::clearTransmitBuffer()
-@param u8Index index of transmit buffer array (0x00..0x3F)
-@param u16Value value to place in position u8Index of transmit buffer (0x0000..0xFFFF)
-@return 0 on success; exception number on failure
 @ingroup buffer
 */
-uint8_t ModbusMaster::setTransmitBuffer(uint8_t u8Index, uint16_t u16Value)
+uint8_t ModbusMaster::getResponseLength(void)
 {
-  if (u8Index < ku8MaxBufferSize)
-  {
-    _u16TransmitBuffer[u8Index] = u16Value;
-    return ku8MBSuccess;
-  }
-  else
-  {
-    return ku8MBIllegalDataAddress;
-  }
+  decodeResponseWords();
+  return _u8ResponseBufferLength;
 }
 
 
 /**
-Clear Modbus transmit buffer.
+Copy the words decoded from the last response in one block.
 
-@see ModbusMaster::setTransmitBuffer(uint8_t u8Index, uint16_t u16Value)
+@param pu16Dest destination array
+@param u8Qty capacity of the destination array, in words
+@return number of words copied (at most getResponseLength())
 @ingroup buffer
 */
-void ModbusMaster::clearTransmitBuffer()
+uint8_t ModbusMaster::copyResponse(uint16_t *pu16Dest, uint8_t u8Qty)
 {
-  uint8_t i;
-
-  for (i = 0; i < ku8MaxBufferSize; i++)
+  decodeResponseWords();
+  if (u8Qty > _u8ResponseBufferLength)
   {
-    _u16TransmitBuffer[i] = 0;
+    u8Qty = _u8ResponseBufferLength;
   }
+  memcpy(pu16Dest, _u16ResponseBuffer, u8Qty * sizeof(uint16_t));
+  return u8Qty;
 }
 
 
 /**
-Modbus function 0x01 Read Coils.
+Copy the coils/discrete inputs of the last response into a bitset.
 
-This function code is used to read from 1 to 2000 contiguous status of
-coils in a remote device. The request specifies the starting address,
-i.e. the address of the first coil specified, and the number of coils.
-Coils are addressed starting at zero.
+Covers the full 2000 bits a 0x01/0x02 response can carry, sized to the
+quantity requested.
 
-The coils in the response buffer are packed as one coil per bit of the
-data field. Status is indicated as 1=ON and 0=OFF. The LSB of the first
-data word contains the output addressed in the query. The other coils
-follow toward the high order end of this word and from low order to high
-order in subsequent words.
+@param bits destination; emptied if the last response is not a 0x01/0x02
+one
+@return number of bits copied
+@ingroup buffer
+*/
+uint16_t ModbusMaster::getResponseBits(ModbusBitset &bits)
+{
+  decodeResponseWords();
+  bits.assign(_u16ResponseBuffer, _u16ResponseBits);
+  return bits.size();
+}
 
-If the returned quantity is not a multiple of sixteen, the remaining
-bits in the final data word will be padded with zeros (toward the high
-order end of the word).
 
-@param u16ReadAddress address of first coil (0x0000..0xFFFF)
-@param u16BitQty quantity of coils to read (1..2000, enforced by remote device)
-@return 0 on success; exception number on failure
-@ingroup discrete
+/**
+Decode registers of the last response straight into caller storage.
+
+Reads the validated response ADU of functions 0x03, 0x04 and 0x17
+directly; the word buffer is not involved. Values are taken from
+consecutive registers starting at u8Register (an index into the response,
+not a slave address): one register per 16-bit value, two per 32-bit value
+and four per double. Values that do not fit completely in the response are
+not decoded.
+
+@param u8Register index of the first register in the response (0x00..0x7C)
+@param pu16Dest destination array
+@param u8Qty number of values to decode
+@param u8Order register/byte order (ku8MBOrderABCD, CDAB, BADC or DCBA)
+@return number of values decoded
+@ingroup buffer
 */
-uint8_t ModbusMaster::readCoils(uint16_t u16ReadAddress, uint16_t u16BitQty)
+uint8_t ModbusMaster::decodeResponse(uint8_t u8Register, uint16_t *pu16Dest,
+  uint8_t u8Qty, uint8_t u8Order)
 {
-  _u16ReadAddress = u16ReadAddress;
-  _u16ReadQty = u16BitQty;
-  return ModbusMasterTransaction(ku8MBReadCoils);
+  const uint8_t *pu8Data = NULL;
+  uint8_t i;
+
+  u8Qty = responseRegisters(u8Register, 1, u8Qty, &pu8Data);
+  for (i = 0; i < u8Qty; i++)
+  {
+    pu16Dest[i] = (uint16_t) mb_decode_bytes(pu8Data + 2 * i, 1, u8Order);
+  }
+  return u8Qty;
 }
 
 
 /**
-Modbus function 0x02 Read Discrete Inputs.
-
-This function code is used to read from 1 to 2000 contiguous status of
-discrete inputs in a remote device. The request specifies the starting
-address, i.e. the address of the first input specified, and the number
-of inputs. Discrete inputs are addressed starting at zero.
+@see ModbusMaster::decodeResponse(uint8_t, uint16_t *, uint8_t, uint8_t)
+@ingroup buffer
+*/
+uint8_t ModbusMaster::decodeResponse(uint8_t u8Register, int16_t *pi16Dest,
+  uint8_t u8Qty, uint8_t u8Order)
+{
+  const uint8_t *pu8Data = NULL;
+  uint8_t i;
 
-The discrete inputs in the response buffer are packed as one input per
-bit of the data field. Status is indicated as 1=ON; 0=OFF. The LSB of
-the first data word contains the input addressed in the query. The other
-inputs follow toward the high order end of this word, and from low order
-to high order in subsequent words.
+  u8Qty = responseRegisters(u8Register, 1, u8Qty, &pu8Data);
+  for (i = 0; i < u8Qty; i++)
+  {
+    pi16Dest[i] = (int16_t) mb_decode_bytes(pu8Data + 2 * i, 1, u8Order);
+  }
+  return u8Qty;
+}
 
-If the returned quantity is not a multiple of sixteen, the remaining
-bits in the final data word will be padded with zeros (toward the high
-order end of the word).
 
-@param u16ReadAddress address of first discrete input (0x0000..0xFFFF)
-@param u16BitQty quantity of discrete inputs to read (1..2000, enforced by remote device)
-@return 0 on success; exception number on failure
-@ingroup discrete
+/**
+@see ModbusMaster::decodeResponse(uint8_t, uint16_t *, uint8_t, uint8_t)
+@ingroup buffer
 */
-uint8_t ModbusMaster::readDiscreteInputs(uint16_t u16ReadAddress,
-  uint16_t u16BitQty)
+uint8_t ModbusMaster::decodeResponse(uint8_t u8Register, uint32_t *pu32Dest,
+  uint8_t u8Qty, uint8_t u8Order)
 {
-  _u16ReadAddress = u16ReadAddress;
-  _u16ReadQty = u16BitQty;
-  return ModbusMasterTransaction(ku8MBReadDiscreteInputs);
+  const uint8_t *pu8Data = NULL;
+  uint8_t i;
+
+  u8Qty = responseRegisters(u8Register, 2, u8Qty, &pu8Data);
+  for (i = 0; i < u8Qty; i++)
+  {
+    pu32Dest[i] = (uint32_t) mb_decode_bytes(pu8Data + 4 * i, 2, u8Order);
+  }
+  return u8Qty;
 }
 
 
 /**
-Modbus function 0x03 Read Holding Registers.
-
+@see ModbusMaster::decodeResponse(uint8_t, uint16_t *, uint8_t, uint8_t)
+@ingroup buffer
+*/
+uint8_t ModbusMaster::decodeResponse(uint8_t u8Register, int32_t *pi32Dest,
+  uint8_t u8Qty, uint8_t u8Order)
+{
+  const uint8_t *pu8Data = NULL;
+  uint8_t i;
+
+  u8Qty = responseRegisters(u8Register, 2, u8Qty, &pu8Data);
+  for (i = 0; i < u8Qty; i++)
+  {
+    pi32Dest[i] = (int32_t) mb_decode_bytes(pu8Data + 4 * i, 2, u8Order);
+  }
+  return u8Qty;
+}
+
+
+/**
+@see ModbusMaster::decodeResponse(uint8_t, uint16_t *, uint8_t, uint8_t)
+@ingroup buffer
+*/
+uint8_t ModbusMaster::decodeResponse(uint8_t u8Register, float *pfDest,
+  uint8_t u8Qty, uint8_t u8Order)
+{
+  const uint8_t *pu8Data = NULL;
+  uint8_t i;
+
+  u8Qty = responseRegisters(u8Register, 2, u8Qty, &pu8Data);
+  for (i = 0; i < u8Qty; i++)
+  {
+    pfDest[i] = mb_float_from_bits((uint32_t) mb_decode_bytes(pu8Data + 4 * i, 2, u8Order));
+  }
+  return u8Qty;
+}
+
+
+/**
+@see ModbusMaster::decodeResponse(uint8_t, uint16_t *, uint8_t, uint8_t)
+@ingroup buffer
+*/
+uint8_t ModbusMaster::decodeResponse(uint8_t u8Register, double *pdDest,
+  uint8_t u8Qty, uint8_t u8Order)
+{
+  const uint8_t *pu8Data = NULL;
+  uint8_t i;
+
+  u8Qty = responseRegisters(u8Register, 4, u8Qty, &pu8Data);
+  for (i = 0; i < u8Qty; i++)
+  {
+    pdDest[i] = mb_double_from_bits(mb_decode_bytes(pu8Data + 8 * i, 4, u8Order));
+  }
+  return u8Qty;
+}
+
+
+/**
+Clear Modbus response buffer.
+
+@see ModbusMaster::getResponseBuffer(uint8_t u8Index)
+@ingroup buffer
+*/
+void ModbusMaster::clearResponseBuffer()
+{
+  uint8_t i;
+
+  for (i = 0; i < ku8MaxBufferSize; i++)
+  {
+    _u16ResponseBuffer[i] = 0;
+  }
+  _responseDecoded = true;
+}
+
+
+/**
+Place data in transmit buffer.
+
+@see ModbusMaster::clearTransmitBuffer()
+@param u8Index index of transmit buffer array (0x00..0x7C)
+@param u16Value value to place in position u8Index of transmit buffer (0x0000..0xFFFF)
+@return 0 on success; exception number on failure
+@ingroup buffer
+*/
+uint8_t ModbusMaster::setTransmitBuffer(uint8_t u8Index, uint16_t u16Value)
+{
+  if (u8Index < ku8MaxBufferSize)
+  {
+    _u16TransmitBuffer[u8Index] = u16Value;
+    return ku8MBSuccess;
+  }
+  else
+  {
+    return ku8MBIllegalDataAddress;
+  }
+}
+
+
+/**
+Clear Modbus transmit buffer.
+
+@see ModbusMaster::setTransmitBuffer(uint8_t u8Index, uint16_t u16Value)
+@ingroup buffer
+*/
+void ModbusMaster::clearTransmitBuffer()
+{
+  uint8_t i;
+
+  for (i = 0; i < ku8MaxBufferSize; i++)
+  {
+    _u16TransmitBuffer[i] = 0;
+  }
+}
+
+
+/**
+Modbus function 0x01 Read Coils.
+
+This function code is used to read from 1 to 2000 contiguous status of
+coils in a remote device. The request specifies the starting address,
+i.e. the address of the first coil specified, and the number of coils.
+Coils are addressed starting at zero.
+
+The coils in the response buffer are packed as one coil per bit of the
+data field. Status is indicated as 1=ON and 0=OFF. The LSB of the first
+data word contains the output addressed in the query. The other coils
+follow toward the high order end of this word and from low order to high
+order in subsequent words.
+
+If the returned quantity is not a multiple of sixteen, the remaining
+bits in the final data word will be padded with zeros (toward the high
+order end of the word).
+
+@param u16ReadAddress address of first coil (0x0000..0xFFFF)
+@param u16BitQty quantity of coils to read (1..2000)
+@return 0 on success; exception number on failure
+@ingroup discrete
+*/
+uint8_t ModbusMaster::readCoils(uint16_t u16ReadAddress, uint16_t u16BitQty)
+{
+  _u16ReadAddress = u16ReadAddress;
+  _u16ReadQty = u16BitQty;
+  return ModbusMasterTransaction(ku8MBReadCoils);
+}
+
+
+/**
+Modbus function 0x02 Read Discrete Inputs.
+
+This function code is used to read from 1 to 2000 contiguous status of
+discrete inputs in a remote device. The request specifies the starting
+address, i.e. the address of the first input specified, and the number
+of inputs. Discrete inputs are addressed starting at zero.
+
+The discrete inputs in the response buffer are packed as one input per
+bit of the data field. Status is indicated as 1=ON; 0=OFF. The LSB of
+the first data word contains the input addressed in the query. The other
+inputs follow toward the high order end of this word, and from low order
+to high order in subsequent words.
+
+If the returned quantity is not a multiple of sixteen, the remaining
+bits in the final data word will be padded with zeros (toward the high
+order end of the word).
+
+@param u16ReadAddress address of first discrete input (0x0000..0xFFFF)
+@param u16BitQty quantity of discrete inputs to read (1..2000)
+@return 0 on success; exception number on failure
+@ingroup discrete
+*/
+uint8_t ModbusMaster::readDiscreteInputs(uint16_t u16ReadAddress,
+  uint16_t u16BitQty)
+{
+  _u16ReadAddress = u16ReadAddress;
+  _u16ReadQty = u16BitQty;
+  return ModbusMasterTransaction(ku8MBReadDiscreteInputs);
+}
+
+
+/**
+Modbus function 0x03 Read Holding Registers.
+
 This function code is used to read the contents of a contiguous block of
 holding registers in a remote device. The request specifies the starting
 register address and the number of registers. Registers are addressed
@@ -384,7 +958,7 @@ The register data in the response buffer is packed as one word per
 register.
 
 @param u16ReadAddress address of the first holding register (0x0000..0xFFFF)
-@param u16ReadQty quantity of holding registers to read (1..125, enforced by remote device)
+@param u16ReadQty quantity of holding registers to read (1..125)
 @return 0 on success; exception number on failure
 @ingroup register
 */
@@ -409,7 +983,7 @@ The register data in the response buffer is packed as one word per
 register.
 
 @param u16ReadAddress address of the first input register (0x0000..0xFFFF)
-@param u16ReadQty quantity of input registers to read (1..125, enforced by remote device)
+@param u16ReadQty quantity of input registers to read (1..125)
 @return 0 on success; exception number on failure
 @ingroup register
 */
@@ -478,7 +1052,7 @@ buffer. A logical '1' in a bit position of the buffer requests the
 corresponding output to be ON. A logical '0' requests it to be OFF.
 
 @param u16WriteAddress address of the first coil (0x0000..0xFFFF)
-@param u16BitQty quantity of coils to write (1..2000, enforced by remote device)
+@param u16BitQty quantity of coils to write (1..1968)
 @return 0 on success; exception number on failure
 @ingroup discrete
 */
@@ -506,7 +1080,7 @@ The requested written values are specified in the transmit buffer. Data
 is packed as one word per register.
 
 @param u16WriteAddress address of the holding register (0x0000..0xFFFF)
-@param u16WriteQty quantity of holding registers to write (1..123, enforced by remote device)
+@param u16WriteQty quantity of holding registers to write (1..123)
 @return 0 on success; exception number on failure
 @ingroup register
 */
@@ -526,6 +1100,97 @@ uint8_t ModbusMaster::writeMultipleRegisters()
 }
 
 
+/**
+Write a block of holding registers straight from the caller's array.
+
+Same as writeMultipleRegisters(), but the values are encoded directly into
+the request ADU instead of being staged in the transmit buffer first.
+
+@param u16WriteAddress address of the first holding register (0x0000..0xFFFF)
+@param pu16Values values to write
+@param u8Qty quantity of holding registers to write (1..123)
+@return 0 on success; exception number on failure;
+ModbusMaster::ku8MBIllegalDataValue for an out of range quantity
+@ingroup register
+*/
+uint8_t ModbusMaster::writeRegisters(uint16_t u16WriteAddress, const uint16_t *pu16Values,
+  uint8_t u8Qty)
+{
+  _u16WriteAddress = u16WriteAddress;
+  _u16WriteQty = u8Qty;
+  return awaitTransaction(beginTransaction(ku8MBWriteMultipleRegisters, pu16Values));
+}
+
+/**
+Write 32-bit values to pairs of holding registers.
+
+Each value takes two consecutive registers, laid out in the given
+register/byte order (see util/decode.h); the transmit buffer is left
+untouched.
+
+@param u16WriteAddress address of the first holding register (0x0000..0xFFFF)
+@param pu32Values values to write
+@param u8Count number of values (1..61)
+@param u8Order ku8MBOrderABCD (high word first, default) .. ku8MBOrderDCBA
+@return 0 on success; exception number on failure;
+ModbusMaster::ku8MBIllegalDataValue for an out of range count
+@ingroup register
+*/
+uint8_t ModbusMaster::writeRegisters(uint16_t u16WriteAddress, const uint32_t *pu32Values,
+  uint8_t u8Count, uint8_t u8Order)
+{
+  return writeRegisters32(u16WriteAddress, pu32Values, u8Count, u8Order);
+}
+
+uint8_t ModbusMaster::writeRegisters(uint16_t u16WriteAddress, const int32_t *pi32Values,
+  uint8_t u8Count, uint8_t u8Order)
+{
+  return writeRegisters32(u16WriteAddress, pi32Values, u8Count, u8Order);
+}
+
+uint8_t ModbusMaster::writeRegisters(uint16_t u16WriteAddress, const float *pfValues,
+  uint8_t u8Count, uint8_t u8Order)
+{
+  return writeRegisters32(u16WriteAddress, pfValues, u8Count, u8Order);
+}
+
+/**
+Write a block of coils straight from the caller's packed bits.
+
+Same as writeMultipleCoils(), but the states are encoded directly into
+the request ADU instead of being staged in the transmit buffer first.
+
+@param u16WriteAddress address of the first coil (0x0000..0xFFFF)
+@param pu16Bits coil states, 16 per word, LSB first
+@param u16BitQty quantity of coils to write (1..1968)
+@return 0 on success; exception number on failure;
+ModbusMaster::ku8MBIllegalDataValue for an out of range quantity
+@ingroup discrete
+*/
+uint8_t ModbusMaster::writeCoils(uint16_t u16WriteAddress, const uint16_t *pu16Bits,
+  uint16_t u16BitQty)
+{
+  _u16WriteAddress = u16WriteAddress;
+  _u16WriteQty = u16BitQty;
+  return awaitTransaction(beginTransaction(ku8MBWriteMultipleCoils, pu16Bits));
+}
+
+
+/**
+Write a block of coils from a bitset, one coil per bit.
+
+@param u16WriteAddress address of the first coil (0x0000..0xFFFF)
+@param bits coil states; size() coils are written (1..1968)
+@return 0 on success; exception number on failure;
+ModbusMaster::ku8MBIllegalDataValue for an out of range size
+@ingroup discrete
+*/
+uint8_t ModbusMaster::writeCoils(uint16_t u16WriteAddress, const ModbusBitset &bits)
+{
+  return writeCoils(u16WriteAddress, bits.words(), bits.size());
+}
+
+
 /**
 Modbus function 0x16 Mask Write Register.
 
@@ -572,9 +1237,9 @@ holding registers. The data to be written is specified in the transmit
 buffer.
 
 @param u16ReadAddress address of the first holding register (0x0000..0xFFFF)
-@param u16ReadQty quantity of holding registers to read (1..125, enforced by remote device)
+@param u16ReadQty quantity of holding registers to read (1..125)
 @param u16WriteAddress address of the first holding register (0x0000..0xFFFF)
-@param u16WriteQty quantity of holding registers to write (1..121, enforced by remote device)
+@param u16WriteQty quantity of holding registers to write (1..121)
 @return 0 on success; exception number on failure
 @ingroup register
 */
@@ -597,300 +1262,1018 @@ uint8_t ModbusMaster::readWriteMultipleRegisters(uint16_t u16ReadAddress,
 }
 
 
-/* _____PRIVATE FUNCTIONS____________________________________________________ */
-
 /**
-Modbus transaction engine.
-Sequence:
-  - assemble Modbus Request Application Data Unit (ADU),
-    based on particular function called
-  - transmit request over selected serial port
-  - wait for/retrieve response
-  - evaluate/disassemble response
-  - return status (success/exception)
+Send a prepared request.
 
-@param u8MBFunction Modbus function (0x01..0xFF)
-@return 0 on success; exception number on failure
-*/
-uint8_t ModbusMaster::ModbusMasterTransaction(uint8_t u8MBFunction)
-{
-  uint8_t u8ModbusADU[256];
-  uint8_t u8ModbusADUSize = 0;
-  uint8_t i, u8Qty;
-  uint16_t u16CRC;
-  uint32_t u32StartTime;
-  uint8_t u8BytesLeft = 8;
-  uint8_t u8MBStatus = ku8MBSuccess;
+The frame compiled by ModbusPreparedRequest::compile() is written as is
+with a single block write: no assembly, no CRC computation. The slave ID
+is taken from the request, the one set with setSlave() is left alone.
+Reads fill the response buffer like their function counterparts.
 
-  // assemble Modbus Request Application Data Unit
-  u8ModbusADU[u8ModbusADUSize++] = _u8MBSlave;
-  u8ModbusADU[u8ModbusADUSize++] = u8MBFunction;
+The request must stay valid until the transaction completes.
 
-  switch(u8MBFunction)
+@param request compiled request
+@return 0 on success; exception number on failure;
+ModbusMaster::ku8MBIllegalFunction if the request was not compiled
+@ingroup prepared
+*/
+uint8_t ModbusMaster::issue(const ModbusPreparedRequest &request)
+{
+  if (!request.valid())
   {
-    case ku8MBReadCoils:
-    case ku8MBReadDiscreteInputs:
-    case ku8MBReadInputRegisters:
-    case ku8MBReadHoldingRegisters:
-    case ku8MBReadWriteMultipleRegisters:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16ReadAddress);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16ReadAddress);
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16ReadQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16ReadQty);
-      break;
+    return ku8MBIllegalFunction;
   }
-
-  switch(u8MBFunction)
+  if (_u8State != ku8StateIdle)
   {
-    case ku8MBWriteSingleCoil:
-    case ku8MBMaskWriteRegister:
-    case ku8MBWriteMultipleCoils:
-    case ku8MBWriteSingleRegister:
-    case ku8MBWriteMultipleRegisters:
-    case ku8MBReadWriteMultipleRegisters:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16WriteAddress);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteAddress);
-      break;
+    return ku8MBBusy;
   }
 
-  switch(u8MBFunction)
-  {
-    case ku8MBWriteSingleCoil:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16WriteQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteQty);
-      break;
-
-    case ku8MBWriteSingleRegister:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[0]);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[0]);
-      break;
-
-    case ku8MBWriteMultipleCoils:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16WriteQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteQty);
-      u8Qty = (_u16WriteQty % 8) ? ((_u16WriteQty >> 3) + 1) : (_u16WriteQty >> 3);
-      u8ModbusADU[u8ModbusADUSize++] = u8Qty;
-      for (i = 0; i < u8Qty; i++)
-      {
-        switch(i % 2)
-        {
-          case 0: // i is even
-            u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[i >> 1]);
-            break;
-
-          case 1: // i is odd
-            u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[i >> 1]);
-            break;
-        }
-      }
-      break;
-
-    case ku8MBWriteMultipleRegisters:
-    case ku8MBReadWriteMultipleRegisters:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16WriteQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteQty << 1);
-
-      for (i = 0; i < lowByte(_u16WriteQty); i++)
-      {
-        u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[i]);
-        u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[i]);
-      }
-      break;
+  armTransaction(request.frame(), request.size(), request.responseSize());
+  return awaitTransaction(ku8MBTransactionPending);
+}
 
-    case ku8MBMaskWriteRegister:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[0]);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[0]);
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[1]);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[1]);
-      break;
-  }
 
-  // append CRC
-  u16CRC = 0xFFFF;
-  for (i = 0; i < u8ModbusADUSize; i++)
+/**
+Run a request object.
+
+The request carries its own parameters, ADU and result: on completion its
+status() and response words are set (the response is also available
+through the word buffer of the master, as for the function methods). The
+slave ID is taken from the request.
+
+In asynchronous mode the call returns ModbusMaster::ku8MBTransactionPending
+and the request completes from poll(); it must stay valid until then.
+
+@param request request built with one of its function methods
+@return 0 on success; exception number on failure;
+ModbusMaster::ku8MBIllegalFunction if the request was not built;
+ModbusMaster::ku8MBBusy if another transaction is in progress (the
+request is left untouched)
+@ingroup request
+*/
+uint8_t ModbusMaster::issue(ModbusRequest &request)
+{
+  if (!request.valid())
   {
-    u16CRC = crc16_update(u16CRC, u8ModbusADU[i]);
+    return ku8MBIllegalFunction;
   }
-  u8ModbusADU[u8ModbusADUSize++] = lowByte(u16CRC);
-  u8ModbusADU[u8ModbusADUSize++] = highByte(u16CRC);
-  u8ModbusADU[u8ModbusADUSize] = 0;
-
-  // transmit request
-  if (_preTransmission)
+  if (_u8State != ku8StateIdle)
   {
-    /*if (_debugMode) Log.info("preTransmission");*/
-    _preTransmission();
+    return ku8MBBusy;
   }
 
-  // flush receive buffer before transmitting request
-  while (_serial->read() > -1);
+  request.setStatus(ku8MBTransactionPending);
+  armTransaction(request.frame(), request.size(), request.responseSize());
+  _pRequest = &request;
+  return awaitTransaction(ku8MBTransactionPending);
+}
 
-  if (_debugMode) Log.trace("TX:");
-  for (i = 0; i < u8ModbusADUSize; i++)
-  {
-    if (_debugMode) Log.trace("- %0x",u8ModbusADU[i]);
-    _serial->write(u8ModbusADU[i]);
-  }
 
-  u8ModbusADUSize = 0;
-  /*if (_debugMode) Log.info("Flushing");*/
-  _serial->flush();    // flush transmit buffer
-  /*if (_debugMode) Log.info("Flushed");*/
-  if (_postTransmission)
-  {
-    /*if (_debugMode) Log.info("postTransmission");*/
-    _postTransmission();
-  }
+/**
+Enable asynchronous transactions.
 
-  // loop until we run out of time or bytes, or an error occurs
-  u32StartTime = millis();
-  if (_debugMode) Log.trace("RX:");
-  bool startedReading = false;
-  while (u8BytesLeft && !u8MBStatus)
-  {
-    int byteRead = _serial->read();
-    if (byteRead>-1)
-    {
-      u32StartTime = millis();
-      // discard any initial 0x00 byte
-      if (startedReading || byteRead != 0) {
-          if (_debugMode) Log.trace("- %0x",byteRead);
-          u8ModbusADU[u8ModbusADUSize++] = (uint8_t) byteRead;
-          u8BytesLeft--;
-          startedReading = true;
+Once enabled, the Modbus function methods (readHoldingRegisters(), etc.)
+only assemble and queue their request and return
+ModbusMaster::ku8MBTransactionPending. The transaction is then advanced by
+calling ModbusMaster::poll() from loop() or a worker thread; its result is
+returned by poll() and passed to the transactionComplete() callback.
+
+@see ModbusMaster::poll()
+@see ModbusMaster::transactionComplete()
+@ingroup setup
+*/
+void ModbusMaster::enableAsync(void)
+{
+  _asyncMode = true;
+}
+
+
+/**
+Disable asynchronous transactions (default).
+
+Modbus function methods block until the transaction completes, calling
+the idle() callback while waiting for the slave.
+
+@ingroup setup
+*/
+void ModbusMaster::disableAsync(void)
+{
+  _asyncMode = false;
+}
+
+
+/**
+Set transaction completion callback function.
+
+This function gets called with the final status (ModbusMaster::ku8MBSuccess
+or an exception number) whenever a transaction completes, in both blocking
+and asynchronous mode. The response buffer is valid when it is called.
+
+@see ModbusMaster::enableAsync()
+@ingroup setup
+*/
+void ModbusMaster::transactionComplete(void (*transactionComplete)(uint8_t))
+{
+  _transactionComplete = transactionComplete;
+}
+
+
+/**
+Advance the transaction in progress.
+
+Never blocks waiting for the slave: every call consumes whatever bytes are
+already available and returns. Call it repeatedly until it returns
+something other than ModbusMaster::ku8MBTransactionPending.
+
+@return ModbusMaster::ku8MBTransactionPending while the transaction is in
+progress; otherwise the status of the last transaction (0 on success;
+exception number on failure)
+@ingroup setup
+*/
+uint8_t ModbusMaster::poll(void)
+{
+  switch (_u8State)
+  {
+    case ku8StateBackoff:
+      if ((millis() - _u32BackoffStart) < _u32BackoffDelay)
+      {
+        break;
       }
-    }
-    else
-    {
-      if (_idle)
+      _u8State = ku8StateTransmit;
+      // fall through
+
+    case ku8StateTransmit:
+      transmitRequest();
+      if (_u8State == ku8StateTransmit)
       {
-        _idle();
+        break;
+      }
+      // fall through
+
+    case ku8StateSend:
+      sendRequest();
+      if (_u8State == ku8StateSend)
+      {
+        break;
       }
+      // fall through
+
+    case ku8StateDrain:
+      finishTransmit();
+      if (_u8State == ku8StateDrain)
+      {
+        break;
+      }
+      // fall through
+
+    case ku8StateWaitResponse:
+    case ku8StateReceive:
+      receiveResponse();
+      if (_u8State != ku8StateValidate)
+      {
+        break;
+      }
+      // fall through
+
+    case ku8StateValidate:
+      endTransaction(validateResponse());
+      break;
+  }
+
+  return (_u8State == ku8StateIdle) ? _u8MBStatus : ku8MBTransactionPending;
+}
+
+
+/**
+Check whether a transaction is in progress.
+
+@return true between the start of a transaction and its completion
+@ingroup setup
+*/
+bool ModbusMaster::busy(void)
+{
+  return _u8State != ku8StateIdle;
+}
+
+
+/**
+Check whether the request is still being put on the wire.
+
+While it is, poll() must be called without delay: the transceiver is
+turned around as soon as the last stop bit has left (see
+setDriverEnable()). Once it returns false, the response is buffered by
+the port and poll() can be called at leisure.
+
+@return true from the start of a transaction until the driver is released
+@ingroup setup
+*/
+bool ModbusMaster::transmitting(void)
+{
+  return _u8State == ku8StateTransmit || _u8State == ku8StateSend ||
+    _u8State == ku8StateDrain;
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+
+/**
+Modbus transaction engine.
+Sequence:
+  - assemble Modbus Request Application Data Unit (ADU),
+    based on particular function called
+  - transmit request over selected serial port
+  - wait for/retrieve response
+  - evaluate/disassemble response
+  - return status (success/exception)
+
+In asynchronous mode only the first step is performed here; the others are
+driven by ModbusMaster::poll().
+
+@param u8MBFunction Modbus function (0x01..0xFF)
+@return 0 on success; exception number on failure
+*/
+uint8_t ModbusMaster::ModbusMasterTransaction(uint8_t u8MBFunction)
+{
+  return awaitTransaction(beginTransaction(u8MBFunction));
+}
+
+
+/**
+Run a started transaction to completion, unless in asynchronous mode.
+
+@param u8MBStatus status returned when the transaction was started
+@return final status in blocking mode; u8MBStatus in asynchronous mode
+*/
+uint8_t ModbusMaster::awaitTransaction(uint8_t u8MBStatus)
+{
+  if (_asyncMode || u8MBStatus != ku8MBTransactionPending)
+  {
+    return u8MBStatus;
+  }
+
+  while ((u8MBStatus = poll()) == ku8MBTransactionPending)
+  {
+    if (_idle)
+    {
+      _idle();
+    }
+  }
+  return u8MBStatus;
+}
+
+
+/**
+Assemble the request ADU from the transmit buffer and arm the state
+machine.
+
+@param u8MBFunction Modbus function (0x01..0xFF)
+@return as beginTransaction(uint8_t, const uint16_t *)
+*/
+uint8_t ModbusMaster::beginTransaction(uint8_t u8MBFunction)
+{
+  return beginTransaction(u8MBFunction, _u16TransmitBuffer);
+}
+
+
+/**
+Assemble the request ADU from the caller's words and arm the state
+machine.
+
+@param u8MBFunction Modbus function (0x01..0xFF)
+@param pu16Data words to write, as ModbusRequest::assemble()
+@return ModbusMaster::ku8MBTransactionPending; ModbusMaster::ku8MBBusy if
+another transaction is still in progress; otherwise the reason
+ModbusRequest::check() rejected the request
+*/
+uint8_t ModbusMaster::beginTransaction(uint8_t u8MBFunction, const uint16_t *pu16Data)
+{
+  uint8_t u8Status, u8ExpectedSize;
+
+  if (_u8State != ku8StateIdle)
+  {
+    return ku8MBBusy;
+  }
+  u8Status = ModbusRequest::check(_u8MBSlave, u8MBFunction, _u16ReadQty, _u16WriteQty,
+    &u8ExpectedSize);
+  if (u8Status)
+  {
+    return u8Status;
+  }
+
+  _u8RequestADUSize = ModbusRequest::assemble(_u8RequestADU, _u8MBSlave, u8MBFunction,
+    _u16ReadAddress, _u16ReadQty, _u16WriteAddress, _u16WriteQty, pu16Data);
+  armTransaction(_u8RequestADU, _u8RequestADUSize, u8ExpectedSize);
+  return ku8MBTransactionPending;
+}
+
+
+/**
+Encode 32-bit values into register words and run them as a 0x10 request.
+
+@param pValues values, 4 bytes each (uint32_t, int32_t or float)
+*/
+uint8_t ModbusMaster::writeRegisters32(uint16_t u16WriteAddress, const void *pValues,
+  uint8_t u8Count, uint8_t u8Order)
+{
+  uint8_t i, u8Bytes[4];
+  uint16_t u16Words[122];
+  uint32_t u32Value;
+
+  if (u8Count < 1 || u8Count > 61)
+  {
+    return ku8MBIllegalDataValue;
+  }
+  for (i = 0; i < u8Count; i++)
+  {
+    memcpy(&u32Value, (const uint8_t *) pValues + 4 * i, sizeof(u32Value));
+    mb_encode_bytes(u8Bytes, u32Value, 2, u8Order);
+    u16Words[2 * i] = word(u8Bytes[0], u8Bytes[1]);
+    u16Words[2 * i + 1] = word(u8Bytes[2], u8Bytes[3]);
+  }
+  _u16WriteAddress = u16WriteAddress;
+  _u16WriteQty = 2 * u8Count;
+  return awaitTransaction(beginTransaction(ku8MBWriteMultipleRegisters, u16Words));
+}
+
+
+/**
+Arm the state machine to send a complete request ADU.
+
+@param pu8Request request ADU, CRC included; must stay valid until the
+transaction completes
+@param u8Size size of the request ADU
+@param u8ExpectedSize size of the expected (non-exception) response, or 0
+if only the response header tells
+*/
+void ModbusMaster::armTransaction(const uint8_t *pu8Request, uint8_t u8Size,
+  uint8_t u8ExpectedSize)
+{
+  _u8MBFunction = pu8Request[1];
+  _pu8RequestADU = pu8Request;
+  _u8RequestADUSize = u8Size;
+  _u8ExpectedSize = u8ExpectedSize;
+  _pRequest = NULL;
+  _activeTimeoutFixed = _u16RequestTimeout != 0;
+  _u16ActiveTimeout = _activeTimeoutFixed ? _u16RequestTimeout : getSlaveTimeout(pu8Request[0]);
+  _u16RequestTimeout = 0;
+  _u8Attempt = 1;
+  _u32TransactionStart = micros();
+  _u8State = ku8StateTransmit;
+}
+
+
+/**
+TX state: wait for the bus to be free, then turn the transceiver to
+transmit.
+
+The request is held back until the bus has been silent for t3.5 since the
+previous frame, as required by the RTU framing rules, then until the pre
+guard time has elapsed since the driver was enabled. It is then handed to
+the port by sendRequest().
+*/
+void ModbusMaster::transmitRequest(void)
+{
+  if (!_guardActive)
+  {
+    if ((micros() - _u32LastBusActivity) < _u32T35)
+    {
+      return;
+    }
+
+    _u32TransmitStart = micros();
+
+    // transmit request
+    if (_preTransmission)
+    {
+      _preTransmission();
+    }
+    driveBus(true);
+    _guardActive = true;
+  }
+
+  if ((micros() - _u32TransmitStart) < _u16PreGuard)
+  {
+    return;
+  }
+  _guardActive = false;
+
+  // flush receive buffer before transmitting request
+  while (_serial->read() > -1);
+
+  if (_debugMode)
+  {
+    Log.trace("TX:");
+    Log.dump(LOG_LEVEL_TRACE, _pu8RequestADU, _u8RequestADUSize);
+  }
+  _u8RequestSent = 0;
+  _stats.u32Attempts++;
+  _u8State = ku8StateSend;
+}
+
+
+/**
+Send state: hand the request ADU to the port, no more than its transmit
+buffer takes without blocking on each step.
+
+A frame longer than the buffer (up to 256 bytes for a 0x10 write of 123
+registers) is fed as the buffer drains, so the caller is not held for the
+time the frame takes on the wire. The transmission then drains in the
+background (see finishTransmit()).
+*/
+void ModbusMaster::sendRequest(void)
+{
+  int iFree = _serial->availableForWrite();
+  uint8_t u8Left = _u8RequestADUSize - _u8RequestSent;
+
+  if (iFree <= 0)
+  {
+    return;
+  }
+  if (u8Left > iFree)
+  {
+    u8Left = (uint8_t) iFree;
+  }
+  _u8RequestSent += _serial->write(_pu8RequestADU + _u8RequestSent, u8Left);
+  if (_u8RequestSent < _u8RequestADUSize)
+  {
+    return;
+  }
+  _stats.u32BytesSent += _u8RequestADUSize;
+  _u8State = ku8StateDrain;
+}
+
+
+/**
+Drain state: wait, without blocking, for the last stop bit of the request
+to leave the line and the post guard time, then switch to waiting for the
+response.
+
+The driver is disabled and postTransmission() called at that moment, the
+earliest the transceiver may be turned around without truncating the
+request.
+*/
+void ModbusMaster::finishTransmit(void)
+{
+  if (!_guardActive)
+  {
+    if (!_serial->transmitComplete())
+    {
+      return;
     }
+    _u32GuardStart = micros();
+    _guardActive = true;
+  }
+
+  if ((micros() - _u32GuardStart) < _u16PostGuard)
+  {
+    return;
+  }
+  _guardActive = false;
+
+  driveBus(false);
+  if (_postTransmission)
+  {
+    _postTransmission();
+  }
+
+  // receive into the frame not holding the last successful response, so
+  // it stays decodable whatever the outcome of this transaction
+  _pu8ResponseADU = (_pu8LastResponse == _u8ResponseFrame[0]) ?
+    _u8ResponseFrame[1] : _u8ResponseFrame[0];
+  _u8ResponseADUSize = 0;
+  _u8BytesLeft = 8;
+  _u16ResponseCRC = 0xFFFF;
+  _u32StartTime = millis();
+  _u32LastBusActivity = _u32TransmitEnd = micros();
+  _stats.transmit.add(_u32TransmitEnd - _u32TransmitStart);
+  _u8State = ku8StateWaitResponse;
+}
+
+
+/**
+Enable or disable the transceiver's driver, if setDriverEnable() was used.
+
+@param enable true to drive the bus, false to listen
+*/
+void ModbusMaster::driveBus(bool enable)
+{
+  if (!_driverEnable)
+  {
+    return;
+  }
+  if (enable == (_u8DEActive == HIGH))
+  {
+    pinSetFast(_dePin);
+  }
+  else
+  {
+    pinResetFast(_dePin);
+  }
+}
+
+
+/**
+Wait/RX states: consume the bytes available so far, without blocking.
+
+Moves to the validate state once the expected number of bytes has been
+received. The transaction ends early if no byte arrives within the
+response timeout, if the header does not match the request, or if the
+line stays silent for t3.5 before the response is complete (the slave
+has finished a frame that is shorter than announced). A broadcast
+succeeds once the turnaround delay has elapsed.
+*/
+void ModbusMaster::receiveResponse(void)
+{
+  int byteRead;
+
+  // nobody answers a broadcast: keep the bus silent until every slave has
+  // executed it, dropping any noise, then report success
+  if (_pu8RequestADU[0] == ku8MBBroadcast)
+  {
+    while (_serial->read() > -1);
+    if ((millis() - _u32StartTime) >= _u16TurnaroundDelay)
+    {
+      _pu8ResponseADU[1] = _u8MBFunction;
+      endTransaction(ku8MBSuccess);
+    }
+    return;
+  }
+
+  while (_u8BytesLeft && (byteRead = _serial->read()) > -1)
+  {
+    _u32LastBusActivity = micros();
+    _stats.u32BytesReceived++;
+    // discard any initial 0x00 byte
+    if (_u8State == ku8StateWaitResponse && byteRead == 0)
+    {
+      continue;
+    }
+    if (_u8ResponseADUSize == 0)
+    {
+      _u32FirstByte = _u32LastBusActivity;
+      _stats.turnaround.add(_u32FirstByte - _u32TransmitEnd);
+    }
+    _pu8ResponseADU[_u8ResponseADUSize++] = (uint8_t) byteRead;
+    // fold each byte into the CRC as it arrives
+    _u16ResponseCRC = crc16_modbus_update(_u16ResponseCRC, (uint8_t) byteRead);
+    _u8BytesLeft--;
+    _u8State = ku8StateReceive;
 
     // evaluate slave ID, function code once enough bytes have been read
-    if (u8ModbusADUSize == 5)
+    if (_u8ResponseADUSize == 5)
     {
       // verify response is for correct Modbus slave
-      if (u8ModbusADU[0] != _u8MBSlave)
+      if (_pu8ResponseADU[0] != _pu8RequestADU[0])
       {
-        u8MBStatus = ku8MBInvalidSlaveID;
-        break;
+        endTransaction(ku8MBInvalidSlaveID);
+        return;
       }
 
       // verify response is for correct Modbus function code (mask exception bit 7)
-      if ((u8ModbusADU[1] & 0x7F) != u8MBFunction)
+      if ((_pu8ResponseADU[1] & 0x7F) != _u8MBFunction)
       {
-        u8MBStatus = ku8MBInvalidFunction;
-        break;
+        endTransaction(ku8MBInvalidFunction);
+        return;
       }
 
       // check whether Modbus exception occurred; return Modbus Exception Code
-      if (bitRead(u8ModbusADU[1], 7))
+      if (bitRead(_pu8ResponseADU[1], 7))
       {
-        u8MBStatus = u8ModbusADU[2];
-        break;
+        endTransaction(_pu8ResponseADU[2]);
+        return;
       }
 
       // evaluate returned Modbus function code
-      switch(u8ModbusADU[1])
+      switch(_pu8ResponseADU[1])
       {
         case ku8MBReadCoils:
         case ku8MBReadDiscreteInputs:
         case ku8MBReadInputRegisters:
         case ku8MBReadHoldingRegisters:
         case ku8MBReadWriteMultipleRegisters:
-          u8BytesLeft = u8ModbusADU[2];
+          _u8BytesLeft = _pu8ResponseADU[2];
           break;
 
         case ku8MBWriteSingleCoil:
         case ku8MBWriteMultipleCoils:
         case ku8MBWriteSingleRegister:
         case ku8MBWriteMultipleRegisters:
-          u8BytesLeft = 3;
+          _u8BytesLeft = 3;
           break;
 
         case ku8MBMaskWriteRegister:
-          u8BytesLeft = 5;
+          _u8BytesLeft = 5;
           break;
       }
     }
-    if ((millis() - u32StartTime) > ku16MBResponseTimeout)
-    {
-      u8MBStatus = ku8MBResponseTimedOut;
-    }
   }
 
-  // verify response is large enough to inspect further
-  if (!u8MBStatus && u8ModbusADUSize >= 5)
+  if (!_u8BytesLeft)
+  {
+    _u8State = ku8StateValidate;
+  }
+  else if (_u8State == ku8StateReceive)
   {
-    // calculate CRC
-    u16CRC = 0xFFFF;
-    for (i = 0; i < (u8ModbusADUSize - 2); i++)
+    if ((micros() - _u32LastBusActivity) > _u32T35)
     {
-      u16CRC = crc16_update(u16CRC, u8ModbusADU[i]);
+      endTransaction(ku8MBInvalidFrame);
     }
+  }
+  else if ((millis() - _u32StartTime) > _u16ActiveTimeout)
+  {
+    endTransaction(ku8MBResponseTimedOut);
+  }
+}
 
-    // verify CRC
-    if (!u8MBStatus && (lowByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 2] ||
-      highByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 1]))
-    {
-      u8MBStatus = ku8MBInvalidCRC;
-    }
+
+/**
+Derive the RTU frame timing from the baud rate.
+
+A character is 11 bits on the wire (start, 8 data, parity or second stop,
+stop). Above 19200 baud the specification fixes t3.5 at 1750 us instead of
+letting it shrink with the character time.
+
+The default response timeout is the slave processing allowance plus the
+time to transmit a maximum size (256 byte) frame.
+
+Only t3.5 is tracked: the t1.5 inter-character limit cannot be observed
+reliably through the UART receive buffer, so a gap inside a frame is only
+detected once it reaches t3.5.
+
+@param u32Speed baud rate
+*/
+void ModbusMaster::setFrameTiming(uint32_t u32Speed)
+{
+  uint32_t u32Timeout;
+
+  if (u32Speed > 19200)
+  {
+    _u32T35 = 1750;
+  }
+  else
+  {
+    _u32T35 = (35UL * 11 * 1000000UL) / (10 * u32Speed);
+  }
+
+  if (!_responseTimeoutSet)
+  {
+    u32Timeout = ku16MBProcessingTime + 256UL * 11 * 1000 / u32Speed;
+    _u16ResponseTimeout = (u32Timeout > 0xFFFF) ? 0xFFFF : (uint16_t) u32Timeout;
+  }
+}
+
+
+/**
+Validate state: check the CRC of the complete response.
+
+@return 0 on success; exception number on failure
+*/
+uint8_t ModbusMaster::validateResponse(void)
+{
+  // verify response is large enough to inspect further; the running CRC
+  // over a frame including its own CRC bytes is zero when it is intact
+  if (_u8ResponseADUSize >= 5 && _u16ResponseCRC != 0)
+  {
+    return ku8MBInvalidCRC;
+  }
+
+  // the request tells how much data it asked for
+  if (_u8ExpectedSize && _u8ResponseADUSize != _u8ExpectedSize)
+  {
+    return ku8MBInvalidFrame;
+  }
+  return ku8MBSuccess;
+}
+
+
+/**
+Complete the transaction: keep the response, reset the buffers and report
+the status.
+
+A successful response is only disassembled into words when the word
+buffer API asks for it (see decodeResponseWords()).
+
+@param u8MBStatus 0 on success; exception number on failure
+*/
+void ModbusMaster::endTransaction(uint8_t u8MBStatus)
+{
+  recordAttempt(u8MBStatus);
+  updateRtt(u8MBStatus);
+  if (u8MBStatus && scheduleRetry(u8MBStatus))
+  {
+    return;
   }
+  recordTransaction(u8MBStatus);
 
-  // disassemble ADU into words
+  _retryStats.u32Transactions++;
   if (!u8MBStatus)
   {
-    // evaluate returned Modbus function code
-    switch(u8ModbusADU[1])
+    _pu8LastResponse = _pu8ResponseADU;
+    _responseDecoded = false;
+    _u16ResponseBits = (_u8MBFunction == ku8MBReadCoils || _u8MBFunction == ku8MBReadDiscreteInputs) ?
+      word(_pu8RequestADU[4], _pu8RequestADU[5]) : 0;
+    if (_u8Attempt > 1)
     {
-      case ku8MBReadCoils:
-      case ku8MBReadDiscreteInputs:
-        // load bytes into word; response bytes are ordered L, H, L, H, ...
-        for (i = 0; i < (u8ModbusADU[2] >> 1); i++)
-        {
-          if (i < ku8MaxBufferSize)
-          {
-            _u16ResponseBuffer[i] = word(u8ModbusADU[2 * i + 4], u8ModbusADU[2 * i + 3]);
-          }
-
-          _u8ResponseBufferLength = i;
-        }
-
-        // in the event of an odd number of bytes, load last byte into zero-padded word
-        if (u8ModbusADU[2] % 2)
-        {
-          if (i < ku8MaxBufferSize)
-          {
-            _u16ResponseBuffer[i] = word(0, u8ModbusADU[2 * i + 3]);
-          }
-
-          _u8ResponseBufferLength = i + 1;
-        }
-        break;
-
-      case ku8MBReadInputRegisters:
-      case ku8MBReadHoldingRegisters:
-      case ku8MBReadWriteMultipleRegisters:
-        // load bytes into word; response bytes are ordered H, L, H, L, ...
-        for (i = 0; i < (u8ModbusADU[2] >> 1); i++)
-        {
-          if (i < ku8MaxBufferSize)
-          {
-            _u16ResponseBuffer[i] = word(u8ModbusADU[2 * i + 3], u8ModbusADU[2 * i + 4]);
-          }
-
-          _u8ResponseBufferLength = i;
-        }
-        break;
+      _retryStats.u32Recovered++;
     }
   }
+  else if (retryClass(u8MBStatus) & _u8RetryOn)
+  {
+    _retryStats.u32Exhausted++;
+  }
+  else
+  {
+    _retryStats.u32NotRetried++;
+  }
 
   _u8TransmitBufferIndex = 0;
   u16TransmitBufferLength = 0;
   _u8ResponseBufferIndex = 0;
+  _u8MBStatus = u8MBStatus;
+  _u8State = ku8StateIdle;
   if (_debugMode) Log.info("Status: %0x",u8MBStatus);
-  return u8MBStatus;
+  if (_pRequest)
+  {
+    _pRequest->complete(u8MBStatus, _pu8ResponseADU);
+    _pRequest = NULL;
+  }
+  if (_transactionComplete)
+  {
+    _transactionComplete(u8MBStatus);
+  }
+}
+
+
+/**
+Start the back-off before the next attempt if the retry policy allows it.
+
+The request ADU is kept as assembled, so the retry sends the same frame.
+
+@param u8MBStatus exception number of the failed attempt
+@return true if the transaction continues with a retry
+*/
+bool ModbusMaster::scheduleRetry(uint8_t u8MBStatus)
+{
+  uint8_t i;
+
+  if (_u8Attempt >= _u8RetryAttempts || !(retryClass(u8MBStatus) & _u8RetryOn))
+  {
+    return false;
+  }
+
+  // double the delay for every retry already made, up to the cap
+  _u32BackoffDelay = _u16RetryBackoff;
+  for (i = 1; i < _u8Attempt && _u32BackoffDelay < _u16RetryMaxBackoff; i++)
+  {
+    _u32BackoffDelay <<= 1;
+  }
+  if (_u32BackoffDelay > _u16RetryMaxBackoff)
+  {
+    _u32BackoffDelay = _u16RetryMaxBackoff;
+  }
+
+  if (_debugMode) Log.info("Retry %u after %0x, %lu ms", _u8Attempt, u8MBStatus, _u32BackoffDelay);
+  _u8Attempt++;
+  _retryStats.u32Retries++;
+  if (!_activeTimeoutFixed)
+  {
+    _u16ActiveTimeout = getSlaveTimeout(_pu8RequestADU[0]);
+  }
+  _u32BackoffStart = millis();
+  _u8State = ku8StateBackoff;
+  return true;
+}
+
+
+/**
+Account for the end of an attempt: receive latency, bus time and errors.
+*/
+void ModbusMaster::recordAttempt(uint8_t u8MBStatus)
+{
+  uint32_t u32Busy = _u32TransmitEnd - _u32TransmitStart;
+
+  if (_debugMode && _u8ResponseADUSize)
+  {
+    Log.trace("RX:");
+    Log.dump(LOG_LEVEL_TRACE, _pu8ResponseADU, _u8ResponseADUSize);
+  }
+
+  if (_u8ResponseADUSize)
+  {
+    _stats.receive.add(_u32LastBusActivity - _u32FirstByte);
+    u32Busy += _u32LastBusActivity - _u32FirstByte;
+  }
+  _stats.u64BusyTime += u32Busy;
+  if (u8MBStatus)
+  {
+    _stats.u32Errors[ModbusMasterStats::statusIndex(u8MBStatus)]++;
+  }
+}
+
+
+/**
+Per-slave round-trip time estimate.
+
+@param u8Slave slave ID
+@param create true to take a free entry if the slave has none
+@return estimate; NULL if the slave has none (and the table is full)
+*/
+ModbusRttEstimate *ModbusMaster::rttEstimate(uint8_t u8Slave, bool create)
+{
+  uint8_t i;
+
+  for (i = 0; i < ku8RttSlaves && _rtt[i].u32Samples; i++)
+  {
+    if (_rtt[i].u8Slave == u8Slave)
+    {
+      return &_rtt[i];
+    }
+  }
+  if (!create || i == ku8RttSlaves)
+  {
+    return NULL;
+  }
+  _rtt[i].u8Slave = u8Slave;
+  return &_rtt[i];
+}
+
+
+/**
+Fold the outcome of an attempt into the slave's round-trip time estimate.
+
+Only first attempts are sampled (Karn's algorithm): the answer to a
+retry may be a late answer to the previous attempt.
+*/
+void ModbusMaster::updateRtt(uint8_t u8MBStatus)
+{
+  ModbusRttEstimate *rtt;
+  uint32_t u32Sample, u32Delta;
+
+  // a timeout imposed by setRequestTimeout() says nothing about the slave
+  if (u8MBStatus == ku8MBResponseTimedOut)
+  {
+    rtt = _activeTimeoutFixed ? NULL : rttEstimate(_pu8RequestADU[0], false);
+    if (rtt && rtt->u8Backoff < ku8RttMaxBackoff)
+    {
+      rtt->u8Backoff++;
+    }
+    return;
+  }
+
+  // an answer from the slave, with data or a protocol exception
+  if (u8MBStatus >= 0x10 || !_u8ResponseADUSize || _u8Attempt > 1)
+  {
+    return;
+  }
+  rtt = rttEstimate(_pu8RequestADU[0], true);
+  if (!rtt)
+  {
+    return;
+  }
+
+  u32Sample = _u32FirstByte - _u32TransmitEnd;
+  if (!rtt->u32Samples)
+  {
+    rtt->u32Srtt = u32Sample;
+    rtt->u32RttVar = u32Sample / 2;
+  }
+  else
+  {
+    u32Delta = (rtt->u32Srtt > u32Sample) ? rtt->u32Srtt - u32Sample : u32Sample - rtt->u32Srtt;
+    rtt->u32RttVar = rtt->u32RttVar - rtt->u32RttVar / 4 + u32Delta / 4;
+    rtt->u32Srtt = rtt->u32Srtt - rtt->u32Srtt / 8 + u32Sample / 8;
+  }
+  rtt->u32Samples++;
+  rtt->u8Backoff = 0;
+}
+
+
+/**
+Account for a completed transaction: per-function and per-slave counts
+and total latency.
+*/
+void ModbusMaster::recordTransaction(uint8_t u8MBStatus)
+{
+  uint8_t i;
+
+  _stats.u32Transactions++;
+  _stats.total.add(micros() - _u32TransactionStart);
+  if (_u8MBFunction < ModbusMasterStats::ku8Functions)
+  {
+    _stats.u32Functions[_u8MBFunction]++;
+  }
+
+  // slaves take the first free entry of the table on their first transaction
+  for (i = 0; i < ModbusMasterStats::ku8Slaves; i++)
+  {
+    ModbusSlaveStats &slave = _stats.slaves[i];
+    if (slave.u32Transactions == 0)
+    {
+      slave.u8Slave = _pu8RequestADU[0];
+    }
+    if (slave.u8Slave == _pu8RequestADU[0])
+    {
+      slave.u32Transactions++;
+      if (u8MBStatus)
+      {
+        slave.u32Errors++;
+      }
+      return;
+    }
+  }
+  _stats.u32OtherSlaves++;
+}
+
+
+/**
+Map a failure status to its ku8RetryOn* class.
+
+@return class bit; 0 for statuses that are never retried
+*/
+uint8_t ModbusMaster::retryClass(uint8_t u8MBStatus)
+{
+  switch (u8MBStatus)
+  {
+    case ku8MBResponseTimedOut:
+      return ku8RetryOnTimeout;
+
+    case ku8MBInvalidCRC:
+      return ku8RetryOnCRC;
+
+    case ku8MBInvalidFrame:
+      return ku8RetryOnFrame;
+
+    case ku8MBInvalidSlaveID:
+    case ku8MBInvalidFunction:
+      return ku8RetryOnMismatch;
+
+    case ku8MBSlaveDeviceFailure:
+    case 0x06: // slave device busy
+      return ku8RetryOnDeviceBusy;
+
+    default:
+      return 0;
+  }
+}
+
+
+/**
+Disassemble the last successful response into the word buffer.
+
+Done at most once per response, on the first call to an accessor of the
+word buffer; the typed decodeResponse() functions read the ADU directly
+and never need it.
+*/
+void ModbusMaster::decodeResponseWords(void)
+{
+  if (_responseDecoded)
+  {
+    return;
+  }
+  _responseDecoded = true;
+  _u8ResponseBufferLength = ModbusRequest::disassemble(_pu8LastResponse, _u16ResponseBuffer);
+}
+
+
+/**
+Locate registers of the last successful response.
+
+@param u8Register index of the first register in the response
+@param u8Words registers per value
+@param u8Qty number of values requested
+@param ppu8Data set to the first byte of the first register
+@return number of complete values available (at most u8Qty)
+*/
+uint8_t ModbusMaster::responseRegisters(uint8_t u8Register, uint8_t u8Words,
+  uint8_t u8Qty, const uint8_t **ppu8Data)
+{
+  uint8_t u8Registers;
+
+  if (_pu8LastResponse == NULL)
+  {
+    return 0;
+  }
+
+  switch(_pu8LastResponse[1])
+  {
+    case ku8MBReadInputRegisters:
+    case ku8MBReadHoldingRegisters:
+    case ku8MBReadWriteMultipleRegisters:
+      u8Registers = _pu8LastResponse[2] >> 1;
+      break;
+
+    default:
+      return 0;
+  }
+
+  if (u8Register >= u8Registers)
+  {
+    return 0;
+  }
+  if (u8Qty > (u8Registers - u8Register) / u8Words)
+  {
+    u8Qty = (u8Registers - u8Register) / u8Words;
+  }
+  *ppu8Data = _pu8LastResponse + 3 + 2 * u8Register;
+  return u8Qty;
 }
@@ -51,6 +51,21 @@ Arduino library for communicating with Modbus slaves over RS232/485 (via RTU pro
 // functions to calculate Modbus Application Data Unit CRC
 #include "util/crc16.h"
 
+// functions to assemble multi-register values
+#include "util/decode.h"
+
+// serial port abstraction
+#include "ModbusSerial.h"
+
+// transaction counters and latency histograms
+#include "ModbusStats.h"
+
+// request frames compiled once for repeated polls
+#include "ModbusPreparedRequest.h"
+
+// bit-packed coil/discrete input sets
+#include "ModbusBitset.h"
+
 // functions to manipulate words
 // #include "util/word.h"
 
@@ -89,7 +104,69 @@ union StringData
   wchar_t w[32];
 };
 
+class ModbusRequest;
+
 /* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Read-only, non-owning view over a block of response words.
+
+Returned by ModbusMaster::getResponseView(); valid until the next
+transaction on the same master. Indexing is unchecked, use size().
+
+@ingroup buffer
+*/
+class ModbusResponseView
+{
+  public:
+    ModbusResponseView(const uint16_t *pu16Data, uint8_t u8Size)
+      : _pu16Data(pu16Data), _u8Size(u8Size) {}
+
+    const uint16_t *data(void) const { return _pu16Data; }
+    uint8_t size(void) const { return _u8Size; }
+    bool empty(void) const { return _u8Size == 0; }
+    uint16_t operator[](uint8_t u8Index) const { return _pu16Data[u8Index]; }
+    const uint16_t *begin(void) const { return _pu16Data; }
+    const uint16_t *end(void) const { return _pu16Data + _u8Size; }
+
+  private:
+    const uint16_t *_pu16Data;                                   ///< first word
+    uint8_t _u8Size;                                             ///< number of words
+};
+
+
+/**
+Counters of the retry policy of a ModbusMaster.
+
+@see ModbusMaster::getRetryStats()
+@ingroup setup
+*/
+struct ModbusRetryStats
+{
+  uint32_t u32Transactions;                                      ///< transactions completed
+  uint32_t u32Retries;                                           ///< requests sent again after a retriable failure
+  uint32_t u32Recovered;                                         ///< transactions that succeeded after at least one retry
+  uint32_t u32Exhausted;                                         ///< transactions that still failed after the last attempt
+  uint32_t u32NotRetried;                                        ///< failures whose status is not retried by the policy
+};
+
+
+/**
+Round-trip time estimate of one slave, as kept by the adaptive response
+timeout.
+
+@see ModbusMaster::enableAdaptiveTimeout()
+@ingroup setup
+*/
+struct ModbusRttEstimate
+{
+  uint8_t  u8Slave;                                              ///< slave ID
+  uint8_t  u8Backoff;                                            ///< timeouts since the last sample; each doubles the timeout
+  uint32_t u32Samples;                                           ///< turnaround samples taken; 0 for an unused entry
+  uint32_t u32Srtt;                                              ///< smoothed turnaround time [microseconds]
+  uint32_t u32RttVar;                                            ///< smoothed mean deviation of the turnaround [microseconds]
+};
+
+
 /**
 Arduino class library for communicating with Modbus slaves over
 RS232/485 (via RTU protocol).
@@ -100,14 +177,46 @@ class ModbusMaster
     ModbusMaster();
 
     void begin(uint8_t slaveID, USARTSerial &serial);
+    void begin(uint8_t slaveID, ModbusSerial &serial);
+    void begin(uint8_t slaveID, USARTSerial &serial, pin_t dePin, uint8_t deActive = HIGH);
+    void begin(uint8_t slaveID, ModbusSerial &serial, pin_t dePin, uint8_t deActive = HIGH);
     void setSlave(uint8_t slave);
 
+    void setDriverEnable(pin_t, uint8_t = HIGH);
+    void setGuardTimes(uint16_t, uint16_t);
+
     void idle(void (*)());
     void preTransmission(void (*)());
     void postTransmission(void (*)());
 
-    void setSpeed(uint16_t speed);
-    void setSpeed(uint16_t speed, uint32_t config);
+    void setSpeed(uint32_t speed);
+    void setSpeed(uint32_t speed, uint32_t config);
+
+    void     setResponseTimeout(uint16_t);
+    uint16_t getResponseTimeout(void);
+    void     setRequestTimeout(uint16_t);
+    void     setTurnaroundDelay(uint16_t);
+
+    void     enableAdaptiveTimeout(uint16_t = 50, uint16_t = 0);
+    void     disableAdaptiveTimeout(void);
+    uint16_t getSlaveTimeout(uint8_t);
+    bool     getRttEstimate(uint8_t, ModbusRttEstimate &);
+    void     clearRttEstimates(void);
+
+    // retriable failure classes, see setRetryPolicy()
+    static const uint8_t ku8RetryOnTimeout               = 0x01; ///< ku8MBResponseTimedOut
+    static const uint8_t ku8RetryOnCRC                   = 0x02; ///< ku8MBInvalidCRC
+    static const uint8_t ku8RetryOnFrame                 = 0x04; ///< ku8MBInvalidFrame
+    static const uint8_t ku8RetryOnMismatch              = 0x08; ///< ku8MBInvalidSlaveID, ku8MBInvalidFunction
+    static const uint8_t ku8RetryOnDeviceBusy            = 0x10; ///< exceptions 0x04 slave device failure, 0x06 slave device busy
+    static const uint8_t ku8RetryDefault                 = 0x07; ///< line noise: timeout, CRC, frame
+
+    void     setRetryPolicy(uint8_t, uint16_t = 0, uint16_t = 0, uint8_t = ku8RetryDefault);
+    ModbusRetryStats getRetryStats(void);
+    void     clearRetryStats(void);
+
+    void     getStats(ModbusMasterStats &);
+    void     clearStats(void);
 
     // Modbus exception codes
     /**
@@ -221,7 +330,80 @@ class ModbusMaster
     */
     static const uint8_t ku8MBInvalidCRC                 = 0xE3;
 
+    /**
+    ModbusMaster transaction pending.
+
+    The transaction has been started but has not completed yet; keep
+    calling ModbusMaster::poll() until it returns another status.
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBTransactionPending         = 0xE4;
+
+    /**
+    ModbusMaster busy exception.
+
+    A new transaction was requested while another one is still in progress
+    (asynchronous mode only). The request was not sent.
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBBusy                       = 0xE5;
+
+    /**
+    ModbusMaster invalid response frame exception.
+
+    The slave stopped transmitting (t3.5 inter-frame silence) before the
+    number of bytes announced by the response header was received.
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBInvalidFrame               = 0xE6;
+
+    /**
+    ModbusMaster slave offline exception.
+
+    The request was not sent because the slave stopped answering and is
+    in back-off (see ModbusBus).
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBSlaveOffline               = 0xE7;
+
+    /**
+    ModbusMaster request cancelled exception.
+
+    The request object was removed from the bus queue (see
+    ModbusBus::cancel()) before it was sent.
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBCancelled                  = 0xE8;
+
+    /**
+    Broadcast slave ID.
+
+    A write sent to this ID is executed by every slave and answered by
+    none: the transaction succeeds once the request has been sent and the
+    turnaround delay (see setTurnaroundDelay()) has elapsed. Read
+    functions cannot be broadcast and fail with
+    ModbusMaster::ku8MBIllegalFunction.
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBBroadcast                  = 0x00;
+
     uint16_t getResponseBuffer(uint8_t);
+    ModbusResponseView getResponseView(void);
+    uint8_t  getResponseLength(void);
+    uint8_t  copyResponse(uint16_t *, uint8_t);
+    uint16_t getResponseBits(ModbusBitset &);
+    uint8_t  decodeResponse(uint8_t, uint16_t *, uint8_t, uint8_t = ku8MBOrderABCD);
+    uint8_t  decodeResponse(uint8_t, int16_t *, uint8_t, uint8_t = ku8MBOrderABCD);
+    uint8_t  decodeResponse(uint8_t, uint32_t *, uint8_t, uint8_t = ku8MBOrderABCD);
+    uint8_t  decodeResponse(uint8_t, int32_t *, uint8_t, uint8_t = ku8MBOrderABCD);
+    uint8_t  decodeResponse(uint8_t, float *, uint8_t, uint8_t = ku8MBOrderABCD);
+    uint8_t  decodeResponse(uint8_t, double *, uint8_t, uint8_t = ku8MBOrderABCD);
     void     clearResponseBuffer();
     uint8_t  setTransmitBuffer(uint8_t, uint16_t);
     void     clearTransmitBuffer();
@@ -229,6 +411,13 @@ class ModbusMaster
     void enableDebug(void);
     void disableDebug(void);
 
+    void    enableAsync(void);
+    void    disableAsync(void);
+    void    transactionComplete(void (*)(uint8_t));
+    uint8_t poll(void);
+    bool    busy(void);
+    bool    transmitting(void);
+
     void beginTransmission(uint16_t);
     uint8_t requestFrom(uint16_t, uint16_t);
     void sendBit(bool);
@@ -249,16 +438,26 @@ class ModbusMaster
     uint8_t  writeMultipleCoils();
     uint8_t  writeMultipleRegisters(uint16_t, uint16_t);
     uint8_t  writeMultipleRegisters();
+    uint8_t  writeRegisters(uint16_t, const uint16_t *, uint8_t);
+    uint8_t  writeRegisters(uint16_t, const uint32_t *, uint8_t, uint8_t = ku8MBOrderABCD);
+    uint8_t  writeRegisters(uint16_t, const int32_t *, uint8_t, uint8_t = ku8MBOrderABCD);
+    uint8_t  writeRegisters(uint16_t, const float *, uint8_t, uint8_t = ku8MBOrderABCD);
+    uint8_t  writeCoils(uint16_t, const uint16_t *, uint16_t);
+    uint8_t  writeCoils(uint16_t, const ModbusBitset &);
     uint8_t  maskWriteRegister(uint16_t, uint16_t, uint16_t);
     uint8_t  readWriteMultipleRegisters(uint16_t, uint16_t, uint16_t, uint16_t);
     uint8_t  readWriteMultipleRegisters(uint16_t, uint16_t);
 
+    uint8_t  issue(const ModbusPreparedRequest &);
+    uint8_t  issue(ModbusRequest &);
+
   private:
-    USARTSerial* _serial;                                             ///< reference to serial port object
+    ModbusSerial* _serial;                                       ///< reference to serial port object
+    ModbusUSARTSerial _usartSerial;                              ///< adapter used when begin() is given a hardware UART
     bool _debugMode;
 
     uint8_t  _u8MBSlave;                                         ///< Modbus slave (1..255) initialized in begin()
-    static const uint8_t ku8MaxBufferSize                = 64;   ///< size of response/transmit buffers
+    static const uint8_t ku8MaxBufferSize                = 125;  ///< size of response/transmit buffers (125 registers read, 123 written, 2000 coils)
     uint16_t _u16ReadAddress;                                    ///< slave register from which to read
     uint16_t _u16ReadQty;                                        ///< quantity of words to read
     uint16_t _u16ResponseBuffer[ku8MaxBufferSize];               ///< buffer to store Modbus slave response; read via GetResponseBuffer()
@@ -271,6 +470,7 @@ class ModbusMaster
     uint16_t* rxBuffer; // from Wire.h -- need to clean this up Rx
     uint8_t _u8ResponseBufferIndex;
     uint8_t _u8ResponseBufferLength;
+    bool _responseDecoded;                                       ///< true once the last response has been disassembled into _u16ResponseBuffer
 
     // Modbus function codes for bit access
     static const uint8_t ku8MBReadCoils                  = 0x01; ///< Modbus function 0x01 Read Coils
@@ -287,17 +487,114 @@ class ModbusMaster
     static const uint8_t ku8MBReadWriteMultipleRegisters = 0x17; ///< Modbus function 0x17 Read Write Multiple Registers
 
     // Modbus timeout [milliseconds]
-    static const uint16_t ku16MBResponseTimeout          = 500; ///< Modbus timeout [milliseconds]
+    static const uint16_t ku16MBProcessingTime           = 207; ///< slave processing allowance of the default response timeout; 500 ms in total at 9600 baud [milliseconds]
+    static const uint16_t ku16MBTurnaroundDelay          = 100; ///< default bus silence after a broadcast, for every slave to process it [milliseconds]
+
+    // transaction state machine
+    static const uint8_t ku8StateIdle                    = 0;    ///< no transaction in progress
+    static const uint8_t ku8StateTransmit                = 1;    ///< request assembled, waiting to be sent
+    static const uint8_t ku8StateWaitResponse            = 2;    ///< request sent, waiting for the first response byte
+    static const uint8_t ku8StateReceive                 = 3;    ///< receiving the response
+    static const uint8_t ku8StateValidate                = 4;    ///< response complete, CRC to be checked
+    static const uint8_t ku8StateBackoff                 = 5;    ///< retriable failure, waiting to send the request again
+    static const uint8_t ku8StateDrain                   = 6;    ///< request handed to the port, waiting for its last stop bit
+    static const uint8_t ku8StateSend                    = 7;    ///< request being handed to the port as its transmit buffer frees up
+
+    uint8_t  _u8State;                                           ///< current ku8State* of the transaction
+    bool     _asyncMode;                                         ///< true if function methods return before completion
+    uint8_t  _u8MBFunction;                                      ///< function code of the transaction in progress
+    uint8_t  _u8MBStatus;                                        ///< status of the last completed transaction
+    uint8_t  _u8RequestADU[256];                                 ///< request ADU assembled by the function methods
+    const uint8_t *_pu8RequestADU;                               ///< request ADU being sent: _u8RequestADU or a prepared frame
+    uint8_t  _u8RequestADUSize;                                  ///< request ADU size, CRC included
+    uint8_t  _u8RequestSent;                                     ///< request ADU bytes handed to the port so far
+    uint8_t  _u8ExpectedSize;                                    ///< expected response size; 0 if not known in advance
+    ModbusRequest *_pRequest;                                    ///< request object receiving the outcome; NULL for the function methods
+    uint8_t  _u8ResponseFrame[2][256];                           ///< response ADUs, received alternately
+    uint8_t *_pu8ResponseADU;                                    ///< response ADU being received
+    const uint8_t *_pu8LastResponse;                             ///< last successful response ADU; NULL if none
+    uint16_t _u16ResponseBits;                                   ///< coils/inputs requested by the last successful 0x01/0x02 transaction; 0 otherwise
+    uint8_t  _u8ResponseADUSize;                                 ///< response bytes received so far
+    uint8_t  _u8BytesLeft;                                       ///< response bytes still expected
+    uint16_t _u16ResponseCRC;                                    ///< running CRC of the response bytes received so far
+    uint32_t _u32StartTime;                                      ///< time the request finished sending [milliseconds]
+    uint32_t _u32LastBusActivity;                                ///< time of the last byte sent or received [microseconds]
+
+    uint16_t _u16ResponseTimeout;                                ///< time to first response byte; set via setResponseTimeout()
+    bool     _responseTimeoutSet;                                ///< false while _u16ResponseTimeout follows the baud rate
+    uint16_t _u16RequestTimeout;                                 ///< one-shot override for the next transaction; 0 if unset
+    uint16_t _u16ActiveTimeout;                                  ///< response timeout of the transaction in progress
+    uint16_t _u16TurnaroundDelay;                                ///< bus silence after a broadcast [milliseconds]
+    bool     _activeTimeoutFixed;                                ///< true if _u16ActiveTimeout came from setRequestTimeout()
+    uint32_t _u32T35;                                            ///< RTU t3.5 inter-frame silence [microseconds]
+
+    static const uint8_t ku8RttSlaves                    = 16;   ///< slaves with a round-trip time estimate
+    static const uint8_t ku8RttMaxBackoff                = 3;    ///< timeouts doubling the adaptive timeout, at most
+    bool     _adaptiveTimeout;                                   ///< true if response timeouts follow each slave's turnaround
+    uint16_t _u16TimeoutFloor;                                   ///< shortest adaptive timeout [milliseconds]
+    uint16_t _u16TimeoutCeiling;                                 ///< longest adaptive timeout [milliseconds]; 0 for _u16ResponseTimeout
+    ModbusRttEstimate _rtt[ku8RttSlaves];                        ///< per-slave estimates, first come first served
+
+    uint8_t  _u8RetryAttempts;                                   ///< attempts per transaction, first one included
+    uint8_t  _u8RetryOn;                                         ///< ku8RetryOn* classes that are retried
+    uint16_t _u16RetryBackoff;                                   ///< delay before the first retry [milliseconds]
+    uint16_t _u16RetryMaxBackoff;                                ///< cap of the doubling delay [milliseconds]
+    uint8_t  _u8Attempt;                                         ///< attempts made so far in the transaction in progress
+    uint32_t _u32BackoffStart;                                   ///< time the current back-off started [milliseconds]
+    uint32_t _u32BackoffDelay;                                   ///< length of the current back-off [milliseconds]
+    ModbusRetryStats _retryStats;                                ///< retry policy counters
+
+    ModbusMasterStats _stats;                                    ///< instrumentation counters
+    uint32_t _u32TransactionStart;                               ///< time the transaction started [microseconds]
+    uint32_t _u32TransmitStart;                                  ///< time the current attempt started sending [microseconds]
+    uint32_t _u32TransmitEnd;                                    ///< time the current attempt finished sending [microseconds]
+    uint32_t _u32FirstByte;                                      ///< time the first response byte arrived [microseconds]
+
+    bool     _driverEnable;                                      ///< true if _dePin drives the transceiver DE/RE pins
+    pin_t    _dePin;                                             ///< transceiver DE/RE pin
+    uint8_t  _u8DEActive;                                        ///< level of _dePin that enables the driver
+    uint16_t _u16PreGuard;                                       ///< delay from driver enable to the first bit [microseconds]
+    uint16_t _u16PostGuard;                                      ///< delay from the last stop bit to driver disable [microseconds]
+    bool     _guardActive;                                       ///< true while a pre/post guard time is running
+    uint32_t _u32GuardStart;                                     ///< time the post guard started [microseconds]
 
     // master function that conducts Modbus transactions
     uint8_t ModbusMasterTransaction(uint8_t u8MBFunction);
 
+    // transaction state machine steps
+    uint8_t beginTransaction(uint8_t u8MBFunction);
+    uint8_t beginTransaction(uint8_t u8MBFunction, const uint16_t *pu16Data);
+    uint8_t writeRegisters32(uint16_t u16WriteAddress, const void *pValues, uint8_t u8Count,
+      uint8_t u8Order);
+    void    armTransaction(const uint8_t *pu8Request, uint8_t u8Size, uint8_t u8ExpectedSize);
+    uint8_t awaitTransaction(uint8_t u8MBStatus);
+    void    transmitRequest(void);
+    void    sendRequest(void);
+    void    finishTransmit(void);
+    void    driveBus(bool enable);
+    void    receiveResponse(void);
+    uint8_t validateResponse(void);
+    void    setFrameTiming(uint32_t u32Speed);
+    void    endTransaction(uint8_t u8MBStatus);
+    bool    scheduleRetry(uint8_t u8MBStatus);
+    void    recordAttempt(uint8_t u8MBStatus);
+    void    recordTransaction(uint8_t u8MBStatus);
+    static uint8_t retryClass(uint8_t u8MBStatus);
+    ModbusRttEstimate *rttEstimate(uint8_t u8Slave, bool create);
+    void    updateRtt(uint8_t u8MBStatus);
+
+    // response decoding
+    void    decodeResponseWords(void);
+    uint8_t responseRegisters(uint8_t u8Register, uint8_t u8Words, uint8_t u8Qty, const uint8_t **ppu8Data);
+
     // idle callback function; gets called during idle time between TX and RX
     void (*_idle)();
     // preTransmission callback function; gets called before writing a Modbus message
     void (*_preTransmission)();
     // postTransmission callback function; gets called after a Modbus message has been sent
     void (*_postTransmission)();
+    // transactionComplete callback function; gets called with the status of each completed transaction
+    void (*_transactionComplete)(uint8_t);
 };
 #endif
 
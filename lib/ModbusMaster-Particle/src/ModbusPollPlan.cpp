@@ -0,0 +1,626 @@
+/**
+@file
+Register poll plan: coalesces scattered register reads into few requests.
+*/
+/*
+
+  ModbusPollPlan.cpp - Register poll plan for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusPollPlan.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+/**
+Constructor.
+
+Creates an empty plan reading from slave 1 with no gap fill.
+
+@ingroup pollplan
+*/
+ModbusPollPlan::ModbusPollPlan()
+{
+  _u8Slave = 1;
+  _u8GapFill = 0;
+  _u8MaxBlock = ku8MaxBlockSize;
+  _u32Requests = 0;
+  _updating = false;
+  _update = NULL;
+  _updateContext = NULL;
+  clear();
+}
+
+/**
+Set the slave the points are read from.
+
+@param u8Slave Modbus slave ID (1..247)
+@ingroup pollplan
+*/
+void ModbusPollPlan::setSlave(uint8_t u8Slave)
+{
+  _u8Slave = u8Slave;
+}
+
+/**
+Set the gap fill threshold.
+
+Two points are merged into the same request when at most this many
+unused registers separate them. Reading a few extra registers is almost
+always cheaper than another round trip, but some devices answer with an
+illegal data address exception when a range crosses unmapped registers.
+
+@param u8Registers unused registers allowed between merged points (default 0)
+@ingroup pollplan
+*/
+void ModbusPollPlan::setGapFill(uint8_t u8Registers)
+{
+  _u8GapFill = u8Registers;
+}
+
+/**
+Limit the size of merged requests.
+
+A request on a shared bus cannot be interrupted: urgent traffic queued
+behind it (see ModbusBus::submit()) waits for the whole response. Smaller
+blocks cost a few more round trips per scan but bound that wait, e.g. 16
+registers keep it around 50 ms at 9600 baud instead of 300 ms for 125.
+
+@param u8Registers registers per request (4..125, default 125)
+@ingroup pollplan
+*/
+void ModbusPollPlan::setMaxBlock(uint8_t u8Registers)
+{
+  _u8MaxBlock = (u8Registers < 4) ? 4 :
+    (u8Registers > ku8MaxBlockSize) ? ku8MaxBlockSize : u8Registers;
+}
+
+/**
+Declare a register point.
+
+@param u8Function ModbusMaster function code, 0x03 (holding) or 0x04 (input)
+@param u16Address first register of the point (0x0000..0xFFFF)
+@param u8Type ModbusPollPlan::ku8TypeUInt16 .. ModbusPollPlan::ku8TypeFloat64
+@param u32Interval poll interval [milliseconds]; 0 to read on every cycle
+@param u8Order register/byte order, ku8MBOrderABCD (default) .. ku8MBOrderDCBA
+@return point index, or -1 if the plan is full or the arguments are invalid
+@ingroup pollplan
+*/
+int8_t ModbusPollPlan::add(uint8_t u8Function, uint16_t u16Address, uint8_t u8Type,
+  uint32_t u32Interval, uint8_t u8Order)
+{
+  uint8_t i, u8Point;
+
+  if (_u8Points >= ku8MaxPoints || (u8Function != 0x03 && u8Function != 0x04) ||
+    u8Type > ku8TypeFloat64 || u8Order > ku8MBOrderDCBA || (uint32_t) u16Address + width(u8Type) > 0x10000)
+  {
+    return -1;
+  }
+
+  u8Point = _u8Points++;
+  _points[u8Point].u8Function = u8Function;
+  _points[u8Point].u8Type = u8Type;
+  _points[u8Point].u8WordOrder = u8Order;
+  _points[u8Point].u16Address = u16Address;
+  _points[u8Point].u32Interval = u32Interval;
+  _points[u8Point].u32LastPoll = 0;
+  _points[u8Point].u32Updated = 0;
+  memset(_points[u8Point].u16Raw, 0, sizeof(_points[u8Point].u16Raw));
+  _points[u8Point].u8Status = ModbusMaster::ku8MBResponseTimedOut;
+  _points[u8Point].polled = false;
+  _points[u8Point].visited = false;
+
+  // keep the order sorted by function code, then address
+  for (i = u8Point; i > 0; i--)
+  {
+    const Point &previous = _points[_u8Order[i - 1]];
+    if (previous.u8Function < u8Function ||
+      (previous.u8Function == u8Function && previous.u16Address <= u16Address))
+    {
+      break;
+    }
+    _u8Order[i] = _u8Order[i - 1];
+  }
+  _u8Order[i] = u8Point;
+  return u8Point;
+}
+
+/**
+Remove all points.
+
+@ingroup pollplan
+*/
+void ModbusPollPlan::clear(void)
+{
+  _u8Points = 0;
+  _blockActive = false;
+}
+
+/**
+Set the function called after every read attempt of a point.
+
+The callback runs from service() once per point covered by the request
+that just completed, failed reads included (check status()), so values
+can be forwarded as they arrive instead of polling the getters.
+
+@param callback point update callback; NULL to remove it
+@param context passed to the callback
+@ingroup pollplan
+*/
+void ModbusPollPlan::onUpdate(UpdateCallback callback, void *context)
+{
+  _update = callback;
+  _updateContext = context;
+}
+
+/**
+Advance the plan by one step, without blocking.
+
+If the plan's request is in progress, polls it; otherwise starts the
+next merged request covering due points. With the master in blocking
+mode the request completes within this call; with ModbusMaster::enableAsync()
+call service() repeatedly from loop() until it stops returning
+ModbusMaster::ku8MBTransactionPending.
+
+@param node master to issue the requests on
+@return ModbusMaster::ku8MBTransactionPending while a request is in
+progress; ModbusMaster::ku8MBBusy if the master is running someone
+else's transaction; otherwise the status of the request that just
+completed (ModbusMaster::ku8MBSuccess if nothing was due)
+@ingroup pollplan
+*/
+uint8_t ModbusPollPlan::service(ModbusMaster &node)
+{
+  uint8_t u8Status;
+  uint16_t u16Qty;
+
+  if (_blockActive)
+  {
+    u8Status = node.poll();
+    if (u8Status != ModbusMaster::ku8MBTransactionPending)
+    {
+      endBlock(node, u8Status);
+    }
+    return u8Status;
+  }
+
+  if (node.busy())
+  {
+    return ModbusMaster::ku8MBBusy;
+  }
+  if (!nextBlock(millis()))
+  {
+    return ModbusMaster::ku8MBSuccess;
+  }
+
+  // steady-state polls repeat the same block: only recompile on change
+  u16Qty = _u16BlockEnd - _u16BlockStart + 1;
+  if (!_request.valid() || _request.slave() != _u8Slave ||
+    _request.function() != _u8BlockFunction ||
+    _u16RequestStart != _u16BlockStart || _u16RequestQty != u16Qty)
+  {
+    _request.compile(_u8Slave, _u8BlockFunction, _u16BlockStart, u16Qty);
+    _u16RequestStart = _u16BlockStart;
+    _u16RequestQty = u16Qty;
+  }
+
+  _u32Requests++;
+  _blockActive = true;
+  u8Status = node.issue(_request);
+
+  if (u8Status != ModbusMaster::ku8MBTransactionPending)
+  {
+    endBlock(node, u8Status);
+  }
+  return u8Status;
+}
+
+/**
+Read every due point now (blocking).
+
+@param node master to issue the requests on
+@return 0 if every request succeeded; otherwise the status of the first
+failed request
+@ingroup pollplan
+*/
+uint8_t ModbusPollPlan::update(ModbusMaster &node)
+{
+  uint8_t i, u8Status, u8Result = ModbusMaster::ku8MBSuccess;
+
+  // points read during this call are not due again before it returns,
+  // otherwise points with a 0 interval would be read forever
+  for (i = 0; i < _u8Points; i++)
+  {
+    _points[i].visited = false;
+  }
+  _updating = true;
+  while (_blockActive || due())
+  {
+    u8Status = service(node);
+    if (u8Status == ModbusMaster::ku8MBBusy)
+    {
+      u8Result = u8Status;
+      break;
+    }
+    if (u8Status != ModbusMaster::ku8MBTransactionPending && !u8Result)
+    {
+      u8Result = u8Status;
+    }
+  }
+  _updating = false;
+  return u8Result;
+}
+
+/**
+Check whether any point is due for polling.
+
+@ingroup pollplan
+*/
+bool ModbusPollPlan::due(void)
+{
+  uint8_t i;
+  uint32_t u32Now = millis();
+
+  for (i = 0; i < _u8Points; i++)
+  {
+    if (isDue(_points[i], u32Now))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+Make every point due now, whatever its interval.
+
+Used after a latch broadcast (see ModbusBus::snapshot()) so the next scan
+reads the values the slaves just froze.
+
+@ingroup pollplan
+*/
+void ModbusPollPlan::trigger(void)
+{
+  uint8_t i;
+  uint32_t u32Now = millis();
+
+  for (i = 0; i < _u8Points; i++)
+  {
+    _points[i].u32LastPoll = u32Now - _points[i].u32Interval;
+  }
+}
+
+/**
+Check whether the last read of a point succeeded.
+
+@param u8Point point index returned by add()
+@ingroup pollplan
+*/
+bool ModbusPollPlan::valid(uint8_t u8Point)
+{
+  return status(u8Point) == ModbusMaster::ku8MBSuccess;
+}
+
+/**
+Status of the last read attempt of a point.
+
+@param u8Point point index returned by add()
+@return 0 on success; exception number on failure
+@ingroup pollplan
+*/
+uint8_t ModbusPollPlan::status(uint8_t u8Point)
+{
+  if (u8Point >= _u8Points || !_points[u8Point].polled)
+  {
+    return ModbusMaster::ku8MBResponseTimedOut;
+  }
+  return _points[u8Point].u8Status;
+}
+
+/**
+Time of the last successful read of a point.
+
+@param u8Point point index returned by add()
+@return millis() at the time of the read; 0 if never read
+@ingroup pollplan
+*/
+uint32_t ModbusPollPlan::timestamp(uint8_t u8Point)
+{
+  return (u8Point < _u8Points) ? _points[u8Point].u32Updated : 0;
+}
+
+uint16_t ModbusPollPlan::getUInt16(uint8_t u8Point)
+{
+  if (u8Point >= _u8Points)
+  {
+    return 0;
+  }
+  return (uint16_t) mb_decode_words(_points[u8Point].u16Raw, 1, _points[u8Point].u8WordOrder);
+}
+
+int16_t ModbusPollPlan::getInt16(uint8_t u8Point)
+{
+  return (int16_t) getUInt16(u8Point);
+}
+
+/**
+Value of a point as an unsigned 32-bit integer.
+
+Single register points are zero-extended; the low 32 bits of a
+ku8TypeFloat64 point are returned.
+
+@param u8Point point index returned by add()
+@ingroup pollplan
+*/
+uint32_t ModbusPollPlan::getUInt32(uint8_t u8Point)
+{
+  if (u8Point >= _u8Points)
+  {
+    return 0;
+  }
+  return (uint32_t) mb_decode_words(_points[u8Point].u16Raw,
+    width(_points[u8Point].u8Type), _points[u8Point].u8WordOrder);
+}
+
+/**
+Value of a point as a signed 32-bit integer.
+
+ku8TypeInt16 points are sign-extended.
+
+@param u8Point point index returned by add()
+@ingroup pollplan
+*/
+int32_t ModbusPollPlan::getInt32(uint8_t u8Point)
+{
+  if (u8Point < _u8Points && _points[u8Point].u8Type == ku8TypeInt16)
+  {
+    return getInt16(u8Point);
+  }
+  return (int32_t) getUInt32(u8Point);
+}
+
+/**
+Value of a point converted to float, whatever its type.
+
+@param u8Point point index returned by add()
+@ingroup pollplan
+*/
+float ModbusPollPlan::getFloat(uint8_t u8Point)
+{
+  if (u8Point >= _u8Points)
+  {
+    return 0;
+  }
+  if (_points[u8Point].u8Type == ku8TypeFloat32)
+  {
+    return mb_float_from_bits(getUInt32(u8Point));
+  }
+  return (float) getDouble(u8Point);
+}
+
+/**
+Value of a point converted to double, whatever its type.
+
+@param u8Point point index returned by add()
+@ingroup pollplan
+*/
+double ModbusPollPlan::getDouble(uint8_t u8Point)
+{
+  if (u8Point >= _u8Points)
+  {
+    return 0;
+  }
+  switch (_points[u8Point].u8Type)
+  {
+    case ku8TypeUInt16:
+      return getUInt16(u8Point);
+
+    case ku8TypeInt16:
+      return getInt16(u8Point);
+
+    case ku8TypeUInt32:
+      return getUInt32(u8Point);
+
+    case ku8TypeInt32:
+      return getInt32(u8Point);
+
+    case ku8TypeFloat32:
+      return getFloat(u8Point);
+
+    default:
+      return mb_double_from_bits(mb_decode_words(_points[u8Point].u16Raw, 4,
+        _points[u8Point].u8WordOrder));
+  }
+}
+
+/**
+Number of requests issued since the plan was created.
+
+@ingroup pollplan
+*/
+uint32_t ModbusPollPlan::requests(void)
+{
+  return _u32Requests;
+}
+
+/**
+Slave the points are read from.
+
+@ingroup pollplan
+*/
+uint8_t ModbusPollPlan::slave(void)
+{
+  return _u8Slave;
+}
+
+/**
+Number of declared points.
+
+@ingroup pollplan
+*/
+uint8_t ModbusPollPlan::points(void)
+{
+  return _u8Points;
+}
+
+/**
+Function code a point is read with.
+
+@param u8Point point index returned by add()
+@return 0x03 or 0x04; 0 for an invalid index
+@ingroup pollplan
+*/
+uint8_t ModbusPollPlan::function(uint8_t u8Point)
+{
+  return (u8Point < _u8Points) ? _points[u8Point].u8Function : 0;
+}
+
+/**
+First register of a point.
+
+@param u8Point point index returned by add()
+@ingroup pollplan
+*/
+uint16_t ModbusPollPlan::address(uint8_t u8Point)
+{
+  return (u8Point < _u8Points) ? _points[u8Point].u16Address : 0;
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+
+/**
+Number of registers occupied by a value type.
+*/
+uint8_t ModbusPollPlan::width(uint8_t u8Type)
+{
+  if (u8Type == ku8TypeFloat64)
+  {
+    return 4;
+  }
+  return (u8Type >= ku8TypeUInt32) ? 2 : 1;
+}
+
+bool ModbusPollPlan::isDue(const Point &point, uint32_t u32Now)
+{
+  if (_updating && point.visited)
+  {
+    return false;
+  }
+  return !point.polled || (u32Now - point.u32LastPoll) >= point.u32Interval;
+}
+
+/**
+Pick the next request: the first due point in address order, extended
+over every following point it can reach.
+
+A point is reachable when it starts at most the gap fill threshold after
+the range read so far and the request stays within setMaxBlock()
+registers. Points that are not due still bridge the gap towards due
+points further on, but the request only extends as far as the last due
+point.
+
+@return false if no point is due
+*/
+bool ModbusPollPlan::nextBlock(uint32_t u32Now)
+{
+  uint8_t i;
+  uint32_t u32End, u32Reach, u32PointEnd;
+
+  for (i = 0; i < _u8Points && !isDue(_points[_u8Order[i]], u32Now); i++);
+  if (i == _u8Points)
+  {
+    return false;
+  }
+
+  const Point &first = _points[_u8Order[i]];
+  _u8BlockFunction = first.u8Function;
+  _u16BlockStart = first.u16Address;
+  u32End = u32Reach = (uint32_t) first.u16Address + width(first.u8Type) - 1;
+
+  for (i++; i < _u8Points; i++)
+  {
+    const Point &point = _points[_u8Order[i]];
+    u32PointEnd = (uint32_t) point.u16Address + width(point.u8Type) - 1;
+
+    if (point.u8Function != _u8BlockFunction ||
+      point.u16Address > u32Reach + _u8GapFill + 1 ||
+      u32PointEnd - _u16BlockStart + 1 > _u8MaxBlock)
+    {
+      break;
+    }
+    if (u32PointEnd > u32Reach)
+    {
+      u32Reach = u32PointEnd;
+    }
+    if (isDue(point, u32Now) && u32PointEnd > u32End)
+    {
+      u32End = u32PointEnd;
+    }
+  }
+
+  _u16BlockEnd = (uint16_t) u32End;
+  return true;
+}
+
+/**
+Scatter the response of the current request into every point it covers.
+
+Registers are copied straight from the response ADU; the master's word
+buffer is never built.
+
+@param u8Status status of the request
+*/
+void ModbusPollPlan::endBlock(ModbusMaster &node, uint8_t u8Status)
+{
+  uint8_t i;
+  uint16_t u16Last;
+  uint32_t u32Now = millis();
+
+  _blockActive = false;
+  if (u8Status == ModbusMaster::ku8MBSuccess &&
+    !node.decodeResponse(_u16BlockEnd - _u16BlockStart, &u16Last, 1))
+  {
+    u8Status = ModbusMaster::ku8MBInvalidFrame; // short response
+  }
+  for (i = 0; i < _u8Points; i++)
+  {
+    Point &point = _points[i];
+    if (point.u8Function != _u8BlockFunction || point.u16Address < _u16BlockStart ||
+      (uint32_t) point.u16Address + width(point.u8Type) - 1 > _u16BlockEnd)
+    {
+      continue;
+    }
+
+    point.polled = true;
+    point.visited = true;
+    point.u32LastPoll = u32Now;
+    point.u8Status = u8Status;
+    if (u8Status == ModbusMaster::ku8MBSuccess)
+    {
+      node.decodeResponse(point.u16Address - _u16BlockStart, point.u16Raw,
+        width(point.u8Type));
+      point.u32Updated = u32Now;
+    }
+    if (_update)
+    {
+      _update(*this, i, _updateContext);
+    }
+  }
+}
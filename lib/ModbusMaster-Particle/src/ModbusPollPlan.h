@@ -0,0 +1,151 @@
+/**
+@file
+Register poll plan: coalesces scattered register reads into few requests.
+
+@defgroup pollplan ModbusMaster Register Poll Plan
+*/
+/*
+
+  ModbusPollPlan.h - Register poll plan for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusPollPlan_h
+#define ModbusPollPlan_h
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusMaster-Particle.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Set of holding/input register points polled from one slave.
+
+Each point is declared once with its address, value type and poll
+interval. On every service() call the plan picks the due points and
+merges adjacent ones (and ones separated by at most the gap fill
+threshold) into a single 0x03/0x04 request, up to the protocol limit of
+125 registers. Registers inside a merged range that belong to points not
+due yet are refreshed for free. The response is scattered back into the
+points, which are read through the typed getters. Multi-register points
+are assembled in the register/byte order given to add() (high word first
+by default, see util/decode.h).
+
+Points are kept sorted by function code and address as they are added,
+so building a request is a single linear scan.
+
+@ingroup pollplan
+*/
+class ModbusPollPlan
+{
+  public:
+    // point value types
+    static const uint8_t ku8TypeUInt16                   = 0;    ///< one register, unsigned
+    static const uint8_t ku8TypeInt16                    = 1;    ///< one register, two's complement
+    static const uint8_t ku8TypeUInt32                   = 2;    ///< two registers, unsigned
+    static const uint8_t ku8TypeInt32                    = 3;    ///< two registers, two's complement
+    static const uint8_t ku8TypeFloat32                  = 4;    ///< two registers, IEEE 754 single
+    static const uint8_t ku8TypeFloat64                  = 5;    ///< four registers, IEEE 754 double
+
+    static const uint8_t ku8MaxPoints                    = 64;   ///< points per plan
+
+    /**
+    Point update callback.
+
+    @param plan plan holding the point
+    @param u8Point point index returned by add()
+    @param context pointer passed to onUpdate()
+    */
+    typedef void (*UpdateCallback)(ModbusPollPlan &plan, uint8_t u8Point, void *context);
+
+    ModbusPollPlan();
+
+    void   setSlave(uint8_t);
+    void   setGapFill(uint8_t);
+    void   setMaxBlock(uint8_t);
+    int8_t add(uint8_t, uint16_t, uint8_t, uint32_t, uint8_t = ku8MBOrderABCD);
+    void   clear(void);
+    void   onUpdate(UpdateCallback, void * = NULL);
+
+    uint8_t service(ModbusMaster &node);
+    uint8_t update(ModbusMaster &node);
+    bool    due(void);
+    void    trigger(void);
+
+    bool     valid(uint8_t);
+    uint8_t  status(uint8_t);
+    uint32_t timestamp(uint8_t);
+    uint16_t getUInt16(uint8_t);
+    int16_t  getInt16(uint8_t);
+    uint32_t getUInt32(uint8_t);
+    int32_t  getInt32(uint8_t);
+    float    getFloat(uint8_t);
+    double   getDouble(uint8_t);
+
+    uint32_t requests(void);
+
+    uint8_t  slave(void);
+    uint8_t  points(void);
+    uint8_t  function(uint8_t);
+    uint16_t address(uint8_t);
+
+  private:
+    static const uint8_t ku8MaxBlockSize                 = 125;  ///< registers per request (protocol limit)
+
+    /**
+    Declared register point.
+    */
+    struct Point
+    {
+      uint8_t  u8Function;                                       ///< 0x03 or 0x04
+      uint8_t  u8Type;                                           ///< ku8Type*
+      uint8_t  u8WordOrder;                                      ///< ku8MBOrder* of multi-register values
+      uint16_t u16Address;                                       ///< first register
+      uint32_t u32Interval;                                      ///< poll interval [milliseconds]
+      uint32_t u32LastPoll;                                      ///< time of the last read attempt [milliseconds]
+      uint32_t u32Updated;                                       ///< time of the last successful read [milliseconds]
+      uint16_t u16Raw[4];                                        ///< raw register values, in address order
+      uint8_t  u8Status;                                         ///< status of the last read attempt
+      bool     polled;                                           ///< false until the first read attempt
+      bool     visited;                                          ///< read attempted during the current update() pass
+    };
+
+    Point    _points[ku8MaxPoints];                              ///< declared points
+    uint8_t  _u8Order[ku8MaxPoints];                             ///< point indices sorted by function code, address
+    uint8_t  _u8Points;                                          ///< number of declared points
+    uint8_t  _u8Slave;                                           ///< slave the points are read from
+    uint8_t  _u8GapFill;                                         ///< unused registers allowed between merged points
+    uint8_t  _u8MaxBlock;                                        ///< registers per request, at most ku8MaxBlockSize
+
+    bool     _blockActive;                                       ///< true while the plan's request is in progress
+    uint8_t  _u8BlockFunction;                                   ///< function code of the current request
+    uint16_t _u16BlockStart;                                     ///< first register of the current request
+    uint16_t _u16BlockEnd;                                       ///< last register of the current request
+    uint32_t _u32Requests;                                       ///< requests issued so far
+    ModbusPreparedRequest _request;                              ///< frame of the last request, reused while the block is unchanged
+    uint16_t _u16RequestStart;                                   ///< first register of _request
+    uint16_t _u16RequestQty;                                     ///< registers read by _request
+    bool     _updating;                                          ///< true while update() runs its single pass
+    UpdateCallback _update;                                      ///< called for every point a request covered; may be NULL
+    void*    _updateContext;                                     ///< passed to _update
+
+    static uint8_t width(uint8_t u8Type);
+    bool isDue(const Point &point, uint32_t u32Now);
+    bool nextBlock(uint32_t u32Now);
+    void endBlock(ModbusMaster &node, uint8_t u8Status);
+};
+#endif
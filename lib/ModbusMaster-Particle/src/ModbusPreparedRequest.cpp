@@ -0,0 +1,96 @@
+/**
+@file
+Prepared request frames for repeated polls.
+*/
+/*
+
+  ModbusPreparedRequest.cpp - Prepared request frames for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusPreparedRequest.h"
+#include "ModbusMaster-Particle.h"
+#include "ModbusRequest.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+ModbusPreparedRequest::ModbusPreparedRequest()
+{
+  clear();
+}
+
+/**
+Compile a request frame.
+
+@param u8Slave slave ID (1..247; ModbusMaster::ku8MBBroadcast for writes)
+@param u8Function 0x01, 0x02, 0x03, 0x04 (read) or 0x05, 0x06 (write single)
+@param u16Address first coil/register
+@param u16Value quantity to read (1..2000 bits, 1..125 registers), or the
+value to write (any non-zero value turns a coil on)
+@return ModbusMaster::ku8MBSuccess, ModbusMaster::ku8MBIllegalFunction for
+an unsupported function or a broadcast read, or
+ModbusMaster::ku8MBIllegalDataValue for an out of range quantity; the
+request is left invalid on failure
+@ingroup prepared
+*/
+uint8_t ModbusPreparedRequest::compile(uint8_t u8Slave, uint8_t u8Function,
+  uint16_t u16Address, uint16_t u16Value)
+{
+  uint8_t u8Status;
+  uint16_t u16CRC;
+
+  clear();
+  if (u8Function < 0x01 || u8Function > 0x06)
+  {
+    return ModbusMaster::ku8MBIllegalFunction; // not a fixed 8-byte frame
+  }
+  u8Status = ModbusRequest::check(u8Slave, u8Function, u16Value, 0, &_u8ResponseSize);
+  if (u8Status)
+  {
+    return u8Status;
+  }
+  if (u8Function == 0x05)
+  {
+    u16Value = u16Value ? 0xFF00 : 0x0000;
+  }
+
+  _u8Frame[0] = u8Slave;
+  _u8Frame[1] = u8Function;
+  _u8Frame[2] = highByte(u16Address);
+  _u8Frame[3] = lowByte(u16Address);
+  _u8Frame[4] = highByte(u16Value);
+  _u8Frame[5] = lowByte(u16Value);
+  u16CRC = crc16_modbus(0xFFFF, _u8Frame, 6);
+  _u8Frame[6] = lowByte(u16CRC);
+  _u8Frame[7] = highByte(u16CRC);
+  _u8Size = ku8FrameSize;
+  return ModbusMaster::ku8MBSuccess;
+}
+
+/**
+Invalidate the request.
+
+@ingroup prepared
+*/
+void ModbusPreparedRequest::clear(void)
+{
+  memset(_u8Frame, 0, sizeof(_u8Frame));
+  _u8Size = 0;
+  _u8ResponseSize = 0;
+}
@@ -0,0 +1,71 @@
+/**
+@file
+Prepared request frames for repeated polls.
+
+@defgroup prepared ModbusMaster Prepared Requests
+*/
+/*
+
+  ModbusPreparedRequest.h - Prepared request frames for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusPreparedRequest_h
+#define ModbusPreparedRequest_h
+
+/* _____STANDARD INCLUDES____________________________________________________ */
+// include types & constants of Wiring core API
+#include "application.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Request ADU compiled once and sent as is on every poll.
+
+Covers the fixed-size requests of periodic polling: reads of coils,
+discrete inputs, holding and input registers (0x01..0x04) and single
+coil/register writes (0x05, 0x06). The frame, its CRC and the size of
+the expected response are computed by compile(); ModbusMaster::issue()
+then sends the frame with a single block write. The response is checked
+against the expected size, so a slave answering with fewer registers than
+requested is reported as ModbusMaster::ku8MBInvalidFrame.
+
+@ingroup prepared
+*/
+class ModbusPreparedRequest
+{
+  public:
+    ModbusPreparedRequest();
+
+    uint8_t compile(uint8_t, uint8_t, uint16_t, uint16_t);
+    void    clear(void);
+
+    bool           valid(void) const { return _u8Size != 0; }
+    uint8_t        slave(void) const { return _u8Frame[0]; }
+    uint8_t        function(void) const { return _u8Frame[1]; }
+    const uint8_t *frame(void) const { return _u8Frame; }
+    uint8_t        size(void) const { return _u8Size; }
+    uint8_t        responseSize(void) const { return _u8ResponseSize; }
+
+  private:
+    static const uint8_t ku8FrameSize                    = 8;    ///< slave, function, 2 x 16 bit fields, CRC
+
+    uint8_t _u8Frame[ku8FrameSize];                              ///< request ADU, CRC included
+    uint8_t _u8Size;                                             ///< frame size; 0 until compiled
+    uint8_t _u8ResponseSize;                                     ///< expected response ADU size, CRC included
+};
+#endif
@@ -0,0 +1,475 @@
+/**
+@file
+Read-through register cache with single-flight fetches.
+*/
+/*
+
+  ModbusRegisterCache.cpp - Read-through register cache for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusRegisterCache.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+/**
+Constructor.
+
+Creates an empty cache without a transport; call begin() before reading.
+
+@ingroup cache
+*/
+ModbusRegisterCache::ModbusRegisterCache()
+{
+  uint8_t i;
+
+  _worker = NULL;
+  _node = NULL;
+  for (i = 0; i < ku8Entries; i++)
+  {
+    _entries[i].u8Function = 0;
+    _entries[i].valid = false;
+    _entries[i].loading = false;
+    _entries[i].invalidated = false;
+    _entries[i].u8Waiters = 0;
+    _entries[i].semaphore = NULL;
+  }
+  clearStats();
+}
+
+
+/**
+Fetch through a bus worker.
+
+Reads may then come from any thread except the worker's own (its
+completion callbacks).
+
+@param worker bus worker the slaves are on
+@ingroup cache
+*/
+void ModbusRegisterCache::begin(ModbusBusWorker &worker)
+{
+  _worker = &worker;
+  _node = NULL;
+  prepare();
+}
+
+
+/**
+Fetch through a master directly.
+
+The master is not thread-safe, so all reads must come from the thread
+that owns it. An asynchronous master is polled until the fetch completes.
+
+@param node master the slaves are on
+@ingroup cache
+*/
+void ModbusRegisterCache::begin(ModbusMaster &node)
+{
+  _worker = NULL;
+  _node = &node;
+  prepare();
+}
+
+
+/**
+Read coils or registers, from RAM if a young enough copy is cached.
+
+@param u8Slave slave ID
+@param u8Function 0x01 (coils), 0x02 (discrete inputs), 0x03 (holding
+registers) or 0x04 (input registers)
+@param u16Address first coil/register
+@param u16Qty coils (1..2000) or registers (1..125)
+@param pu16Dest receives the words, packed as getResponseBuffer() of the
+master: one register per word, or 16 coils per word, LSB first
+@param u32MaxAge oldest cached copy accepted, in milliseconds; 0 always
+fetches (but still shares a fetch already in progress)
+@param u8Priority ModbusBus::ku8PriorityControl ..
+ModbusBus::ku8PriorityBackground (bus worker only)
+@return 0 on success; exception number on failure, shared by every caller
+that waited for the same fetch
+@ingroup cache
+*/
+uint8_t ModbusRegisterCache::read(uint8_t u8Slave, uint8_t u8Function, uint16_t u16Address,
+  uint16_t u16Qty, uint16_t *pu16Dest, uint32_t u32MaxAge, uint8_t u8Priority)
+{
+  ModbusRequest request;
+  Entry *entry;
+  uint8_t u8Status;
+
+  // validates function and quantity before anything is cached
+  u8Status = build(request, u8Slave, u8Function, u16Address, u16Qty);
+  if (u8Status)
+  {
+    return u8Status;
+  }
+
+  _mutex.lock();
+  for (;;)
+  {
+    entry = find(u8Slave, u8Function, u16Address, u16Qty);
+    if (!entry || !entry->loading)
+    {
+      break;
+    }
+
+    // single flight: wait for the fetch in progress instead of issuing another
+    entry->u8Waiters++;
+    _stats.u32Shared++;
+    _mutex.unlock();
+    os_semaphore_take(entry->semaphore, CONCURRENT_WAIT_FOREVER, false);
+    _mutex.lock();
+
+    // the entry may have been recycled meanwhile; if not, share its outcome
+    if (!entry->loading && entry->u8Function == u8Function && entry->u8Slave == u8Slave
+      && find(u8Slave, u8Function, u16Address, u16Qty) == entry)
+    {
+      u8Status = entry->u8Status;
+      if (u8Status == ModbusMaster::ku8MBSuccess)
+      {
+        copy(*entry, u16Address, u16Qty, pu16Dest);
+      }
+      _mutex.unlock();
+      return u8Status;
+    }
+  }
+
+  if (entry && entry->valid && (uint32_t) (millis() - entry->u32Fetched) <= u32MaxAge)
+  {
+    copy(*entry, u16Address, u16Qty, pu16Dest);
+    entry->u32Used = millis();
+    _stats.u32Hits++;
+    _mutex.unlock();
+    return ModbusMaster::ku8MBSuccess;
+  }
+
+  // a stale range covering the read is refreshed as a whole
+  if (entry)
+  {
+    build(request, entry->u8Slave, entry->u8Function, entry->u16Address, entry->u16Qty);
+  }
+  else
+  {
+    entry = allocate();
+    if (!entry)
+    {
+      _stats.u32Bypassed++;
+      _mutex.unlock();
+      u8Status = fetch(request, u8Priority);
+      if (u8Status == ModbusMaster::ku8MBSuccess)
+      {
+        unpack(request, pu16Dest);
+      }
+      return u8Status;
+    }
+    entry->u8Slave = u8Slave;
+    entry->u8Function = u8Function;
+    entry->u16Address = u16Address;
+    entry->u16Qty = u16Qty;
+  }
+  entry->valid = false;
+  entry->loading = true;
+  entry->invalidated = false;
+  entry->u32Used = millis();
+  _stats.u32Misses++;
+  _mutex.unlock();
+
+  u8Status = fetch(request, u8Priority);
+
+  _mutex.lock();
+  entry->u8Status = u8Status;
+  entry->u32Fetched = millis();
+  if (u8Status == ModbusMaster::ku8MBSuccess)
+  {
+    unpack(request, entry->u16Words);
+    entry->valid = !entry->invalidated;
+    copy(*entry, u16Address, u16Qty, pu16Dest);
+  }
+  entry->loading = false;
+  while (entry->u8Waiters)
+  {
+    entry->u8Waiters--;
+    os_semaphore_give(entry->semaphore, false);
+  }
+  _mutex.unlock();
+  return u8Status;
+}
+
+
+/**
+Drop cached copies overlapping a range, e.g. after writing to it.
+
+A fetch in progress still completes and is shared with its waiters, but
+is not cached.
+
+@param u8Slave slave ID
+@param u8Function read function whose ranges are dropped (0x01..0x04)
+@param u16Address first coil/register
+@param u16Qty number of coils/registers
+@ingroup cache
+*/
+void ModbusRegisterCache::invalidate(uint8_t u8Slave, uint8_t u8Function, uint16_t u16Address,
+  uint16_t u16Qty)
+{
+  uint8_t i;
+  uint32_t u32End = (uint32_t) u16Address + u16Qty;
+
+  _mutex.lock();
+  for (i = 0; i < ku8Entries; i++)
+  {
+    Entry &entry = _entries[i];
+
+    if (entry.u8Function == u8Function && entry.u8Slave == u8Slave
+      && entry.u16Address < u32End && u16Address < (uint32_t) entry.u16Address + entry.u16Qty)
+    {
+      entry.valid = false;
+      entry.invalidated = true;
+    }
+  }
+  _mutex.unlock();
+}
+
+
+/**
+Drop every cached copy.
+
+@ingroup cache
+*/
+void ModbusRegisterCache::clear(void)
+{
+  uint8_t i;
+
+  _mutex.lock();
+  for (i = 0; i < ku8Entries; i++)
+  {
+    _entries[i].valid = false;
+    _entries[i].invalidated = true;
+    if (!_entries[i].loading)
+    {
+      _entries[i].u8Function = 0;
+    }
+  }
+  _mutex.unlock();
+}
+
+
+/**
+Copy of the cache counters.
+
+@ingroup cache
+*/
+ModbusCacheStats ModbusRegisterCache::getStats(void)
+{
+  ModbusCacheStats stats;
+
+  _mutex.lock();
+  stats = _stats;
+  _mutex.unlock();
+  return stats;
+}
+
+
+/**
+Reset the cache counters.
+
+@ingroup cache
+*/
+void ModbusRegisterCache::clearStats(void)
+{
+  _mutex.lock();
+  memset(&_stats, 0, sizeof(_stats));
+  _mutex.unlock();
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+/**
+Create the per-entry semaphores waiters block on.
+*/
+void ModbusRegisterCache::prepare(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < ku8Entries; i++)
+  {
+    if (!_entries[i].semaphore)
+    {
+      os_semaphore_create(&_entries[i].semaphore, 255, 0);
+    }
+  }
+}
+
+
+/**
+Entry whose range covers a read, loading or not.
+
+Register ranges cover any read inside them; coil and discrete input
+ranges only the same range, since their words are not bit-aligned to
+other start addresses.
+*/
+ModbusRegisterCache::Entry *ModbusRegisterCache::find(uint8_t u8Slave, uint8_t u8Function,
+  uint16_t u16Address, uint16_t u16Qty)
+{
+  uint8_t i;
+
+  for (i = 0; i < ku8Entries; i++)
+  {
+    Entry &entry = _entries[i];
+
+    if (entry.u8Function != u8Function || entry.u8Slave != u8Slave)
+    {
+      continue;
+    }
+    if (u8Function <= 0x02)
+    {
+      if (entry.u16Address == u16Address && entry.u16Qty == u16Qty)
+      {
+        return &entry;
+      }
+    }
+    else if (entry.u16Address <= u16Address
+      && (uint32_t) u16Address + u16Qty <= (uint32_t) entry.u16Address + entry.u16Qty)
+    {
+      return &entry;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+Unused entry, or the least recently used one not being fetched.
+
+@return NULL if every entry is being fetched
+*/
+ModbusRegisterCache::Entry *ModbusRegisterCache::allocate(void)
+{
+  uint8_t i;
+  Entry *oldest = NULL;
+  uint32_t u32Now = millis();
+
+  for (i = 0; i < ku8Entries; i++)
+  {
+    Entry &entry = _entries[i];
+
+    if (entry.loading)
+    {
+      continue;
+    }
+    if (!entry.u8Function)
+    {
+      return &entry;
+    }
+    if (!oldest || (uint32_t) (u32Now - entry.u32Used) > (uint32_t) (u32Now - oldest->u32Used))
+    {
+      oldest = &entry;
+    }
+  }
+  if (oldest)
+  {
+    _stats.u32Evictions++;
+  }
+  return oldest;
+}
+
+
+/**
+Copy the words of a read out of the entry covering it.
+*/
+void ModbusRegisterCache::copy(const Entry &entry, uint16_t u16Address, uint16_t u16Qty,
+  uint16_t *pu16Dest)
+{
+  if (entry.u8Function <= 0x02)
+  {
+    memcpy(pu16Dest, entry.u16Words, ((u16Qty + 15) >> 4) * sizeof(uint16_t));
+  }
+  else
+  {
+    memcpy(pu16Dest, &entry.u16Words[u16Address - entry.u16Address], u16Qty * sizeof(uint16_t));
+  }
+}
+
+
+/**
+Copy the response words of a completed request.
+*/
+void ModbusRegisterCache::unpack(const ModbusRequest &request, uint16_t *pu16Dest)
+{
+  uint8_t i;
+
+  for (i = 0; i < request.getResponseLength(); i++)
+  {
+    pu16Dest[i] = request.getResponseBuffer(i);
+  }
+}
+
+
+/**
+Run a read on the transport, blocking until it completes.
+*/
+uint8_t ModbusRegisterCache::fetch(ModbusRequest &request, uint8_t u8Priority)
+{
+  uint8_t u8Status;
+
+  if (_worker)
+  {
+    return _worker->execute(request, u8Priority);
+  }
+  if (!_node)
+  {
+    return ModbusMaster::ku8MBIllegalFunction;
+  }
+
+  u8Status = _node->issue(request);
+  while (u8Status == ModbusMaster::ku8MBTransactionPending)
+  {
+    u8Status = _node->poll();
+  }
+  return u8Status;
+}
+
+
+/**
+Build a read request object.
+
+@return 0, or ModbusMaster::ku8MBIllegalFunction /
+ModbusMaster::ku8MBIllegalDataValue for a function or quantity that
+cannot be read
+*/
+uint8_t ModbusRegisterCache::build(ModbusRequest &request, uint8_t u8Slave, uint8_t u8Function,
+  uint16_t u16Address, uint16_t u16Qty)
+{
+  switch (u8Function)
+  {
+    case 0x01:
+      return request.readCoils(u8Slave, u16Address, u16Qty);
+
+    case 0x02:
+      return request.readDiscreteInputs(u8Slave, u16Address, u16Qty);
+
+    case 0x03:
+      return request.readHoldingRegisters(u8Slave, u16Address, u16Qty);
+
+    case 0x04:
+      return request.readInputRegisters(u8Slave, u16Address, u16Qty);
+
+    default:
+      return ModbusMaster::ku8MBIllegalFunction;
+  }
+}
@@ -0,0 +1,127 @@
+/**
+@file
+Read-through register cache with single-flight fetches.
+
+@defgroup cache ModbusMaster Register Cache
+*/
+/*
+
+  ModbusRegisterCache.h - Read-through register cache for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusRegisterCache_h
+#define ModbusRegisterCache_h
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusBusWorker.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Counters of a ModbusRegisterCache.
+
+@see ModbusRegisterCache::getStats()
+@ingroup cache
+*/
+struct ModbusCacheStats
+{
+  uint32_t u32Hits;                                              ///< reads served from RAM
+  uint32_t u32Misses;                                            ///< reads that fetched from the slave
+  uint32_t u32Shared;                                            ///< reads that waited for another caller's fetch
+  uint32_t u32Bypassed;                                          ///< reads fetched without caching (every entry busy)
+  uint32_t u32Evictions;                                         ///< entries recycled for another range
+};
+
+
+/**
+Read-through cache of coil and register ranges, shared by several tasks.
+
+A read names the slave, function (0x01..0x04), range and the oldest value
+the caller accepts. If a cached range covers it and is young enough, the
+words are copied from RAM and the bus is not touched. Otherwise one
+caller fetches the range while every concurrent caller asking for a
+covered range waits for that same transaction (single flight), so N
+tasks polling the same status word cost one request per TTL, not N.
+A failed fetch is reported to all of its waiters and never cached.
+
+Register reads are served from any cached range containing them; coil
+and discrete input reads only from the same range. A stale range that
+covers a read is refetched as a whole. When every entry is in use the
+least recently used one is recycled.
+
+Fetches go through a ModbusBusWorker (thread-safe, from any thread) or a
+ModbusMaster (single-threaded use only). Call invalidate() after writes
+so the next read sees the new values.
+
+@ingroup cache
+*/
+class ModbusRegisterCache
+{
+  public:
+    static const uint8_t ku8Entries                      = 16;   ///< cached ranges
+
+    ModbusRegisterCache();
+
+    void    begin(ModbusBusWorker &);
+    void    begin(ModbusMaster &);
+
+    uint8_t read(uint8_t, uint8_t, uint16_t, uint16_t, uint16_t *, uint32_t,
+      uint8_t = ModbusBus::ku8PriorityInteractive);
+    void    invalidate(uint8_t, uint8_t, uint16_t, uint16_t);
+    void    clear(void);
+
+    ModbusCacheStats getStats(void);
+    void    clearStats(void);
+
+  private:
+    /**
+    Cached range.
+    */
+    struct Entry
+    {
+      uint8_t  u8Slave;                                          ///< slave ID
+      uint8_t  u8Function;                                       ///< 0x01..0x04; 0 for an unused entry
+      uint16_t u16Address;                                       ///< first coil/register
+      uint16_t u16Qty;                                           ///< coils/registers in the range
+      uint32_t u32Fetched;                                       ///< millis() when the fetch completed
+      uint32_t u32Used;                                          ///< millis() of the last read, for eviction
+      uint8_t  u8Status;                                         ///< status of the last fetch
+      bool     valid;                                            ///< u16Words holds the current range
+      bool     loading;                                          ///< a fetch is in progress
+      bool     invalidated;                                      ///< invalidate() hit the range during the fetch
+      uint8_t  u8Waiters;                                        ///< callers blocked on the fetch
+      os_semaphore_t semaphore;                                  ///< released once per waiter when the fetch completes
+      uint16_t u16Words[ModbusRequest::ku8MaxWords];             ///< response words
+    };
+
+    Entry    _entries[ku8Entries];                               ///< cached ranges
+    ModbusBusWorker* _worker;                                    ///< transport; NULL if _node is used
+    ModbusMaster*    _node;                                      ///< transport; NULL if _worker is used
+    ModbusCacheStats _stats;                                     ///< counters
+    Mutex    _mutex;                                             ///< guards everything above but the fetches
+
+    Entry*  find(uint8_t u8Slave, uint8_t u8Function, uint16_t u16Address, uint16_t u16Qty);
+    void    prepare(void);
+    Entry*  allocate(void);
+    void    copy(const Entry &entry, uint16_t u16Address, uint16_t u16Qty, uint16_t *pu16Dest);
+    uint8_t fetch(ModbusRequest &request, uint8_t u8Priority);
+    static void unpack(const ModbusRequest &request, uint16_t *pu16Dest);
+    static uint8_t build(ModbusRequest &request, uint8_t u8Slave, uint8_t u8Function,
+      uint16_t u16Address, uint16_t u16Qty);
+};
+#endif
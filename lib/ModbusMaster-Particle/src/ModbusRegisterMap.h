@@ -0,0 +1,502 @@
+/**
+@file
+Compile-time register maps: request ranges and decoding generated from a
+declaration of the device's registers.
+
+@defgroup regmap ModbusMaster Register Maps
+*/
+/*
+
+  ModbusRegisterMap.h - Compile-time register maps for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusRegisterMap_h
+#define ModbusRegisterMap_h
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusMaster-Particle.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Value types a register field may have, with their width and conversion
+from the raw value assembled by mb_decode_words().
+
+Any other type is rejected at compile time.
+
+@ingroup regmap
+*/
+template <typename T>
+struct ModbusFieldType
+{
+  static_assert(sizeof(T) == 0,
+    "register fields are uint16_t, int16_t, uint32_t, int32_t, float or double");
+};
+
+template <>
+struct ModbusFieldType<uint16_t>
+{
+  static const uint8_t ku8Words = 1;
+  static uint16_t cast(uint64_t u64Raw) { return (uint16_t) u64Raw; }
+};
+
+template <>
+struct ModbusFieldType<int16_t>
+{
+  static const uint8_t ku8Words = 1;
+  static int16_t cast(uint64_t u64Raw) { return (int16_t) u64Raw; }
+};
+
+template <>
+struct ModbusFieldType<uint32_t>
+{
+  static const uint8_t ku8Words = 2;
+  static uint32_t cast(uint64_t u64Raw) { return (uint32_t) u64Raw; }
+};
+
+template <>
+struct ModbusFieldType<int32_t>
+{
+  static const uint8_t ku8Words = 2;
+  static int32_t cast(uint64_t u64Raw) { return (int32_t) u64Raw; }
+};
+
+template <>
+struct ModbusFieldType<float>
+{
+  static const uint8_t ku8Words = 2;
+  static float cast(uint64_t u64Raw) { return mb_float_from_bits((uint32_t) u64Raw); }
+};
+
+template <>
+struct ModbusFieldType<double>
+{
+  static const uint8_t ku8Words = 4;
+  static double cast(uint64_t u64Raw) { return mb_double_from_bits(u64Raw); }
+};
+
+
+/**
+One named value of a register map.
+
+The name is a type deriving from the field, which the map's getters take
+as template argument:
+
+@code
+struct Voltage : ModbusField<0x0000, uint16_t, 1, 10> {};             // 0.1 V per count
+struct Power   : ModbusField<0x0002, float, 1, 1, ku8MBOrderCDAB> {}; // word swapped
+@endcode
+
+@tparam u16Address first register
+@tparam T value type (see ModbusFieldType)
+@tparam i32Scale, i32Divisor engineering value = raw value * i32Scale /
+i32Divisor, see ModbusRegisterMap::scaled()
+@tparam u8Order ku8MBOrderABCD .. ku8MBOrderDCBA of multi-register values
+@ingroup regmap
+*/
+template <uint16_t u16Address, typename T, int32_t i32Scale = 1, int32_t i32Divisor = 1,
+  uint8_t u8Order = ku8MBOrderABCD>
+struct ModbusField
+{
+  typedef T Type;
+
+  static const uint16_t address = u16Address;                    ///< first register
+  static const uint8_t  words   = ModbusFieldType<T>::ku8Words;  ///< registers taken
+  static const uint8_t  order   = u8Order;                       ///< register/byte order
+  static const int32_t  scale   = i32Scale;                      ///< scale numerator
+  static const int32_t  divisor = i32Divisor;                    ///< scale denominator
+
+  static_assert((uint32_t) u16Address + ModbusFieldType<T>::ku8Words <= 0x10000,
+    "register field extends past register 0xFFFF");
+  static_assert(u8Order <= ku8MBOrderDCBA, "unknown register/byte order");
+  static_assert(i32Divisor != 0, "register field scale divides by zero");
+};
+
+
+/**
+Request ranges of a register map, as materialized by
+ModbusRegisterLayout::table().
+
+@tparam u8Ranges number of ranges
+@ingroup regmap
+*/
+template <uint8_t u8Ranges>
+struct ModbusRegisterRanges
+{
+  uint16_t u16Address[u8Ranges];                                 ///< first register of each range
+  uint8_t  u8Quantity[u8Ranges];                                 ///< registers read by each range
+  uint16_t u16Offset[u8Ranges + 1];                              ///< storage offset of each range; of the end of storage last
+};
+
+
+/**
+Request ranges and storage offsets of a list of fields, all computed at
+compile time.
+
+Fields are listed by ascending address. Consecutive fields share a range
+(one request) as long as at most ku8GapFill unused registers separate
+them and the range stays within the protocol limit of 125 registers. The
+words of every range are stored back to back, gaps included, so a
+response is stored with one block copy and a field is found at a fixed
+offset.
+
+@ingroup regmap
+*/
+template <typename... Fields>
+struct ModbusRegisterLayout
+{
+  static const uint8_t ku8GapFill                        = 8;    ///< unused registers a range may span, cheaper than one more round trip
+  static const uint8_t ku8MaxRange                       = 125;  ///< registers per request (protocol limit)
+
+  /**
+  Number of fields.
+  */
+  static constexpr uint8_t fields(void)
+  {
+    return sizeof...(Fields);
+  }
+
+  /**
+  First register of a field.
+  */
+  static constexpr uint32_t address(uint8_t u8Field)
+  {
+    const uint32_t u32Address[] = { 0, Fields::address... };
+    return u32Address[u8Field + 1];
+  }
+
+  /**
+  Register following the last one of a field.
+  */
+  static constexpr uint32_t end(uint8_t u8Field)
+  {
+    const uint32_t u32End[] = { 0, (uint32_t) Fields::address + Fields::words... };
+    return u32End[u8Field + 1];
+  }
+
+  /**
+  True if every field starts after the previous one ends.
+  */
+  static constexpr bool ordered(void)
+  {
+    for (uint8_t i = 1; i < fields(); i++)
+    {
+      if (address(i) < end(i - 1))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+  True if a field starts a new range.
+  */
+  static constexpr bool opens(uint8_t u8Field, uint32_t u32RangeStart)
+  {
+    return u8Field == 0 || address(u8Field) > end(u8Field - 1) + ku8GapFill ||
+      end(u8Field) - u32RangeStart > ku8MaxRange;
+  }
+
+  /**
+  Range holding a field.
+  */
+  static constexpr uint8_t rangeOf(uint8_t u8Field)
+  {
+    uint8_t u8Range = 0;
+    uint32_t u32Start = address(0);
+
+    for (uint8_t i = 1; i <= u8Field; i++)
+    {
+      if (opens(i, u32Start))
+      {
+        u8Range++;
+        u32Start = address(i);
+      }
+    }
+    return u8Range;
+  }
+
+  /**
+  Number of ranges, i.e. requests per read.
+  */
+  static constexpr uint8_t ranges(void)
+  {
+    return fields() ? rangeOf(fields() - 1) + 1 : 0;
+  }
+
+  /**
+  Address, quantity and storage offset of every range, in one pass over
+  the fields.
+  */
+  static constexpr auto table(void)
+  {
+    ModbusRegisterRanges<ranges()> table = {};
+    uint8_t u8Range = 0;
+
+    for (uint8_t i = 0; i < fields(); i++)
+    {
+      if (opens(i, table.u16Address[u8Range]))
+      {
+        if (i > 0)
+        {
+          table.u16Offset[u8Range + 1] = table.u16Offset[u8Range] + table.u8Quantity[u8Range];
+          u8Range++;
+        }
+        table.u16Address[u8Range] = (uint16_t) address(i);
+      }
+      table.u8Quantity[u8Range] = (uint8_t) (end(i) - table.u16Address[u8Range]);
+    }
+    table.u16Offset[ranges()] = table.u16Offset[u8Range] + table.u8Quantity[u8Range];
+    return table;
+  }
+
+  /**
+  First register of a range.
+  */
+  static constexpr uint16_t rangeAddress(uint8_t u8Range)
+  {
+    return table().u16Address[u8Range];
+  }
+
+  /**
+  Registers read by a range.
+  */
+  static constexpr uint8_t rangeQuantity(uint8_t u8Range)
+  {
+    return table().u8Quantity[u8Range];
+  }
+
+  /**
+  Storage offset of a range; of the end of storage for ranges().
+  */
+  static constexpr uint16_t rangeOffset(uint8_t u8Range)
+  {
+    return table().u16Offset[u8Range];
+  }
+
+  /**
+  Words of storage for all ranges.
+  */
+  static constexpr uint16_t words(void)
+  {
+    return rangeOffset(ranges());
+  }
+
+  /**
+  Index of a field; fields() if it is not in the list.
+  */
+  template <typename F>
+  static constexpr uint8_t indexOf(void)
+  {
+    const bool same[] = { false, is((F *) nullptr, (Fields *) nullptr)... };
+    for (uint8_t i = 0; i < fields(); i++)
+    {
+      if (same[i + 1])
+      {
+        return i;
+      }
+    }
+    return fields();
+  }
+
+  /**
+  Storage offset of the first register of a field.
+  */
+  template <typename F>
+  static constexpr uint16_t offset(void)
+  {
+    return rangeOffset(rangeOf(indexOf<F>())) + (uint16_t) (F::address -
+      rangeAddress(rangeOf(indexOf<F>())));
+  }
+
+  /**
+  Type identity of two fields, for indexOf().
+  */
+  template <typename A, typename B>
+  static constexpr bool is(A *, B *) { return false; }
+  template <typename A>
+  static constexpr bool is(A *, A *) { return true; }
+};
+
+
+/**
+Register map of a device: named, typed holding (0x03) or input (0x04)
+register fields, read with the fewest requests and decoded without any
+runtime lookup.
+
+Everything but the transfer itself is done by the compiler from the
+declaration: the request ranges and storage offsets (see
+ModbusRegisterLayout), and the decoding of each field, which get() turns
+into straight-line code reading fixed storage words. Overlapping or
+unordered fields, fields past register 0xFFFF, unsupported types and
+getters naming a field of another map are compile errors, so a profile
+that builds is consistent.
+
+@code
+struct Voltage : ModbusField<0x0000, uint16_t, 1, 10> {};
+struct Current : ModbusField<0x0001, int16_t, 1, 100> {};
+struct Power   : ModbusField<0x0002, float, 1, 1, ku8MBOrderCDAB> {};
+struct Energy  : ModbusField<0x0100, uint32_t> {};
+
+ModbusRegisterMap<0x03, Voltage, Current, Power, Energy> meter;  // 2 requests
+
+if (meter.read(node, 1) == ModbusMaster::ku8MBSuccess)
+{
+  float volts = meter.scaled<Voltage>();
+  uint32_t wh = meter.get<Energy>();
+}
+@endcode
+
+A map holds the last values read; they are 0 until the first read.
+Ranges can also be fetched by other means (ModbusBusWorker,
+ModbusRegisterCache) and handed to store().
+
+@tparam u8Function 0x03 (holding registers) or 0x04 (input registers)
+@tparam Fields fields, by ascending address
+@ingroup regmap
+*/
+template <uint8_t u8Function, typename... Fields>
+class ModbusRegisterMap
+{
+  public:
+    typedef ModbusRegisterLayout<Fields...> Layout;
+
+    static_assert(u8Function == 0x03 || u8Function == 0x04,
+      "register maps read holding (0x03) or input (0x04) registers");
+    static_assert(Layout::fields() > 0, "register map without fields");
+    static_assert(sizeof...(Fields) < 255, "too many fields in one register map");
+    static_assert(Layout::ordered(),
+      "register map fields must be listed by ascending address and must not overlap");
+
+    ModbusRegisterMap() { clear(); }
+
+    /**
+    Zero the values read.
+
+    @ingroup regmap
+    */
+    void clear(void)
+    {
+      memset(_u16Words, 0, sizeof(_u16Words));
+    }
+
+    uint8_t read(ModbusMaster &node, uint8_t u8Slave);
+
+    /**
+    Store the registers of one range, fetched by other means.
+
+    @param u8Range range index (0..Layout::ranges() - 1)
+    @param pu16Words Layout::rangeQuantity() registers from
+    Layout::rangeAddress()
+    @ingroup regmap
+    */
+    void store(uint8_t u8Range, const uint16_t *pu16Words)
+    {
+      if (u8Range < Layout::ranges())
+      {
+        memcpy(&_u16Words[_ranges.u16Offset[u8Range]], pu16Words,
+          _ranges.u8Quantity[u8Range] * sizeof(uint16_t));
+      }
+    }
+
+    /**
+    Value of a field, as last read.
+
+    @tparam F field of this map
+    @ingroup regmap
+    */
+    template <typename F>
+    typename F::Type get(void) const
+    {
+      static_assert(Layout::template indexOf<F>() < Layout::fields(),
+        "field is not part of this register map");
+      constexpr uint16_t u16Offset = Layout::template offset<F>();
+
+      return ModbusFieldType<typename F::Type>::cast(
+        mb_decode_words(&_u16Words[u16Offset], F::words, F::order));
+    }
+
+    /**
+    Engineering value of a field: get() * scale / divisor.
+
+    @tparam F field of this map
+    @ingroup regmap
+    */
+    template <typename F>
+    float scaled(void) const
+    {
+      return (float) get<F>() * ((float) F::scale / (float) F::divisor);
+    }
+
+    /**
+    Raw registers of all ranges, back to back (Layout::words() words).
+
+    @ingroup regmap
+    */
+    const uint16_t *words(void) const { return _u16Words; }
+
+  private:
+    uint16_t _u16Words[Layout::words()];                         ///< registers of all ranges, back to back
+    ModbusPreparedRequest _request;                              ///< request of the range being read
+
+    static constexpr ModbusRegisterRanges<Layout::ranges()> _ranges = Layout::table(); ///< ranges, indexed at run time
+};
+
+template <uint8_t u8Function, typename... Fields>
+constexpr ModbusRegisterRanges<ModbusRegisterLayout<Fields...>::ranges()>
+  ModbusRegisterMap<u8Function, Fields...>::_ranges;
+
+
+/**
+Read every range of the map (blocking).
+
+An asynchronous master is polled until each request completes.
+
+@param node master the slave is on
+@param u8Slave slave ID (1..247)
+@return 0 on success; otherwise the status of the first failed request,
+whose range and the following ones keep their previous values
+@ingroup regmap
+*/
+template <uint8_t u8Function, typename... Fields>
+uint8_t ModbusRegisterMap<u8Function, Fields...>::read(ModbusMaster &node, uint8_t u8Slave)
+{
+  uint8_t i, u8Status;
+
+  for (i = 0; i < Layout::ranges(); i++)
+  {
+    u8Status = _request.compile(u8Slave, u8Function, _ranges.u16Address[i],
+      _ranges.u8Quantity[i]);
+    if (!u8Status)
+    {
+      u8Status = node.issue(_request);
+    }
+    while (u8Status == ModbusMaster::ku8MBTransactionPending)
+    {
+      u8Status = node.poll();
+    }
+    if (u8Status)
+    {
+      return u8Status;
+    }
+    node.copyResponse(&_u16Words[_ranges.u16Offset[i]], _ranges.u8Quantity[i]);
+  }
+  return ModbusMaster::ku8MBSuccess;
+}
+#endif
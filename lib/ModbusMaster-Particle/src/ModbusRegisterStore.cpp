@@ -0,0 +1,195 @@
+/**
+@file
+Thread-safe store of the latest values read from all buses.
+*/
+/*
+
+  ModbusRegisterStore.cpp - Shared register store for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusRegisterStore.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+/**
+Constructor.
+
+Creates an empty store.
+
+@ingroup store
+*/
+ModbusRegisterStore::ModbusRegisterStore()
+{
+  _u8Values = 0;
+  _u32Version = 0;
+}
+
+/**
+Record the outcome of a read.
+
+A failed read only updates the status: the last good value and its
+timestamp are kept, so readers can decide how stale is too stale.
+
+@param u8Bus bus index
+@param u8Slave slave ID
+@param u8Function function code the point is read with
+@param u16Address first register of the point
+@param u8Status 0 on success; exception number on failure
+@param dValue value read (ignored on failure)
+@return false if the point is new and the store is full
+@ingroup store
+*/
+bool ModbusRegisterStore::publish(uint8_t u8Bus, uint8_t u8Slave, uint8_t u8Function,
+  uint16_t u16Address, uint8_t u8Status, double dValue)
+{
+  Value *value;
+
+  _mutex.lock();
+  value = (Value *) find(_values, _u8Values, u8Bus, u8Slave, u8Function, u16Address);
+  if (!value)
+  {
+    if (_u8Values >= ku8MaxValues)
+    {
+      _mutex.unlock();
+      return false;
+    }
+    value = &_values[_u8Values++];
+    value->u8Bus = u8Bus;
+    value->u8Slave = u8Slave;
+    value->u8Function = u8Function;
+    value->u16Address = u16Address;
+    value->u32Updated = 0;
+    value->dValue = 0;
+  }
+
+  value->u8Status = u8Status;
+  if (u8Status == 0x00)
+  {
+    value->dValue = dValue;
+    value->u32Updated = millis();
+  }
+  _u32Version++;
+  _mutex.unlock();
+  return true;
+}
+
+/**
+Copy the stored value of one point.
+
+@param u8Bus bus index
+@param u8Slave slave ID
+@param u8Function function code the point is read with
+@param u16Address first register of the point
+@param value receives the entry
+@return false if nothing was published for the point yet
+@ingroup store
+*/
+bool ModbusRegisterStore::get(uint8_t u8Bus, uint8_t u8Slave, uint8_t u8Function,
+  uint16_t u16Address, Value &value)
+{
+  const Value *stored;
+
+  _mutex.lock();
+  stored = find(_values, _u8Values, u8Bus, u8Slave, u8Function, u16Address);
+  if (stored)
+  {
+    value = *stored;
+  }
+  _mutex.unlock();
+  return stored != NULL;
+}
+
+/**
+Copy all stored values at once.
+
+@param values receives the entries
+@param u8Max capacity of values
+@return number of entries copied
+@ingroup store
+*/
+uint8_t ModbusRegisterStore::snapshot(Value *values, uint8_t u8Max)
+{
+  uint8_t u8Count;
+
+  _mutex.lock();
+  u8Count = (_u8Values < u8Max) ? _u8Values : u8Max;
+  memcpy(values, _values, u8Count * sizeof(Value));
+  _mutex.unlock();
+  return u8Count;
+}
+
+/**
+Number of publish() calls so far.
+
+Cheap way for a reader to tell whether anything changed since its last
+snapshot.
+
+@ingroup store
+*/
+uint32_t ModbusRegisterStore::version(void)
+{
+  uint32_t u32Version;
+
+  _mutex.lock();
+  u32Version = _u32Version;
+  _mutex.unlock();
+  return u32Version;
+}
+
+/**
+Remove all entries.
+
+@ingroup store
+*/
+void ModbusRegisterStore::clear(void)
+{
+  _mutex.lock();
+  _u8Values = 0;
+  _u32Version++;
+  _mutex.unlock();
+}
+
+/**
+Look up a point in a table returned by snapshot().
+
+@param values entries
+@param u8Count number of entries
+@param u8Bus bus index
+@param u8Slave slave ID
+@param u8Function function code the point is read with
+@param u16Address first register of the point
+@return matching entry, or NULL
+@ingroup store
+*/
+const ModbusRegisterStore::Value *ModbusRegisterStore::find(const Value *values,
+  uint8_t u8Count, uint8_t u8Bus, uint8_t u8Slave, uint8_t u8Function, uint16_t u16Address)
+{
+  uint8_t i;
+
+  for (i = 0; i < u8Count; i++)
+  {
+    if (values[i].u16Address == u16Address && values[i].u8Slave == u8Slave &&
+      values[i].u8Function == u8Function && values[i].u8Bus == u8Bus)
+    {
+      return &values[i];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,82 @@
+/**
+@file
+Thread-safe store of the latest values read from all buses.
+
+@defgroup store ModbusMaster Register Store
+*/
+/*
+
+  ModbusRegisterStore.h - Shared register store for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusRegisterStore_h
+#define ModbusRegisterStore_h
+
+/* _____STANDARD INCLUDES____________________________________________________ */
+// include types & constants of Wiring core API
+#include "application.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Latest value of every point, keyed by bus, slave, function and address.
+
+Bus workers publish into the store from their own threads; readers take
+a copy of one value with get() or of the whole table with snapshot().
+Every call holds the store's mutex only for the copy, so readers never
+wait on a bus transaction and never see a half-written entry.
+
+@see ModbusBusWorker
+@ingroup store
+*/
+class ModbusRegisterStore
+{
+  public:
+    static const uint8_t ku8MaxValues                    = 64;   ///< entries in the store
+
+    /**
+    Stored value of one point.
+    */
+    struct Value
+    {
+      uint8_t  u8Bus;                                            ///< bus index given to the worker
+      uint8_t  u8Slave;                                          ///< slave ID
+      uint8_t  u8Function;                                       ///< function code the point is read with
+      uint16_t u16Address;                                       ///< first register of the point
+      uint8_t  u8Status;                                         ///< status of the last read attempt
+      uint32_t u32Updated;                                       ///< millis() of the last successful read; 0 if never read
+      double   dValue;                                           ///< value of the last successful read
+    };
+
+    ModbusRegisterStore();
+
+    bool     publish(uint8_t, uint8_t, uint8_t, uint16_t, uint8_t, double);
+    bool     get(uint8_t, uint8_t, uint8_t, uint16_t, Value &);
+    uint8_t  snapshot(Value *, uint8_t);
+    uint32_t version(void);
+    void     clear(void);
+
+    static const Value *find(const Value *, uint8_t, uint8_t, uint8_t, uint8_t, uint16_t);
+
+  private:
+    Value    _values[ku8MaxValues];                              ///< stored values, in order of first publication
+    uint8_t  _u8Values;                                          ///< number of stored values
+    uint32_t _u32Version;                                        ///< incremented by every publish()
+    Mutex    _mutex;                                             ///< guards all of the above
+};
+#endif
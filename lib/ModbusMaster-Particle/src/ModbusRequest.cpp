@@ -0,0 +1,612 @@
+/**
+@file
+Self-contained request/response objects.
+*/
+/*
+
+  ModbusRequest.cpp - Request/response value type for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusRequest.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+ModbusRequest::ModbusRequest()
+{
+  clear();
+}
+
+/**
+Build a Modbus function 0x01 Read Coils request.
+
+@param u8Slave slave ID (1..247)
+@param u16ReadAddress address of first coil (0x0000..0xFFFF)
+@param u16BitQty quantity of coils to read (1..2000)
+@return 0 on success; ModbusMaster::ku8MBIllegalDataValue for an out of
+range quantity, in which case the request is left invalid
+@see ModbusMaster::readCoils()
+@ingroup request
+*/
+uint8_t ModbusRequest::readCoils(uint8_t u8Slave, uint16_t u16ReadAddress,
+  uint16_t u16BitQty)
+{
+  return build(u8Slave, 0x01, u16ReadAddress, u16BitQty, 0, 0, NULL);
+}
+
+/**
+Build a Modbus function 0x02 Read Discrete Inputs request.
+
+@param u8Slave slave ID (1..247)
+@param u16ReadAddress address of first discrete input (0x0000..0xFFFF)
+@param u16BitQty quantity of discrete inputs to read (1..2000)
+@return 0 on success; exception number on failure
+@see ModbusMaster::readDiscreteInputs()
+@ingroup request
+*/
+uint8_t ModbusRequest::readDiscreteInputs(uint8_t u8Slave, uint16_t u16ReadAddress,
+  uint16_t u16BitQty)
+{
+  return build(u8Slave, 0x02, u16ReadAddress, u16BitQty, 0, 0, NULL);
+}
+
+/**
+Build a Modbus function 0x03 Read Holding Registers request.
+
+@param u8Slave slave ID (1..247)
+@param u16ReadAddress address of the first holding register (0x0000..0xFFFF)
+@param u16ReadQty quantity of holding registers to read (1..125)
+@return 0 on success; exception number on failure
+@see ModbusMaster::readHoldingRegisters()
+@ingroup request
+*/
+uint8_t ModbusRequest::readHoldingRegisters(uint8_t u8Slave, uint16_t u16ReadAddress,
+  uint16_t u16ReadQty)
+{
+  return build(u8Slave, 0x03, u16ReadAddress, u16ReadQty, 0, 0, NULL);
+}
+
+/**
+Build a Modbus function 0x04 Read Input Registers request.
+
+@param u8Slave slave ID (1..247)
+@param u16ReadAddress address of the first input register (0x0000..0xFFFF)
+@param u16ReadQty quantity of input registers to read (1..125)
+@return 0 on success; exception number on failure
+@see ModbusMaster::readInputRegisters()
+@ingroup request
+*/
+uint8_t ModbusRequest::readInputRegisters(uint8_t u8Slave, uint16_t u16ReadAddress,
+  uint16_t u16ReadQty)
+{
+  return build(u8Slave, 0x04, u16ReadAddress, u16ReadQty, 0, 0, NULL);
+}
+
+/**
+Build a Modbus function 0x05 Write Single Coil request.
+
+@param u8Slave slave ID (0 for broadcast, 1..247)
+@param u16WriteAddress address of the coil (0x0000..0xFFFF)
+@param u8State 0=OFF, non-zero=ON
+@return 0
+@see ModbusMaster::writeSingleCoil()
+@ingroup request
+*/
+uint8_t ModbusRequest::writeSingleCoil(uint8_t u8Slave, uint16_t u16WriteAddress,
+  uint8_t u8State)
+{
+  return build(u8Slave, 0x05, 0, 0, u16WriteAddress, u8State ? 0xFF00 : 0x0000, NULL);
+}
+
+/**
+Build a Modbus function 0x06 Write Single Register request.
+
+@param u8Slave slave ID (0 for broadcast, 1..247)
+@param u16WriteAddress address of the holding register (0x0000..0xFFFF)
+@param u16WriteValue value to be written (0x0000..0xFFFF)
+@return 0
+@see ModbusMaster::writeSingleRegister()
+@ingroup request
+*/
+uint8_t ModbusRequest::writeSingleRegister(uint8_t u8Slave, uint16_t u16WriteAddress,
+  uint16_t u16WriteValue)
+{
+  return build(u8Slave, 0x06, 0, 0, u16WriteAddress, 0, &u16WriteValue);
+}
+
+/**
+Build a Modbus function 0x0F Write Multiple Coils request.
+
+@param u8Slave slave ID (0 for broadcast, 1..247)
+@param u16WriteAddress address of the first coil (0x0000..0xFFFF)
+@param u16BitQty quantity of coils to write (1..1968)
+@param pu16Bits coil states, 16 per word, first coil in the LSB of the
+first word (the layout of ModbusMaster::setTransmitBuffer()); copied
+@return 0 on success; exception number on failure
+@see ModbusMaster::writeMultipleCoils()
+@ingroup request
+*/
+uint8_t ModbusRequest::writeMultipleCoils(uint8_t u8Slave, uint16_t u16WriteAddress,
+  uint16_t u16BitQty, const uint16_t *pu16Bits)
+{
+  return build(u8Slave, 0x0F, 0, 0, u16WriteAddress, u16BitQty, pu16Bits);
+}
+
+/**
+Build a Modbus function 0x10 Write Multiple Registers request.
+
+@param u8Slave slave ID (0 for broadcast, 1..247)
+@param u16WriteAddress address of the first holding register (0x0000..0xFFFF)
+@param u16WriteQty quantity of holding registers to write (1..123)
+@param pu16Values values to write; copied
+@return 0 on success; exception number on failure
+@see ModbusMaster::writeMultipleRegisters()
+@ingroup request
+*/
+uint8_t ModbusRequest::writeMultipleRegisters(uint8_t u8Slave, uint16_t u16WriteAddress,
+  uint16_t u16WriteQty, const uint16_t *pu16Values)
+{
+  return build(u8Slave, 0x10, 0, 0, u16WriteAddress, u16WriteQty, pu16Values);
+}
+
+/**
+Build a Modbus function 0x16 Mask Write Register request.
+
+@param u8Slave slave ID (0 for broadcast, 1..247)
+@param u16WriteAddress address of the holding register (0x0000..0xFFFF)
+@param u16AndMask AND mask (0x0000..0xFFFF)
+@param u16OrMask OR mask (0x0000..0xFFFF)
+@return 0
+@see ModbusMaster::maskWriteRegister()
+@ingroup request
+*/
+uint8_t ModbusRequest::maskWriteRegister(uint8_t u8Slave, uint16_t u16WriteAddress,
+  uint16_t u16AndMask, uint16_t u16OrMask)
+{
+  uint16_t u16Masks[2] = { u16AndMask, u16OrMask };
+
+  return build(u8Slave, 0x16, 0, 0, u16WriteAddress, 0, u16Masks);
+}
+
+/**
+Build a Modbus function 0x17 Read Write Multiple Registers request.
+
+@param u8Slave slave ID (1..247)
+@param u16ReadAddress address of the first holding register to read (0x0000..0xFFFF)
+@param u16ReadQty quantity of holding registers to read (1..125)
+@param u16WriteAddress address of the first holding register to write (0x0000..0xFFFF)
+@param u16WriteQty quantity of holding registers to write (1..121)
+@param pu16Values values to write; copied
+@return 0 on success; exception number on failure
+@see ModbusMaster::readWriteMultipleRegisters()
+@ingroup request
+*/
+uint8_t ModbusRequest::readWriteMultipleRegisters(uint8_t u8Slave, uint16_t u16ReadAddress,
+  uint16_t u16ReadQty, uint16_t u16WriteAddress, uint16_t u16WriteQty,
+  const uint16_t *pu16Values)
+{
+  return build(u8Slave, 0x17, u16ReadAddress, u16ReadQty, u16WriteAddress, u16WriteQty,
+    pu16Values);
+}
+
+/**
+Invalidate the request and drop its response.
+
+@ingroup request
+*/
+void ModbusRequest::clear(void)
+{
+  _u8ADU[0] = 0;
+  _u8ADU[1] = 0;
+  _u8Size = 0;
+  _u8ResponseSize = 0;
+  setStatus(ModbusMaster::ku8MBIllegalFunction);
+  _u8ResponseLength = 0;
+}
+
+/**
+Check whether the request has completed (or was rejected).
+
+@ingroup request
+*/
+bool ModbusRequest::done(void) const
+{
+  return status() != ModbusMaster::ku8MBTransactionPending;
+}
+
+/**
+Final status of the request.
+
+@return ModbusMaster::ku8MBTransactionPending from the time the request is
+built until it completes; then 0 on success or an exception number
+@ingroup request
+*/
+uint8_t ModbusRequest::status(void) const
+{
+  // pairs with setStatus(): the response is complete once this is read
+  return __atomic_load_n(&_u8Status, __ATOMIC_ACQUIRE);
+}
+
+/**
+Number of words decoded from the response.
+
+Registers for functions 0x03, 0x04 and 0x17; coils/discrete inputs packed
+16 per word for functions 0x01 and 0x02; 0 for write functions and
+failed requests.
+
+@ingroup request
+*/
+uint8_t ModbusRequest::getResponseLength(void) const
+{
+  return _u8ResponseLength;
+}
+
+/**
+Word of the response.
+
+@param u8Index index of the word (0..getResponseLength() - 1)
+@return value of the word; 0xFFFF if out of range
+@ingroup request
+*/
+uint16_t ModbusRequest::getResponseBuffer(uint8_t u8Index) const
+{
+  return (u8Index < _u8ResponseLength) ? _u16Response[u8Index] : 0xFFFF;
+}
+
+/**
+Read-only view over the response words.
+
+@ingroup request
+*/
+ModbusResponseView ModbusRequest::getResponseView(void) const
+{
+  return ModbusResponseView(_u16Response, _u8ResponseLength);
+}
+
+/**
+Copy the coils/discrete inputs read into a bitset.
+
+@param bits destination, sized to the quantity requested; emptied unless
+the request is a successful 0x01/0x02 read
+@return number of bits copied
+@ingroup request
+*/
+uint16_t ModbusRequest::getResponseBits(ModbusBitset &bits) const
+{
+  uint16_t u16Bits = 0;
+
+  if (status() == ModbusMaster::ku8MBSuccess && (function() == 0x01 || function() == 0x02))
+  {
+    u16Bits = word(_u8ADU[4], _u8ADU[5]);
+  }
+  bits.assign(_u16Response, u16Bits);
+  return bits.size();
+}
+
+/**
+Check whether a function may be sent to ModbusMaster::ku8MBBroadcast.
+
+Only writes can be broadcast: a read would need every slave to answer at
+once.
+
+@param u8Function Modbus function (0x01..0xFF)
+@ingroup request
+*/
+bool ModbusRequest::broadcastable(uint8_t u8Function)
+{
+  switch (u8Function)
+  {
+    case 0x05:
+    case 0x06:
+    case 0x0F:
+    case 0x10:
+    case 0x16:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+/**
+Validate the quantities of a request and assemble its ADU.
+*/
+uint8_t ModbusRequest::build(uint8_t u8Slave, uint8_t u8Function, uint16_t u16ReadAddress,
+  uint16_t u16ReadQty, uint16_t u16WriteAddress, uint16_t u16WriteQty,
+  const uint16_t *pu16Data)
+{
+  uint8_t u8Status;
+
+  clear();
+  u8Status = check(u8Slave, u8Function, u16ReadQty, u16WriteQty, &_u8ResponseSize);
+  if (u8Status)
+  {
+    return u8Status;
+  }
+
+  _u8Size = assemble(_u8ADU, u8Slave, u8Function, u16ReadAddress, u16ReadQty,
+    u16WriteAddress, u16WriteQty, pu16Data);
+  setStatus(ModbusMaster::ku8MBTransactionPending);
+  return ModbusMaster::ku8MBSuccess;
+}
+
+/**
+Store the outcome of the transaction.
+
+@param u8Status final status
+@param pu8Response response ADU on success
+*/
+void ModbusRequest::complete(uint8_t u8Status, const uint8_t *pu8Response)
+{
+  _u8ResponseLength = u8Status ? 0 : disassemble(pu8Response, _u16Response);
+  setStatus(u8Status);
+}
+
+/**
+Publish the status of the request to the thread waiting on it.
+
+A release store: a thread that reads the final status through status()
+(acquire) also sees the response words and length written before it, even
+when the request completed on a bus worker thread.
+
+@param u8Status new status
+*/
+void ModbusRequest::setStatus(uint8_t u8Status)
+{
+  __atomic_store_n(&_u8Status, u8Status, __ATOMIC_RELEASE);
+}
+
+/**
+Check a request against the limits of its function and size its response.
+
+Shared by ModbusRequest, ModbusPreparedRequest and the function methods of
+ModbusMaster, so all of them accept the same requests.
+
+@param u8Slave slave ID (ModbusMaster::ku8MBBroadcast for writes only)
+@param u8Function Modbus function (0x01..0xFF)
+@param u16ReadQty quantity to read: 1..2000 bits (0x01, 0x02), 1..125
+registers (0x03, 0x04, 0x17)
+@param u16WriteQty quantity to write: 1..1968 coils (0x0F), 1..123
+registers (0x10), 1..121 registers (0x17)
+@param pu8ResponseSize set to the size of the expected (non-exception)
+response ADU, CRC included
+@return ModbusMaster::ku8MBSuccess, ModbusMaster::ku8MBIllegalFunction for
+an unsupported function or a broadcast read, or
+ModbusMaster::ku8MBIllegalDataValue for an out of range quantity
+*/
+uint8_t ModbusRequest::check(uint8_t u8Slave, uint8_t u8Function, uint16_t u16ReadQty,
+  uint16_t u16WriteQty, uint8_t *pu8ResponseSize)
+{
+  *pu8ResponseSize = 0;
+  if (u8Slave == ModbusMaster::ku8MBBroadcast && !broadcastable(u8Function))
+  {
+    return ModbusMaster::ku8MBIllegalFunction;
+  }
+  switch (u8Function)
+  {
+    case 0x01:
+    case 0x02:
+      if (u16ReadQty < 1 || u16ReadQty > 2000)
+      {
+        return ModbusMaster::ku8MBIllegalDataValue;
+      }
+      *pu8ResponseSize = 5 + (u16ReadQty + 7) / 8;
+      break;
+
+    case 0x03:
+    case 0x04:
+      if (u16ReadQty < 1 || u16ReadQty > 125)
+      {
+        return ModbusMaster::ku8MBIllegalDataValue;
+      }
+      *pu8ResponseSize = 5 + 2 * u16ReadQty;
+      break;
+
+    case 0x05:
+    case 0x06:
+      *pu8ResponseSize = 8;
+      break;
+
+    case 0x0F:
+      if (u16WriteQty < 1 || u16WriteQty > 1968)
+      {
+        return ModbusMaster::ku8MBIllegalDataValue;
+      }
+      *pu8ResponseSize = 8;
+      break;
+
+    case 0x10:
+      if (u16WriteQty < 1 || u16WriteQty > 123)
+      {
+        return ModbusMaster::ku8MBIllegalDataValue;
+      }
+      *pu8ResponseSize = 8;
+      break;
+
+    case 0x16:
+      *pu8ResponseSize = 10;
+      break;
+
+    case 0x17:
+      if (u16ReadQty < 1 || u16ReadQty > 125 || u16WriteQty < 1 || u16WriteQty > 121)
+      {
+        return ModbusMaster::ku8MBIllegalDataValue;
+      }
+      *pu8ResponseSize = 5 + 2 * u16ReadQty;
+      break;
+
+    default:
+      return ModbusMaster::ku8MBIllegalFunction;
+  }
+  return ModbusMaster::ku8MBSuccess;
+}
+
+/**
+Assemble a Modbus Request Application Data Unit, CRC included.
+
+Shared by ModbusRequest and the function methods of ModbusMaster.
+
+@param pu8ADU destination, 256 bytes
+@param u8Slave slave ID
+@param u8Function Modbus function (0x01..0xFF)
+@param u16ReadAddress first coil/register to read
+@param u16ReadQty quantity to read
+@param u16WriteAddress first coil/register to write
+@param u16WriteQty quantity to write; the coil state (0xFF00/0x0000) for 0x05
+@param pu16Data words to write: the value for 0x06, the AND and OR masks for
+0x16, coils packed 16 per word for 0x0F, registers for 0x10 and 0x17
+@return size of the ADU
+*/
+uint8_t ModbusRequest::assemble(uint8_t *pu8ADU, uint8_t u8Slave, uint8_t u8Function,
+  uint16_t u16ReadAddress, uint16_t u16ReadQty, uint16_t u16WriteAddress,
+  uint16_t u16WriteQty, const uint16_t *pu16Data)
+{
+  uint8_t i, u8Qty, u8Size = 0;
+  uint16_t u16CRC;
+
+  pu8ADU[u8Size++] = u8Slave;
+  pu8ADU[u8Size++] = u8Function;
+
+  switch(u8Function)
+  {
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+    case 0x17:
+      pu8ADU[u8Size++] = highByte(u16ReadAddress);
+      pu8ADU[u8Size++] = lowByte(u16ReadAddress);
+      pu8ADU[u8Size++] = highByte(u16ReadQty);
+      pu8ADU[u8Size++] = lowByte(u16ReadQty);
+      break;
+  }
+
+  switch(u8Function)
+  {
+    case 0x05:
+    case 0x06:
+    case 0x0F:
+    case 0x10:
+    case 0x16:
+    case 0x17:
+      pu8ADU[u8Size++] = highByte(u16WriteAddress);
+      pu8ADU[u8Size++] = lowByte(u16WriteAddress);
+      break;
+  }
+
+  switch(u8Function)
+  {
+    case 0x05:
+      pu8ADU[u8Size++] = highByte(u16WriteQty);
+      pu8ADU[u8Size++] = lowByte(u16WriteQty);
+      break;
+
+    case 0x06:
+      pu8ADU[u8Size++] = highByte(pu16Data[0]);
+      pu8ADU[u8Size++] = lowByte(pu16Data[0]);
+      break;
+
+    case 0x0F:
+      pu8ADU[u8Size++] = highByte(u16WriteQty);
+      pu8ADU[u8Size++] = lowByte(u16WriteQty);
+      u8Qty = (u16WriteQty % 8) ? ((u16WriteQty >> 3) + 1) : (u16WriteQty >> 3);
+      pu8ADU[u8Size++] = u8Qty;
+      for (i = 0; i < u8Qty; i++)
+      {
+        // bytes are sent L, H, L, H, ... out of each word
+        pu8ADU[u8Size++] = (i % 2) ? highByte(pu16Data[i >> 1]) : lowByte(pu16Data[i >> 1]);
+      }
+      break;
+
+    case 0x10:
+    case 0x17:
+      pu8ADU[u8Size++] = highByte(u16WriteQty);
+      pu8ADU[u8Size++] = lowByte(u16WriteQty);
+      pu8ADU[u8Size++] = lowByte(u16WriteQty << 1);
+
+      for (i = 0; i < lowByte(u16WriteQty); i++)
+      {
+        pu8ADU[u8Size++] = highByte(pu16Data[i]);
+        pu8ADU[u8Size++] = lowByte(pu16Data[i]);
+      }
+      break;
+
+    case 0x16:
+      pu8ADU[u8Size++] = highByte(pu16Data[0]);
+      pu8ADU[u8Size++] = lowByte(pu16Data[0]);
+      pu8ADU[u8Size++] = highByte(pu16Data[1]);
+      pu8ADU[u8Size++] = lowByte(pu16Data[1]);
+      break;
+  }
+
+  // append CRC
+  u16CRC = crc16_modbus(0xFFFF, pu8ADU, u8Size);
+  pu8ADU[u8Size++] = lowByte(u16CRC);
+  pu8ADU[u8Size++] = highByte(u16CRC);
+  return u8Size;
+}
+
+/**
+Disassemble a successful response ADU into words.
+
+Shared by ModbusRequest and the word buffer of ModbusMaster.
+
+@param pu8Response validated response ADU
+@param pu16Words destination, ku8MaxWords words
+@return number of words
+*/
+uint8_t ModbusRequest::disassemble(const uint8_t *pu8Response, uint16_t *pu16Words)
+{
+  uint8_t i;
+
+  // evaluate returned Modbus function code
+  switch(pu8Response[1])
+  {
+    case 0x01:
+    case 0x02:
+      // load bytes into word; response bytes are ordered L, H, L, H, ...
+      for (i = 0; i < (pu8Response[2] >> 1) && i < ku8MaxWords; i++)
+      {
+        pu16Words[i] = word(pu8Response[2 * i + 4], pu8Response[2 * i + 3]);
+      }
+
+      // in the event of an odd number of bytes, load last byte into zero-padded word
+      if ((pu8Response[2] % 2) && i < ku8MaxWords)
+      {
+        pu16Words[i] = word(0, pu8Response[2 * i + 3]);
+        i++;
+      }
+      return i;
+
+    case 0x03:
+    case 0x04:
+    case 0x17:
+      // load bytes into word; response bytes are ordered H, L, H, L, ...
+      for (i = 0; i < (pu8Response[2] >> 1) && i < ku8MaxWords; i++)
+      {
+        pu16Words[i] = word(pu8Response[2 * i + 3], pu8Response[2 * i + 4]);
+      }
+      return i;
+
+    default:
+      return 0;
+  }
+}
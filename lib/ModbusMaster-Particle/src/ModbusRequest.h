@@ -0,0 +1,109 @@
+/**
+@file
+Self-contained request/response objects.
+
+@defgroup request ModbusMaster Request Objects
+*/
+/*
+
+  ModbusRequest.h - Request/response value type for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusRequest_h
+#define ModbusRequest_h
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusMaster-Particle.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+One Modbus transaction: its parameters, request ADU, response words and
+final status, all owned by the object.
+
+The function methods of ModbusMaster pass their arguments through members
+of the master and leave the response in its buffer, so a master can only
+serve one caller at a time. A ModbusRequest is built by the caller
+instead (one of the function methods below, which validate the
+arguments and assemble the ADU with its CRC), handed to
+ModbusMaster::issue(), and receives the outcome when the transaction
+completes. Any number of requests can be prepared, queued or waited on
+from different threads; the master only keeps a pointer to the one in
+flight.
+
+@ingroup request
+*/
+class ModbusRequest
+{
+  public:
+    static const uint8_t ku8MaxWords                     = 125;  ///< response words (125 registers, 2000 coils)
+
+    ModbusRequest();
+
+    uint8_t readCoils(uint8_t, uint16_t, uint16_t);
+    uint8_t readDiscreteInputs(uint8_t, uint16_t, uint16_t);
+    uint8_t readHoldingRegisters(uint8_t, uint16_t, uint16_t);
+    uint8_t readInputRegisters(uint8_t, uint16_t, uint16_t);
+    uint8_t writeSingleCoil(uint8_t, uint16_t, uint8_t);
+    uint8_t writeSingleRegister(uint8_t, uint16_t, uint16_t);
+    uint8_t writeMultipleCoils(uint8_t, uint16_t, uint16_t, const uint16_t *);
+    uint8_t writeMultipleRegisters(uint8_t, uint16_t, uint16_t, const uint16_t *);
+    uint8_t maskWriteRegister(uint8_t, uint16_t, uint16_t, uint16_t);
+    uint8_t readWriteMultipleRegisters(uint8_t, uint16_t, uint16_t, uint16_t, uint16_t, const uint16_t *);
+    void    clear(void);
+
+    bool           valid(void) const { return _u8Size != 0; }
+    uint8_t        slave(void) const { return _u8ADU[0]; }
+    uint8_t        function(void) const { return _u8ADU[1]; }
+    const uint8_t *frame(void) const { return _u8ADU; }
+    uint8_t        size(void) const { return _u8Size; }
+    uint8_t        responseSize(void) const { return _u8ResponseSize; }
+
+    bool     done(void) const;
+    uint8_t  status(void) const;
+    uint8_t  getResponseLength(void) const;
+    uint16_t getResponseBuffer(uint8_t) const;
+    ModbusResponseView getResponseView(void) const;
+    uint16_t getResponseBits(ModbusBitset &) const;
+
+    static bool broadcastable(uint8_t);
+
+  private:
+    uint8_t  _u8ADU[256];                                        ///< request ADU, CRC included
+    uint8_t  _u8Size;                                            ///< request ADU size; 0 until built
+    uint8_t  _u8ResponseSize;                                    ///< expected response ADU size, CRC included
+    uint8_t  _u8Status;                                          ///< ModbusMaster::ku8MBTransactionPending until completed; see setStatus()
+    uint16_t _u16Response[ku8MaxWords];                          ///< response words, as getResponseBuffer() of the master
+    uint8_t  _u8ResponseLength;                                  ///< number of response words
+
+    uint8_t build(uint8_t, uint8_t, uint16_t, uint16_t, uint16_t, uint16_t, const uint16_t *);
+    void    complete(uint8_t u8Status, const uint8_t *pu8Response);
+    void    setStatus(uint8_t u8Status);
+
+    static uint8_t check(uint8_t u8Slave, uint8_t u8Function, uint16_t u16ReadQty,
+      uint16_t u16WriteQty, uint8_t *pu8ResponseSize);
+    static uint8_t assemble(uint8_t *pu8ADU, uint8_t u8Slave, uint8_t u8Function,
+      uint16_t u16ReadAddress, uint16_t u16ReadQty, uint16_t u16WriteAddress,
+      uint16_t u16WriteQty, const uint16_t *pu16Data);
+    static uint8_t disassemble(const uint8_t *pu8Response, uint16_t *pu16Words);
+
+    friend class ModbusMaster;
+    friend class ModbusBus;
+    friend class ModbusPreparedRequest;
+};
+#endif
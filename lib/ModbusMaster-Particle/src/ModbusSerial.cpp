@@ -0,0 +1,207 @@
+/**
+@file
+Serial port abstraction used by ModbusMaster.
+*/
+/*
+
+  ModbusSerial.cpp - Serial port abstraction for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusSerial.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+/**
+Write a block of bytes.
+
+The default implementation writes them one at a time; ports with a
+native block write override it.
+
+@param data bytes to write
+@param size number of bytes
+@return number of bytes written
+@ingroup serial
+*/
+size_t ModbusSerial::write(const uint8_t *data, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size && write(data[i]); i++);
+  return i;
+}
+
+/**
+Number of bytes write() accepts without blocking.
+
+The transaction engine never hands more than this to the port at once,
+so a request longer than the transmit buffer is fed over several poll()
+steps instead of stalling the caller while it drains. The default
+implementation has no such limit.
+
+@return free space in the transmit buffer
+@ingroup serial
+*/
+int ModbusSerial::availableForWrite(void)
+{
+  return 256;
+}
+
+/**
+Check whether everything written so far has left the line.
+
+Polled after a request has been written, to switch the transceiver back
+to receive as early as possible. The default implementation waits in
+flush(); ports that can tell without blocking override it.
+
+@return true once the last stop bit has been shifted out
+@ingroup serial
+*/
+bool ModbusSerial::transmitComplete(void)
+{
+  flush();
+  return true;
+}
+
+
+ModbusUSARTSerial::ModbusUSARTSerial()
+{
+  _usart = NULL;
+  setCharTime(9600, 11);
+  _u32TransmitEnd = 0;
+  _transmitting = false;
+}
+
+/**
+Wrap a hardware UART.
+
+@param serial UART to use (Serial1, Serial2...)
+@ingroup serial
+*/
+void ModbusUSARTSerial::attach(USARTSerial &serial)
+{
+  _usart = &serial;
+}
+
+void ModbusUSARTSerial::begin(uint32_t speed)
+{
+  _usart->begin(speed);
+  setCharTime(speed, 10); // SERIAL_8N1
+}
+
+void ModbusUSARTSerial::begin(uint32_t speed, uint32_t config)
+{
+  uint8_t bits = 10;
+
+  _usart->begin(speed, config);
+#if defined(SERIAL_PARITY) && defined(SERIAL_STOP_BITS)
+  if (config & SERIAL_PARITY)
+  {
+    bits++;
+  }
+  if ((config & SERIAL_STOP_BITS) == SERIAL_STOP_BITS_2)
+  {
+    bits++;
+  }
+#else
+  (void) config;
+  bits = 11; // unknown format: assume the longest RTU character
+#endif
+  setCharTime(speed, bits);
+}
+
+int ModbusUSARTSerial::read(void)
+{
+  return _usart->read();
+}
+
+int ModbusUSARTSerial::available(void)
+{
+  return _usart->available();
+}
+
+size_t ModbusUSARTSerial::write(uint8_t data)
+{
+  uint32_t u32Start = micros();
+  size_t written;
+
+  written = _usart->write(data);
+  queued(u32Start, written);
+  return written;
+}
+
+size_t ModbusUSARTSerial::write(const uint8_t *data, size_t size)
+{
+  uint32_t u32Start = micros();
+  size_t written;
+
+  // a write larger than the free buffer space blocks until most of it is
+  // on the wire: the bytes go out from the call, not from the return
+  written = _usart->write(data, size);
+  queued(u32Start, written);
+  return written;
+}
+
+int ModbusUSARTSerial::availableForWrite(void)
+{
+  return _usart->availableForWrite();
+}
+
+void ModbusUSARTSerial::flush(void)
+{
+  _usart->flush();
+  _transmitting = false;
+}
+
+bool ModbusUSARTSerial::transmitComplete(void)
+{
+  if (_transmitting && (int32_t) (micros() - _u32TransmitEnd) >= 0)
+  {
+    _transmitting = false;
+  }
+  return !_transmitting;
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+/**
+Set the character time from the baud rate and the bits per character
+(start, data, parity and stop bits).
+*/
+void ModbusUSARTSerial::setCharTime(uint32_t speed, uint8_t bits)
+{
+  _u32CharTime = (uint32_t) ((1000000000ULL * bits) / speed);
+}
+
+/**
+Account for bytes handed to the UART: they go out back to back after
+whatever is still being sent, or from u32Start if the line was idle.
+
+@param u32Start time the write was called [microseconds]
+@param size number of bytes written
+*/
+void ModbusUSARTSerial::queued(uint32_t u32Start, size_t size)
+{
+  if (!_transmitting || (int32_t) (u32Start - _u32TransmitEnd) >= 0)
+  {
+    _u32TransmitEnd = u32Start;
+    _transmitting = true;
+  }
+  _u32TransmitEnd += (uint32_t) ((size * (uint64_t) _u32CharTime + 999) / 1000);
+}
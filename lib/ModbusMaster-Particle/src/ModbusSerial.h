@@ -0,0 +1,98 @@
+/**
+@file
+Serial port abstraction used by ModbusMaster.
+
+@defgroup serial ModbusMaster Serial Port Abstraction
+*/
+/*
+
+  ModbusSerial.h - Serial port abstraction for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusSerial_h
+#define ModbusSerial_h
+
+/* _____STANDARD INCLUDES____________________________________________________ */
+// include types & constants of Wiring core API
+#include "application.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Byte stream a ModbusMaster talks to.
+
+Only the handful of operations the transaction engine needs. Hardware
+UARTs are wrapped by ModbusUSARTSerial; ModbusLoopbackSerial provides an
+in-memory port for simulation.
+
+@ingroup serial
+*/
+class ModbusSerial
+{
+  public:
+    virtual ~ModbusSerial() {}
+
+    virtual void   begin(uint32_t speed) = 0;
+    virtual void   begin(uint32_t speed, uint32_t config) = 0;
+    virtual int    read(void) = 0;
+    virtual int    available(void) = 0;
+    virtual size_t write(uint8_t data) = 0;
+    virtual size_t write(const uint8_t *data, size_t size);
+    virtual int    availableForWrite(void);
+    virtual void   flush(void) = 0;
+    virtual bool   transmitComplete(void);
+};
+
+
+/**
+ModbusSerial adapter for a Particle hardware UART (Serial1, Serial2...).
+
+The end of a transmission is derived from the baud rate and frame format
+given to begin(): each write pushes the time the last stop bit leaves the
+line further out, and transmitComplete() compares against it without
+blocking.
+
+@ingroup serial
+*/
+class ModbusUSARTSerial : public ModbusSerial
+{
+  public:
+    ModbusUSARTSerial();
+
+    void attach(USARTSerial &serial);
+
+    void   begin(uint32_t speed);
+    void   begin(uint32_t speed, uint32_t config);
+    int    read(void);
+    int    available(void);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t size);
+    int    availableForWrite(void);
+    void   flush(void);
+    bool   transmitComplete(void);
+
+  private:
+    USARTSerial* _usart;                                         ///< wrapped hardware UART
+    uint32_t _u32CharTime;                                       ///< time to shift out one character [nanoseconds]
+    uint32_t _u32TransmitEnd;                                    ///< time the last written byte is completely sent [microseconds]
+    bool     _transmitting;                                      ///< true until _u32TransmitEnd has been reached
+
+    void setCharTime(uint32_t speed, uint8_t bits);
+    void queued(uint32_t u32Start, size_t size);
+};
+#endif
@@ -0,0 +1,629 @@
+/**
+@file
+In-memory serial port and Modbus RTU slave simulator.
+*/
+/*
+
+  ModbusSlaveSimulator.cpp - In-memory serial port and Modbus RTU slave
+  simulator, for exercising ModbusMaster without an RS-485 bus.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "util/arduino-electron-fixes.h"
+#include "util/crc16.h"
+#include "ModbusSlaveSimulator.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+ModbusLoopbackSerial::ModbusLoopbackSerial()
+{
+  _u8Listeners = 0;
+  _u16QueueHead = 0;
+  _u16QueueCount = 0;
+  _u32Speed = 9600;
+}
+
+/**
+Attach a device to the simulated bus.
+
+@param listener device to attach
+@return false if the bus is full
+@ingroup simulator
+*/
+bool ModbusLoopbackSerial::addListener(Listener *listener)
+{
+  if (_u8Listeners >= ku8MaxListeners)
+  {
+    return false;
+  }
+  _listeners[_u8Listeners++] = listener;
+  return true;
+}
+
+void ModbusLoopbackSerial::begin(uint32_t speed)
+{
+  _u32Speed = speed;
+  _u16QueueHead = 0;
+  _u16QueueCount = 0;
+}
+
+void ModbusLoopbackSerial::begin(uint32_t speed, uint32_t config)
+{
+  (void) config;
+  begin(speed);
+}
+
+int ModbusLoopbackSerial::read(void)
+{
+  uint8_t data;
+
+  service();
+  if (!_u16QueueCount)
+  {
+    return -1;
+  }
+  data = _u8Queue[_u16QueueHead];
+  _u16QueueHead = (_u16QueueHead + 1) % ku16QueueSize;
+  _u16QueueCount--;
+  return data;
+}
+
+int ModbusLoopbackSerial::available(void)
+{
+  service();
+  return _u16QueueCount;
+}
+
+size_t ModbusLoopbackSerial::write(uint8_t data)
+{
+  uint8_t i;
+
+  for (i = 0; i < _u8Listeners; i++)
+  {
+    _listeners[i]->receive(data);
+  }
+  return 1;
+}
+
+void ModbusLoopbackSerial::flush(void)
+{
+  service();
+}
+
+/**
+Queue a byte for the master (called by the simulated devices).
+
+@param data byte to send
+@return 1, or 0 if the queue is full
+@ingroup simulator
+*/
+size_t ModbusLoopbackSerial::slaveWrite(uint8_t data)
+{
+  if (_u16QueueCount >= ku16QueueSize)
+  {
+    return 0;
+  }
+  _u8Queue[(_u16QueueHead + _u16QueueCount) % ku16QueueSize] = data;
+  _u16QueueCount++;
+  return 1;
+}
+
+/**
+Baud rate the master opened the port with.
+
+@ingroup simulator
+*/
+uint32_t ModbusLoopbackSerial::speed(void)
+{
+  return _u32Speed;
+}
+
+
+/**
+Let every attached device emit the bytes that are due.
+*/
+void ModbusLoopbackSerial::service(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < _u8Listeners; i++)
+  {
+    _listeners[i]->service(*this);
+  }
+}
+
+
+/**
+Constructor.
+
+@param slaveID slave ID to answer to (1..247)
+@ingroup simulator
+*/
+ModbusSlaveSimulator::ModbusSlaveSimulator(uint8_t slaveID)
+{
+  _u8SlaveID = slaveID;
+  _port = NULL;
+  memset(_u16Holding, 0, sizeof(_u16Holding));
+  memset(_u16Input, 0, sizeof(_u16Input));
+  memset(_u8Coils, 0, sizeof(_u8Coils));
+  memset(_u8Discrete, 0, sizeof(_u8Discrete));
+  _u16RequestSize = 0;
+  _u32LastReceive = 0;
+  _u16ReplySize = 0;
+  _u16ReplySent = 0;
+  _u32ReplyStart = 0;
+  _u16Latency = 0;
+  _u8DropRate = 0;
+  _u8CorruptRate = 0;
+  _u8Exception = 0;
+  _online = true;
+  _u32Random = 0x1234567;
+  _u32Requests = 0;
+  _u32Replies = 0;
+}
+
+/**
+Put the simulated slave on a loopback bus.
+
+@ingroup simulator
+*/
+void ModbusSlaveSimulator::attach(ModbusLoopbackSerial &port)
+{
+  _port = &port;
+  port.addListener(this);
+}
+
+void ModbusSlaveSimulator::setHoldingRegister(uint16_t u16Address, uint16_t u16Value)
+{
+  if (u16Address < ku16Registers)
+  {
+    _u16Holding[u16Address] = u16Value;
+  }
+}
+
+uint16_t ModbusSlaveSimulator::getHoldingRegister(uint16_t u16Address)
+{
+  return (u16Address < ku16Registers) ? _u16Holding[u16Address] : 0xFFFF;
+}
+
+void ModbusSlaveSimulator::setInputRegister(uint16_t u16Address, uint16_t u16Value)
+{
+  if (u16Address < ku16Registers)
+  {
+    _u16Input[u16Address] = u16Value;
+  }
+}
+
+void ModbusSlaveSimulator::setCoil(uint16_t u16Address, bool state)
+{
+  if (u16Address < ku16Bits)
+  {
+    bitWrite(_u8Coils[u16Address >> 3], u16Address & 7, state);
+  }
+}
+
+bool ModbusSlaveSimulator::getCoil(uint16_t u16Address)
+{
+  return (u16Address < ku16Bits) && bitRead(_u8Coils[u16Address >> 3], u16Address & 7);
+}
+
+void ModbusSlaveSimulator::setDiscreteInput(uint16_t u16Address, bool state)
+{
+  if (u16Address < ku16Bits)
+  {
+    bitWrite(_u8Discrete[u16Address >> 3], u16Address & 7, state);
+  }
+}
+
+/**
+Set the processing delay between the end of a request and the reply.
+
+@param u16Latency delay [milliseconds]
+@ingroup simulator
+*/
+void ModbusSlaveSimulator::setLatency(uint16_t u16Latency)
+{
+  _u16Latency = u16Latency;
+}
+
+/**
+Set the probability of dropping each reply byte.
+
+@param u8Percent 0 (never) .. 100 (always)
+@ingroup simulator
+*/
+void ModbusSlaveSimulator::setDropRate(uint8_t u8Percent)
+{
+  _u8DropRate = u8Percent;
+}
+
+/**
+Set the probability of sending a reply with a wrong CRC.
+
+@param u8Percent 0 (never) .. 100 (always)
+@ingroup simulator
+*/
+void ModbusSlaveSimulator::setCorruptRate(uint8_t u8Percent)
+{
+  _u8CorruptRate = u8Percent;
+}
+
+/**
+Answer every request with an exception.
+
+@param u8Exception exception code (e.g. ModbusMaster::ku8MBSlaveDeviceFailure); 0 to answer normally
+@ingroup simulator
+*/
+void ModbusSlaveSimulator::setException(uint8_t u8Exception)
+{
+  _u8Exception = u8Exception;
+}
+
+/**
+Seed the fault injection generator.
+
+@ingroup simulator
+*/
+void ModbusSlaveSimulator::setSeed(uint32_t u32Seed)
+{
+  _u32Random = u32Seed ? u32Seed : 1;
+}
+
+/**
+Take the simulated slave off the bus (false) or put it back (true).
+
+@ingroup simulator
+*/
+void ModbusSlaveSimulator::setOnline(bool online)
+{
+  _online = online;
+}
+
+uint32_t ModbusSlaveSimulator::requests(void)
+{
+  return _u32Requests;
+}
+
+uint32_t ModbusSlaveSimulator::replies(void)
+{
+  return _u32Replies;
+}
+
+/**
+Collect a request byte sent by the master.
+
+The master writes a request in one burst and keeps the line idle for t3.5
+before it, so a gap of half that length starts a new frame: whatever was
+received before it (a partial request, line noise) is discarded.
+*/
+void ModbusSlaveSimulator::receive(uint8_t data)
+{
+  uint32_t u32Now = micros();
+  uint32_t u32Speed = _port ? _port->speed() : 9600;
+  uint32_t u32Gap = (u32Speed > 19200) ? 875 : (35UL * 11 * 1000000UL) / (20 * u32Speed);
+
+  if (_u16RequestSize && (u32Now - _u32LastReceive) > u32Gap)
+  {
+    _u16RequestSize = 0;
+  }
+  _u32LastReceive = u32Now;
+
+  if (_u16RequestSize < sizeof(_u8Request))
+  {
+    _u8Request[_u16RequestSize++] = data;
+  }
+  if (_u16RequestSize == requestLength())
+  {
+    process();
+    _u16RequestSize = 0;
+  }
+}
+
+/**
+Release the reply bytes that are due at the port's baud rate.
+*/
+void ModbusSlaveSimulator::service(ModbusLoopbackSerial &port)
+{
+  uint32_t u32CharTime = (11 * 1000000UL) / port.speed();
+  uint32_t u32Elapsed;
+
+  if (_u16ReplySent >= _u16ReplySize)
+  {
+    return;
+  }
+  u32Elapsed = micros() - _u32ReplyStart;
+  if (u32Elapsed < _u16Latency * 1000UL)
+  {
+    return;
+  }
+  u32Elapsed -= _u16Latency * 1000UL;
+
+  while (_u16ReplySent < _u16ReplySize && u32Elapsed >= (_u16ReplySent + 1) * u32CharTime)
+  {
+    if (!chance(_u8DropRate))
+    {
+      port.slaveWrite(_u8Reply[_u16ReplySent]);
+    }
+    _u16ReplySent++;
+  }
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+
+/**
+Length of the request being received, derived from its function code.
+
+@return expected request size, CRC included (0 if not known yet)
+*/
+uint16_t ModbusSlaveSimulator::requestLength(void)
+{
+  if (_u16RequestSize < 2)
+  {
+    return 0;
+  }
+  switch (_u8Request[1])
+  {
+    case 0x0F:
+    case 0x10:
+      return (_u16RequestSize < 7) ? 0 : 9 + _u8Request[6];
+
+    case 0x16:
+      return 10;
+
+    case 0x17:
+      return (_u16RequestSize < 11) ? 0 : 13 + _u8Request[10];
+
+    default:
+      return 8;
+  }
+}
+
+/**
+Execute a complete request and schedule the reply.
+*/
+void ModbusSlaveSimulator::process(void)
+{
+  uint8_t u8Exception;
+
+  if (!_online || (_u8Request[0] != _u8SlaveID && _u8Request[0] != 0))
+  {
+    return;
+  }
+  if (crc16_modbus(0xFFFF, _u8Request, _u16RequestSize) != 0)
+  {
+    return; // a real slave stays silent on a corrupted request
+  }
+  _u32Requests++;
+
+  u8Exception = _u8Exception ? _u8Exception : execute();
+  if (_u8Request[0] == 0)
+  {
+    return; // broadcast: executed, never answered
+  }
+  if (u8Exception)
+  {
+    _u8Reply[0] = _u8SlaveID;
+    _u8Reply[1] = _u8Request[1] | 0x80;
+    _u8Reply[2] = u8Exception;
+    reply(3);
+  }
+}
+
+/**
+Execute the request against the register maps and build the reply PDU.
+
+@return 0 on success (reply built); exception code otherwise
+*/
+uint8_t ModbusSlaveSimulator::execute(void)
+{
+  uint16_t u16Address = word(_u8Request[2], _u8Request[3]);
+  uint16_t u16Qty = word(_u8Request[4], _u8Request[5]);
+  uint16_t u16Value, u16And, u16Or, u16WriteAddress, u16WriteQty, i;
+  uint16_t u16Size = 0;
+  const uint8_t* pu8Bits;
+
+  _u8Reply[u16Size++] = _u8SlaveID;
+  _u8Reply[u16Size++] = _u8Request[1];
+
+  switch (_u8Request[1])
+  {
+    case 0x01:
+    case 0x02:
+      if (u16Qty < 1 || u16Qty > 2000)
+      {
+        return 0x03;
+      }
+      if ((uint32_t) u16Address + u16Qty > ku16Bits)
+      {
+        return 0x02;
+      }
+      pu8Bits = (_u8Request[1] == 0x01) ? _u8Coils : _u8Discrete;
+      _u8Reply[u16Size++] = (u16Qty + 7) >> 3;
+      memset(&_u8Reply[u16Size], 0, (u16Qty + 7) >> 3);
+      for (i = 0; i < u16Qty; i++)
+      {
+        if (bitRead(pu8Bits[(u16Address + i) >> 3], (u16Address + i) & 7))
+        {
+          bitSet(_u8Reply[u16Size + (i >> 3)], i & 7);
+        }
+      }
+      u16Size += (u16Qty + 7) >> 3;
+      break;
+
+    case 0x03:
+    case 0x04:
+      if (u16Qty < 1 || u16Qty > 125)
+      {
+        return 0x03;
+      }
+      if ((uint32_t) u16Address + u16Qty > ku16Registers)
+      {
+        return 0x02;
+      }
+      _u8Reply[u16Size++] = u16Qty << 1;
+      for (i = 0; i < u16Qty; i++)
+      {
+        u16Value = (_u8Request[1] == 0x03) ? _u16Holding[u16Address + i] : _u16Input[u16Address + i];
+        _u8Reply[u16Size++] = highByte(u16Value);
+        _u8Reply[u16Size++] = lowByte(u16Value);
+      }
+      break;
+
+    case 0x05:
+      if (u16Qty != 0x0000 && u16Qty != 0xFF00)
+      {
+        return 0x03;
+      }
+      if (u16Address >= ku16Bits)
+      {
+        return 0x02;
+      }
+      setCoil(u16Address, u16Qty == 0xFF00);
+      memcpy(&_u8Reply[u16Size], &_u8Request[2], 4);
+      u16Size += 4;
+      break;
+
+    case 0x06:
+      if (u16Address >= ku16Registers)
+      {
+        return 0x02;
+      }
+      _u16Holding[u16Address] = u16Qty;
+      memcpy(&_u8Reply[u16Size], &_u8Request[2], 4);
+      u16Size += 4;
+      break;
+
+    case 0x0F:
+      if (u16Qty < 1 || u16Qty > 1968 || _u8Request[6] != ((u16Qty + 7) >> 3))
+      {
+        return 0x03;
+      }
+      if ((uint32_t) u16Address + u16Qty > ku16Bits)
+      {
+        return 0x02;
+      }
+      for (i = 0; i < u16Qty; i++)
+      {
+        setCoil(u16Address + i, bitRead(_u8Request[7 + (i >> 3)], i & 7));
+      }
+      memcpy(&_u8Reply[u16Size], &_u8Request[2], 4);
+      u16Size += 4;
+      break;
+
+    case 0x10:
+      if (u16Qty < 1 || u16Qty > 123 || _u8Request[6] != (u16Qty << 1))
+      {
+        return 0x03;
+      }
+      if ((uint32_t) u16Address + u16Qty > ku16Registers)
+      {
+        return 0x02;
+      }
+      for (i = 0; i < u16Qty; i++)
+      {
+        _u16Holding[u16Address + i] = word(_u8Request[7 + 2 * i], _u8Request[8 + 2 * i]);
+      }
+      memcpy(&_u8Reply[u16Size], &_u8Request[2], 4);
+      u16Size += 4;
+      break;
+
+    case 0x16:
+      if (u16Address >= ku16Registers)
+      {
+        return 0x02;
+      }
+      u16And = word(_u8Request[4], _u8Request[5]);
+      u16Or = word(_u8Request[6], _u8Request[7]);
+      _u16Holding[u16Address] = (_u16Holding[u16Address] & u16And) | (u16Or & ~u16And);
+      memcpy(&_u8Reply[u16Size], &_u8Request[2], 6);
+      u16Size += 6;
+      break;
+
+    case 0x17:
+      u16WriteAddress = word(_u8Request[6], _u8Request[7]);
+      u16WriteQty = word(_u8Request[8], _u8Request[9]);
+      if (u16Qty < 1 || u16Qty > 125 || u16WriteQty < 1 || u16WriteQty > 121 ||
+        _u8Request[10] != (u16WriteQty << 1))
+      {
+        return 0x03;
+      }
+      if ((uint32_t) u16Address + u16Qty > ku16Registers ||
+        (uint32_t) u16WriteAddress + u16WriteQty > ku16Registers)
+      {
+        return 0x02;
+      }
+      // the write is performed before the read
+      for (i = 0; i < u16WriteQty; i++)
+      {
+        _u16Holding[u16WriteAddress + i] = word(_u8Request[11 + 2 * i], _u8Request[12 + 2 * i]);
+      }
+      _u8Reply[u16Size++] = u16Qty << 1;
+      for (i = 0; i < u16Qty; i++)
+      {
+        _u8Reply[u16Size++] = highByte(_u16Holding[u16Address + i]);
+        _u8Reply[u16Size++] = lowByte(_u16Holding[u16Address + i]);
+      }
+      break;
+
+    default:
+      return 0x01;
+  }
+
+  reply(u16Size);
+  return 0;
+}
+
+/**
+Append the CRC to the reply PDU in _u8Reply and schedule it for sending.
+
+@param u16Size reply size without CRC
+*/
+void ModbusSlaveSimulator::reply(uint16_t u16Size)
+{
+  uint16_t u16CRC = crc16_modbus(0xFFFF, _u8Reply, u16Size);
+
+  if (chance(_u8CorruptRate))
+  {
+    u16CRC ^= 0x5A5A;
+  }
+  _u8Reply[u16Size++] = lowByte(u16CRC);
+  _u8Reply[u16Size++] = highByte(u16CRC);
+  _u16ReplySize = u16Size;
+  _u16ReplySent = 0;
+  _u32ReplyStart = micros();
+  _u32Replies++;
+}
+
+/**
+Draw from the fault injection generator (xorshift32).
+
+@param u8Percent probability of returning true [percent]
+*/
+bool ModbusSlaveSimulator::chance(uint8_t u8Percent)
+{
+  if (!u8Percent)
+  {
+    return false;
+  }
+  _u32Random ^= _u32Random << 13;
+  _u32Random ^= _u32Random >> 17;
+  _u32Random ^= _u32Random << 5;
+  return (_u32Random % 100) < u8Percent;
+}
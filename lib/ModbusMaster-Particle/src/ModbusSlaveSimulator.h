@@ -0,0 +1,178 @@
+/**
+@file
+In-memory serial port and Modbus RTU slave simulator.
+
+@defgroup simulator ModbusMaster Loopback Port and Slave Simulator
+*/
+/*
+
+  ModbusSlaveSimulator.h - In-memory serial port and Modbus RTU slave
+  simulator, for exercising ModbusMaster without an RS-485 bus.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusSlaveSimulator_h
+#define ModbusSlaveSimulator_h
+
+/* _____STANDARD INCLUDES____________________________________________________ */
+// include types & constants of Wiring core API
+#include "application.h"
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusSerial.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+In-memory serial port.
+
+Bytes written by the master are handed to every attached listener (the
+simulated slaves sharing the bus); bytes the listeners write back are
+queued for the master to read. Listeners are serviced from the master's
+own read()/available()/flush() calls, so everything runs on the caller's
+thread with no timers or interrupts.
+
+@ingroup simulator
+*/
+class ModbusLoopbackSerial : public ModbusSerial
+{
+  public:
+    /**
+    Device on the simulated bus.
+    */
+    class Listener
+    {
+      public:
+        virtual ~Listener() {}
+        /** Called with each byte the master transmits. */
+        virtual void receive(uint8_t data) = 0;
+        /** Called whenever the master polls the port; emit due bytes here. */
+        virtual void service(ModbusLoopbackSerial &port) = 0;
+    };
+
+    ModbusLoopbackSerial();
+
+    bool addListener(Listener *listener);
+
+    // master side
+    void   begin(uint32_t speed);
+    void   begin(uint32_t speed, uint32_t config);
+    int    read(void);
+    int    available(void);
+    size_t write(uint8_t data);
+    using  ModbusSerial::write;
+    void   flush(void);
+
+    // slave side
+    size_t   slaveWrite(uint8_t data);
+    uint32_t speed(void);
+
+  private:
+    static const uint8_t  ku8MaxListeners                = 8;    ///< devices per simulated bus
+    static const uint16_t ku16QueueSize                  = 512;  ///< bytes buffered towards the master
+
+    Listener* _listeners[ku8MaxListeners];                       ///< attached devices
+    uint8_t   _u8Listeners;                                      ///< number of attached devices
+    uint8_t   _u8Queue[ku16QueueSize];                           ///< ring buffer of bytes towards the master
+    uint16_t  _u16QueueHead;                                     ///< index of the next byte to read
+    uint16_t  _u16QueueCount;                                    ///< number of queued bytes
+    uint32_t  _u32Speed;                                         ///< baud rate set via begin()
+
+    void service(void);
+};
+
+
+/**
+Modbus RTU slave simulator.
+
+Answers function codes 0x01-0x06, 0x0F, 0x10, 0x16 and 0x17 from its
+own register maps (addresses 0..ku16Registers-1 and 0..ku16Bits-1).
+Replies are released byte by byte at the port's baud rate after a
+configurable latency. Faults can be injected to exercise the master's
+error paths: dropped bytes, corrupted CRCs and forced exception replies.
+Random faults use a seeded generator so that runs are reproducible.
+
+Requests addressed to slave 0 (broadcast) are executed without reply.
+
+@ingroup simulator
+*/
+class ModbusSlaveSimulator : public ModbusLoopbackSerial::Listener
+{
+  public:
+    static const uint16_t ku16Registers                  = 256;  ///< holding/input registers per map
+    static const uint16_t ku16Bits                       = 2048; ///< coils/discrete inputs per map
+
+    ModbusSlaveSimulator(uint8_t slaveID);
+
+    void attach(ModbusLoopbackSerial &port);
+
+    // register maps
+    void     setHoldingRegister(uint16_t, uint16_t);
+    uint16_t getHoldingRegister(uint16_t);
+    void     setInputRegister(uint16_t, uint16_t);
+    void     setCoil(uint16_t, bool);
+    bool     getCoil(uint16_t);
+    void     setDiscreteInput(uint16_t, bool);
+
+    // fault injection
+    void setLatency(uint16_t);
+    void setDropRate(uint8_t);
+    void setCorruptRate(uint8_t);
+    void setException(uint8_t);
+    void setSeed(uint32_t);
+    void setOnline(bool);
+
+    // statistics
+    uint32_t requests(void);
+    uint32_t replies(void);
+
+    // ModbusLoopbackSerial::Listener
+    void receive(uint8_t data);
+    void service(ModbusLoopbackSerial &port);
+
+  private:
+    uint8_t  _u8SlaveID;                                         ///< slave ID answered to
+    ModbusLoopbackSerial* _port;                                 ///< bus the simulator is attached to
+    uint16_t _u16Holding[ku16Registers];                         ///< holding registers (0x03, 0x06, 0x10, 0x16, 0x17)
+    uint16_t _u16Input[ku16Registers];                           ///< input registers (0x04)
+    uint8_t  _u8Coils[ku16Bits / 8];                             ///< coils (0x01, 0x05, 0x0F)
+    uint8_t  _u8Discrete[ku16Bits / 8];                          ///< discrete inputs (0x02)
+
+    uint8_t  _u8Request[256];                                    ///< request being received
+    uint16_t _u16RequestSize;                                    ///< request bytes received so far
+    uint32_t _u32LastReceive;                                    ///< time of the last request byte [microseconds]
+    uint8_t  _u8Reply[256];                                      ///< reply being sent
+    uint16_t _u16ReplySize;                                      ///< reply size, CRC included
+    uint16_t _u16ReplySent;                                      ///< reply bytes released so far
+    uint32_t _u32ReplyStart;                                     ///< time the request was complete [microseconds]
+
+    uint16_t _u16Latency;                                        ///< processing delay before replying [milliseconds]
+    uint8_t  _u8DropRate;                                        ///< probability of dropping each reply byte [percent]
+    uint8_t  _u8CorruptRate;                                     ///< probability of corrupting a reply CRC [percent]
+    uint8_t  _u8Exception;                                       ///< exception code forced on every reply; 0 if none
+    bool     _online;                                            ///< false to ignore all requests
+    uint32_t _u32Random;                                         ///< state of the fault injection generator
+    uint32_t _u32Requests;                                       ///< requests addressed to this slave
+    uint32_t _u32Replies;                                        ///< replies sent
+
+    uint16_t requestLength(void);
+    void     process(void);
+    uint8_t  execute(void);
+    void     reply(uint16_t u16Size);
+    bool     chance(uint8_t u8Percent);
+};
+#endif
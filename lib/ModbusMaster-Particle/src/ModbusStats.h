@@ -0,0 +1,245 @@
+/**
+@file
+Transaction counters and latency histograms of a ModbusMaster.
+
+@defgroup stats ModbusMaster Instrumentation
+*/
+/*
+
+  ModbusStats.h - Instrumentation for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusStats_h
+#define ModbusStats_h
+
+/* _____STANDARD INCLUDES____________________________________________________ */
+// include types & constants of Wiring core API
+#include "application.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Fixed-bucket log2 latency histogram.
+
+Bucket i counts samples in [2^i, 2^(i+1)) microseconds; bucket 0 also
+holds samples below 1 us and the last bucket is open ended (above 0.5 s).
+Recording a sample is a count-leading-zeros and two additions.
+
+@ingroup stats
+*/
+struct ModbusLatencyHistogram
+{
+  static const uint8_t ku8Buckets                      = 20;   ///< number of buckets
+
+  uint32_t u32Count[ku8Buckets];                               ///< samples per bucket
+  uint32_t u32Samples;                                         ///< total number of samples
+  uint32_t u32Max;                                             ///< longest sample [microseconds]
+  uint64_t u64Sum;                                             ///< sum of the samples [microseconds]
+
+  /**
+  Record one sample.
+
+  @param u32Micros duration [microseconds]
+  */
+  void add(uint32_t u32Micros)
+  {
+    uint8_t u8Bucket = u32Micros ? 31 - __builtin_clz(u32Micros) : 0;
+
+    u32Count[(u8Bucket < ku8Buckets) ? u8Bucket : ku8Buckets - 1]++;
+    u32Samples++;
+    u64Sum += u32Micros;
+    if (u32Micros > u32Max)
+    {
+      u32Max = u32Micros;
+    }
+  }
+
+  /**
+  Mean of the samples [microseconds]; 0 if there are none.
+  */
+  uint32_t mean(void) const
+  {
+    return u32Samples ? (uint32_t) (u64Sum / u32Samples) : 0;
+  }
+
+  /**
+  Upper bound of the bucket holding the given percentile [microseconds].
+
+  @param u8Percent percentile (1..100)
+  @return 2^(i+1) for the bucket i reached; u32Max for the last bucket
+  */
+  uint32_t percentile(uint8_t u8Percent) const
+  {
+    uint32_t u32Target = ((uint64_t) u32Samples * u8Percent + 99) / 100;
+    uint32_t u32Seen = 0;
+    uint8_t i;
+
+    for (i = 0; i < ku8Buckets - 1; i++)
+    {
+      u32Seen += u32Count[i];
+      if (u32Seen >= u32Target && u32Seen)
+      {
+        return 2UL << i;
+      }
+    }
+    return u32Max;
+  }
+
+  /**
+  Add the samples of another histogram.
+  */
+  void merge(const ModbusLatencyHistogram &other)
+  {
+    uint8_t i;
+
+    for (i = 0; i < ku8Buckets; i++)
+    {
+      u32Count[i] += other.u32Count[i];
+    }
+    u32Samples += other.u32Samples;
+    u64Sum += other.u64Sum;
+    if (other.u32Max > u32Max)
+    {
+      u32Max = other.u32Max;
+    }
+  }
+};
+
+
+/**
+Counters of one slave.
+
+@ingroup stats
+*/
+struct ModbusSlaveStats
+{
+  uint8_t  u8Slave;                                            ///< slave ID
+  uint32_t u32Transactions;                                    ///< transactions completed; 0 for an unused entry
+  uint32_t u32Errors;                                          ///< transactions that failed
+};
+
+
+/**
+Snapshot of the instrumentation of a ModbusMaster.
+
+Latencies are recorded for every attempt (retries included):
+  - transmit: writing the request until the UART has sent it
+  - turnaround: end of the request to the first response byte
+  - receive: first to last response byte
+  - total: start of the transaction to its final status
+
+Error counts are per attempt and indexed with statusIndex(). The bus
+utilisation is u64BusyTime / (1000 * (millis() - u32Since)).
+
+@see ModbusMaster::getStats()
+@ingroup stats
+*/
+struct ModbusMasterStats
+{
+  static const uint8_t ku8Functions                    = 0x18; ///< function codes tracked (0x00..0x17)
+  static const uint8_t ku8Statuses                     = 0x20; ///< status slots, see statusIndex()
+  static const uint8_t ku8Slaves                       = 16;   ///< slaves tracked individually
+
+  uint32_t u32Since;                                           ///< millis() when the counters were cleared
+  uint32_t u32Transactions;                                    ///< transactions completed
+  uint32_t u32Attempts;                                        ///< requests sent, retries included
+  uint32_t u32BytesSent;                                       ///< request bytes written to the bus
+  uint32_t u32BytesReceived;                                   ///< bytes read from the bus
+  uint64_t u64BusyTime;                                        ///< time spent sending and receiving frames [microseconds]
+  uint32_t u32Functions[ku8Functions];                         ///< transactions per function code
+  uint32_t u32Errors[ku8Statuses];                             ///< failed attempts per status
+  ModbusSlaveStats slaves[ku8Slaves];                          ///< per-slave counters, first come first served
+  uint32_t u32OtherSlaves;                                     ///< transactions with slaves beyond the table
+  ModbusLatencyHistogram transmit;                             ///< request transmission
+  ModbusLatencyHistogram turnaround;                           ///< slave processing time
+  ModbusLatencyHistogram receive;                              ///< response reception
+  ModbusLatencyHistogram total;                                ///< whole transaction
+
+  /**
+  Slot of a status in u32Errors.
+
+  Modbus exception codes 0x01..0x0F map to themselves, ModbusMaster
+  codes 0xE0..0xEF to 0x10..0x1F; anything else to slot 0.
+  */
+  static uint8_t statusIndex(uint8_t u8Status)
+  {
+    if (u8Status < 0x10)
+    {
+      return u8Status;
+    }
+    if ((u8Status & 0xF0) == 0xE0)
+    {
+      return 0x10 | (u8Status & 0x0F);
+    }
+    return 0;
+  }
+
+  /**
+  Add the counters of another master, e.g. to report several buses as
+  one. The window starts at the older of the two u32Since; u64BusyTime
+  becomes the sum over the buses.
+  */
+  void merge(const ModbusMasterStats &other)
+  {
+    uint8_t i, j;
+
+    if ((int32_t) (other.u32Since - u32Since) < 0)
+    {
+      u32Since = other.u32Since;
+    }
+    u32Transactions += other.u32Transactions;
+    u32Attempts += other.u32Attempts;
+    u32BytesSent += other.u32BytesSent;
+    u32BytesReceived += other.u32BytesReceived;
+    u64BusyTime += other.u64BusyTime;
+    for (i = 0; i < ku8Functions; i++)
+    {
+      u32Functions[i] += other.u32Functions[i];
+    }
+    for (i = 0; i < ku8Statuses; i++)
+    {
+      u32Errors[i] += other.u32Errors[i];
+    }
+    u32OtherSlaves += other.u32OtherSlaves;
+    for (i = 0; i < ku8Slaves && other.slaves[i].u32Transactions; i++)
+    {
+      for (j = 0; j < ku8Slaves; j++)
+      {
+        if (slaves[j].u32Transactions == 0)
+        {
+          slaves[j].u8Slave = other.slaves[i].u8Slave;
+        }
+        if (slaves[j].u8Slave == other.slaves[i].u8Slave)
+        {
+          slaves[j].u32Transactions += other.slaves[i].u32Transactions;
+          slaves[j].u32Errors += other.slaves[i].u32Errors;
+          break;
+        }
+      }
+      if (j == ku8Slaves)
+      {
+        u32OtherSlaves += other.slaves[i].u32Transactions;
+      }
+    }
+    transmit.merge(other.transmit);
+    turnaround.merge(other.turnaround);
+    receive.merge(other.receive);
+    total.merge(other.total);
+  }
+};
+#endif
@@ -0,0 +1,348 @@
+/**
+@file
+Coalescing of single register/coil writes into multiple-write requests.
+*/
+/*
+
+  ModbusWriteBatch.cpp - Write coalescing for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusWriteBatch.h"
+
+
+/* _____PUBLIC FUNCTIONS_____________________________________________________ */
+/**
+Constructor.
+
+Creates an empty batch with the default window.
+
+@ingroup batch
+*/
+ModbusWriteBatch::ModbusWriteBatch()
+{
+  _u8Writes = 0;
+  _u16Window = ku16DefaultWindow;
+  _active = false;
+  _u32Writes = 0;
+  _u32Requests = 0;
+}
+
+/**
+Set the batching window.
+
+A write waits at most this long for neighbours before it is sent. Longer
+windows merge bursts spread over more loop() iterations at the cost of
+latency; 0 sends on the next service() call, still merging whatever was
+queued since the previous one.
+
+@param u16Window batching window [milliseconds]
+@ingroup batch
+*/
+void ModbusWriteBatch::setWindow(uint16_t u16Window)
+{
+  _u16Window = u16Window;
+}
+
+/**
+Queue a holding register write.
+
+@param u8Slave slave ID (0 for broadcast, 1..247)
+@param u16Address register to write
+@param u16Value value to write
+@param callback called with the outcome of the write; may be NULL
+@param context passed to the callback
+@return ModbusMaster::ku8MBTransactionPending if queued;
+ModbusMaster::ku8MBBusy if the queue is full (call service() or flush())
+@ingroup batch
+*/
+uint8_t ModbusWriteBatch::writeRegister(uint8_t u8Slave, uint16_t u16Address,
+  uint16_t u16Value, Callback callback, void *context)
+{
+  return queue(u8Slave, false, u16Address, u16Value, callback, context);
+}
+
+/**
+Queue a coil write.
+
+@param u8Slave slave ID (0 for broadcast, 1..247)
+@param u16Address coil to write
+@param state coil state
+@param callback called with the outcome of the write; may be NULL
+@param context passed to the callback
+@return ModbusMaster::ku8MBTransactionPending if queued;
+ModbusMaster::ku8MBBusy if the queue is full (call service() or flush())
+@ingroup batch
+*/
+uint8_t ModbusWriteBatch::writeCoil(uint8_t u8Slave, uint16_t u16Address, bool state,
+  Callback callback, void *context)
+{
+  return queue(u8Slave, true, u16Address, state ? 1 : 0, callback, context);
+}
+
+/**
+Advance the batch by one step, without blocking.
+
+If a request is in progress, polls it; otherwise sends the run around
+the oldest write once it has waited for the window. With the master in
+blocking mode the request completes within this call; with
+ModbusMaster::enableAsync() call service() repeatedly from loop().
+
+@param node master to issue the requests on
+@return ModbusMaster::ku8MBTransactionPending while a request is in
+progress; ModbusMaster::ku8MBBusy if the master is running someone
+else's transaction; otherwise the status of the request that just
+completed (ModbusMaster::ku8MBSuccess if nothing was due)
+@ingroup batch
+*/
+uint8_t ModbusWriteBatch::service(ModbusMaster &node)
+{
+  uint8_t u8Status;
+
+  if (_active)
+  {
+    u8Status = _request.done() ? _request.status() : node.poll();
+    if (u8Status != ModbusMaster::ku8MBTransactionPending)
+    {
+      finish(u8Status);
+    }
+    return u8Status;
+  }
+
+  if (!_u8Writes || (uint32_t) (millis() - _writes[0].u32Queued) < _u16Window)
+  {
+    return ModbusMaster::ku8MBSuccess;
+  }
+  return start(node);
+}
+
+/**
+Send every queued write now, blocking until all have completed.
+
+@param node master to issue the requests on
+@return ModbusMaster::ku8MBSuccess if every request succeeded; otherwise
+the status of the last failed one
+@ingroup batch
+*/
+uint8_t ModbusWriteBatch::flush(ModbusMaster &node)
+{
+  uint8_t u8Status, u8Result = ModbusMaster::ku8MBSuccess;
+
+  while (_active || _u8Writes)
+  {
+    u8Status = _active ? service(node) : start(node);
+    if (u8Status == ModbusMaster::ku8MBBusy)
+    {
+      node.poll(); // let the other transaction finish
+    }
+    else if (u8Status != ModbusMaster::ku8MBTransactionPending && u8Status)
+    {
+      u8Result = u8Status;
+    }
+  }
+  return u8Result;
+}
+
+/**
+Number of writes queued or in progress.
+
+@ingroup batch
+*/
+uint8_t ModbusWriteBatch::pending(void)
+{
+  return _u8Writes;
+}
+
+/**
+Number of writes queued since construction.
+
+@ingroup batch
+*/
+uint32_t ModbusWriteBatch::writes(void)
+{
+  return _u32Writes;
+}
+
+/**
+Number of requests sent since construction.
+
+writes() / requests() is the average merge factor.
+
+@ingroup batch
+*/
+uint32_t ModbusWriteBatch::requests(void)
+{
+  return _u32Requests;
+}
+
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+/**
+Append a write to the queue.
+*/
+uint8_t ModbusWriteBatch::queue(uint8_t u8Slave, bool coil, uint16_t u16Address,
+  uint16_t u16Value, Callback callback, void *context)
+{
+  if (_u8Writes >= ku8MaxWrites)
+  {
+    return ModbusMaster::ku8MBBusy;
+  }
+
+  Write &write = _writes[_u8Writes++];
+  write.u8Slave = u8Slave;
+  write.coil = coil;
+  write.sent = false;
+  write.u16Address = u16Address;
+  write.u16Value = u16Value;
+  write.u32Queued = millis();
+  write.callback = callback;
+  write.context = context;
+  _u32Writes++;
+  return ModbusMaster::ku8MBTransactionPending;
+}
+
+/**
+Send the run of contiguous addresses around the oldest queued write.
+
+The run grows one address at a time, down or up, while a queued write of
+the same slave and kind is found next to it and the request stays within
+the protocol limit. Values are applied in queue order, so the last write
+to an address wins.
+*/
+uint8_t ModbusWriteBatch::start(ModbusMaster &node)
+{
+  uint8_t i, u8Status;
+  uint16_t u16Data[123];
+  uint16_t u16Offset;
+  uint32_t u32Start, u32End, u32Max;
+  bool grown;
+
+  if (node.busy())
+  {
+    return ModbusMaster::ku8MBBusy;
+  }
+
+  const Write &first = _writes[0];
+  u32Max = first.coil ? 1968 : 123;
+  u32Start = u32End = first.u16Address;
+  do
+  {
+    grown = false;
+    for (i = 1; i < _u8Writes && u32End - u32Start + 1 < u32Max; i++)
+    {
+      const Write &write = _writes[i];
+
+      if (write.u8Slave != first.u8Slave || write.coil != first.coil)
+      {
+        continue;
+      }
+      if (write.u16Address + 1UL == u32Start)
+      {
+        u32Start--;
+        grown = true;
+      }
+      else if (write.u16Address == u32End + 1)
+      {
+        u32End++;
+        grown = true;
+      }
+    }
+  } while (grown);
+
+  memset(u16Data, 0, sizeof(u16Data));
+  for (i = 0; i < _u8Writes; i++)
+  {
+    Write &write = _writes[i];
+
+    if (write.u8Slave != first.u8Slave || write.coil != first.coil ||
+      write.u16Address < u32Start || write.u16Address > u32End)
+    {
+      continue;
+    }
+    write.sent = true;
+    u16Offset = write.u16Address - u32Start;
+    if (!write.coil)
+    {
+      u16Data[u16Offset] = write.u16Value;
+    }
+    else if (write.u16Value)
+    {
+      bitSet(u16Data[u16Offset >> 4], u16Offset & 0x0F);
+    }
+    else
+    {
+      bitClear(u16Data[u16Offset >> 4], u16Offset & 0x0F);
+    }
+  }
+
+  if (u32Start == u32End)
+  {
+    u8Status = first.coil ?
+      _request.writeSingleCoil(first.u8Slave, u32Start, u16Data[0] & 1) :
+      _request.writeSingleRegister(first.u8Slave, u32Start, u16Data[0]);
+  }
+  else
+  {
+    u8Status = first.coil ?
+      _request.writeMultipleCoils(first.u8Slave, u32Start, u32End - u32Start + 1, u16Data) :
+      _request.writeMultipleRegisters(first.u8Slave, u32Start, u32End - u32Start + 1, u16Data);
+  }
+  if (u8Status)
+  {
+    finish(u8Status);
+    return u8Status;
+  }
+
+  _u32Requests++;
+  _active = true;
+  u8Status = node.issue(_request);
+  if (u8Status != ModbusMaster::ku8MBTransactionPending)
+  {
+    finish(u8Status);
+  }
+  return u8Status;
+}
+
+/**
+Report the request's status to every write it carried and dequeue them.
+
+Callbacks may queue new writes.
+*/
+void ModbusWriteBatch::finish(uint8_t u8Status)
+{
+  uint8_t i;
+  Write write;
+
+  _active = false;
+  for (i = 0; i < _u8Writes; )
+  {
+    if (!_writes[i].sent)
+    {
+      i++;
+      continue;
+    }
+    write = _writes[i];
+    memmove(&_writes[i], &_writes[i + 1], (_u8Writes - i - 1) * sizeof(Write));
+    _u8Writes--;
+    if (write.callback)
+    {
+      write.callback(write.u8Slave, write.u16Address, u8Status, write.context);
+    }
+  }
+}
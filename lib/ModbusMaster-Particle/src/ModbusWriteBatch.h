@@ -0,0 +1,116 @@
+/**
+@file
+Coalescing of single register/coil writes into multiple-write requests.
+
+@defgroup batch ModbusMaster Write Batching
+*/
+/*
+
+  ModbusWriteBatch.h - Write coalescing for ModbusMaster.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef ModbusWriteBatch_h
+#define ModbusWriteBatch_h
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusRequest.h"
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+Queue of single register and coil writes, sent as few requests as
+possible.
+
+writeRegister() and writeCoil() only queue the write. Once the oldest
+queued write is older than the batching window (or on flush()), service()
+takes the run of contiguous addresses around it, for the same slave and
+kind, and sends it as one 0x10 Write Multiple Registers (up to 123
+registers) or 0x0F Write Multiple Coils (up to 1968 coils) request; a run
+of one is sent as 0x06/0x05. A setpoint push to a 40 register block thus
+costs one round trip instead of 40. Every write reports the status of
+the request that carried it to its own callback.
+
+Writes to the same address within a window are merged, the last value
+winning, and each is still reported. Writes in different runs may be
+sent in a different order than queued; call flush() between writes whose
+order matters.
+
+Not thread-safe: use it from the thread that owns the master.
+
+@ingroup batch
+*/
+class ModbusWriteBatch
+{
+  public:
+    static const uint8_t ku8MaxWrites                    = 128;  ///< queued writes, all slaves
+    static const uint16_t ku16DefaultWindow              = 5;    ///< default batching window [milliseconds]
+
+    /**
+    Write completion callback.
+
+    @param u8Slave slave the write was sent to
+    @param u16Address register/coil written
+    @param u8Status status of the request that carried the write: 0 on
+    success; exception number on failure
+    @param context pointer passed when the write was queued
+    */
+    typedef void (*Callback)(uint8_t u8Slave, uint16_t u16Address, uint8_t u8Status, void *context);
+
+    ModbusWriteBatch();
+
+    void    setWindow(uint16_t);
+    uint8_t writeRegister(uint8_t, uint16_t, uint16_t, Callback = NULL, void * = NULL);
+    uint8_t writeCoil(uint8_t, uint16_t, bool, Callback = NULL, void * = NULL);
+
+    uint8_t service(ModbusMaster &node);
+    uint8_t flush(ModbusMaster &node);
+
+    uint8_t  pending(void);
+    uint32_t writes(void);
+    uint32_t requests(void);
+
+  private:
+    /**
+    Queued write.
+    */
+    struct Write
+    {
+      uint8_t  u8Slave;                                          ///< slave ID
+      bool     coil;                                             ///< true for a coil, false for a holding register
+      bool     sent;                                             ///< carried by the request in progress
+      uint16_t u16Address;                                       ///< register/coil
+      uint16_t u16Value;                                         ///< register value, or coil state (0/1)
+      uint32_t u32Queued;                                        ///< millis() when queued
+      Callback callback;                                         ///< completion callback; may be NULL
+      void*    context;                                          ///< passed to the callback
+    };
+
+    Write    _writes[ku8MaxWrites];                              ///< queued writes, oldest first
+    uint8_t  _u8Writes;                                          ///< number of queued writes
+    uint16_t _u16Window;                                         ///< batching window [milliseconds]
+    ModbusRequest _request;                                      ///< request in progress
+    bool     _active;                                            ///< true while _request is in progress
+    uint32_t _u32Writes;                                         ///< writes queued so far
+    uint32_t _u32Requests;                                       ///< requests sent so far
+
+    uint8_t queue(uint8_t u8Slave, bool coil, uint16_t u16Address, uint16_t u16Value,
+      Callback callback, void *context);
+    uint8_t start(ModbusMaster &node);
+    void    finish(uint8_t u8Status);
+};
+#endif
@@ -1,4 +1,6 @@
 /* _____UTILITY MACROS_______________________________________________________ */
+#include <stdint.h>
+
 /**
 @def lowWord(ww) ((uint16_t) ((ww) & 0xFFFF))
 Macro to return low word of a 32-bit integer.
@@ -12,6 +14,13 @@ Macro to return high word of a 32-bit integer.
 #define highWord(ww) ((uint16_t) ((ww) >> 16))
 
 
+/**
+word(high, low) and word(low), defined in ModbusMaster-Particle.cpp
+(not provided by the Particle core).
+*/
+uint16_t word(uint8_t low);
+uint16_t word(uint8_t high, uint8_t low);
+
 #define LONG(hi, lo) ((uint32_t) ((hi) << 16 | (lo)))
 
 #define lowByte(w)					 ((w) & 0xFF)
@@ -55,10 +55,16 @@ obtain a copy.
 #ifndef _UTIL_CRC16_H_
 #define _UTIL_CRC16_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 
 /** @ingroup util_crc16
     Processor-independent CRC-16 calculation.
 
+    Reference bit-at-a-time implementation; the transaction engine uses the
+    table-driven crc16_modbus() family below.
+
     Polynomial: x^16 + x^15 + x^2 + 1 (0xA001)<br>
     Initial value: 0xFFFF
 
@@ -68,7 +74,7 @@ obtain a copy.
     @param uint8_t a (0x00..0xFF)
     @return calculated CRC (0x0000..0xFFFF)
 */
-static uint16_t crc16_update(uint16_t crc, uint8_t a)
+static inline uint16_t crc16_update(uint16_t crc, uint8_t a)
 {
   int i;
 
@@ -85,4 +91,153 @@ static uint16_t crc16_update(uint16_t crc, uint8_t a)
 }
 
 
+/** @ingroup util_crc16
+    Lookup tables for the table-driven CRC-16/Modbus kernels.
+
+    Row 0 is the classic 256-entry byte table; row k holds the CRC of a byte
+    followed by k zero bytes, which lets the slice-by-4/slice-by-8 kernels
+    fold several input bytes per step. The tables are generated at compile
+    time and live in flash (8 x 256 x 2 = 4 KiB).
+
+    The class template is only there so the static member is emitted once
+    across translation units.
+*/
+template <typename T = void>
+struct Crc16ModbusTables
+{
+  uint16_t t[8][256];
+
+  constexpr Crc16ModbusTables() : t()
+  {
+    for (int n = 0; n < 256; ++n)
+    {
+      uint16_t crc = (uint16_t) n;
+      for (int i = 0; i < 8; ++i)
+      {
+        crc = (crc & 1) ? (uint16_t) ((crc >> 1) ^ 0xA001) : (uint16_t) (crc >> 1);
+      }
+      t[0][n] = crc;
+    }
+    for (int k = 1; k < 8; ++k)
+    {
+      for (int n = 0; n < 256; ++n)
+      {
+        t[k][n] = (uint16_t) ((t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xFF]);
+      }
+    }
+  }
+
+  static const Crc16ModbusTables table;
+};
+
+template <typename T>
+const Crc16ModbusTables<T> Crc16ModbusTables<T>::table = Crc16ModbusTables<T>();
+
+
+/** @ingroup util_crc16
+    Table-driven CRC-16/Modbus update for a single byte.
+
+    Same result as crc16_update(); use it to fold in bytes one at a time as
+    they are received.
+
+    @param uint16_t crc (0x0000..0xFFFF)
+    @param uint8_t a (0x00..0xFF)
+    @return calculated CRC (0x0000..0xFFFF)
+*/
+static inline uint16_t crc16_modbus_update(uint16_t crc, uint8_t a)
+{
+  return (uint16_t) ((crc >> 8) ^ Crc16ModbusTables<>::table.t[0][(crc ^ a) & 0xFF]);
+}
+
+
+/** @ingroup util_crc16
+    CRC-16/Modbus over a buffer, one table lookup per byte.
+
+    @param uint16_t crc initial value (0xFFFF for a new frame)
+    @param const uint8_t *data bytes to fold in
+    @param size_t len number of bytes
+    @return calculated CRC (0x0000..0xFFFF)
+*/
+static inline uint16_t crc16_modbus_bytewise(uint16_t crc, const uint8_t *data,
+  size_t len)
+{
+  while (len--)
+  {
+    crc = crc16_modbus_update(crc, *data++);
+  }
+  return crc;
+}
+
+
+/** @ingroup util_crc16
+    CRC-16/Modbus over a buffer, four bytes per step (slice-by-4).
+
+    @param uint16_t crc initial value (0xFFFF for a new frame)
+    @param const uint8_t *data bytes to fold in
+    @param size_t len number of bytes
+    @return calculated CRC (0x0000..0xFFFF)
+*/
+static inline uint16_t crc16_modbus_slice4(uint16_t crc, const uint8_t *data,
+  size_t len)
+{
+  const uint16_t (*t)[256] = Crc16ModbusTables<>::table.t;
+
+  for (; len >= 4; len -= 4, data += 4)
+  {
+    crc ^= (uint16_t) (data[0] | (data[1] << 8));
+    crc = t[3][crc & 0xFF] ^ t[2][crc >> 8] ^ t[1][data[2]] ^ t[0][data[3]];
+  }
+  return crc16_modbus_bytewise(crc, data, len);
+}
+
+
+/** @ingroup util_crc16
+    CRC-16/Modbus over a buffer, eight bytes per step (slice-by-8).
+
+    @param uint16_t crc initial value (0xFFFF for a new frame)
+    @param const uint8_t *data bytes to fold in
+    @param size_t len number of bytes
+    @return calculated CRC (0x0000..0xFFFF)
+*/
+static inline uint16_t crc16_modbus_slice8(uint16_t crc, const uint8_t *data,
+  size_t len)
+{
+  const uint16_t (*t)[256] = Crc16ModbusTables<>::table.t;
+
+  for (; len >= 8; len -= 8, data += 8)
+  {
+    crc ^= (uint16_t) (data[0] | (data[1] << 8));
+    crc = t[7][crc & 0xFF] ^ t[6][crc >> 8] ^ t[5][data[2]] ^ t[4][data[3]] ^
+      t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+  }
+  return crc16_modbus_slice4(crc, data, len);
+}
+
+
+/** @ingroup util_crc16
+    CRC-16/Modbus over a buffer, picking the fastest kernel for its length.
+
+    Short frames (requests, write acknowledgements) go byte by byte; long
+    register blocks use slice-by-8. Because the function takes the running
+    CRC as its first argument it can be called repeatedly on consecutive
+    chunks of the same frame.
+
+    Running the CRC over a complete ADU, including its two trailing CRC
+    bytes, yields 0x0000 when the frame is intact.
+
+    @param uint16_t crc initial value (0xFFFF for a new frame)
+    @param const uint8_t *data bytes to fold in
+    @param size_t len number of bytes
+    @return calculated CRC (0x0000..0xFFFF)
+*/
+static inline uint16_t crc16_modbus(uint16_t crc, const uint8_t *data, size_t len)
+{
+  if (len >= 16)
+  {
+    return crc16_modbus_slice8(crc, data, len);
+  }
+  return crc16_modbus_bytewise(crc, data, len);
+}
+
+
 #endif /* _UTIL_CRC16_H_ */
@@ -0,0 +1,174 @@
+/**
+@file
+Decoding of Multi-Register Values
+
+@defgroup util_decode "util/decode.h": Decoding of Multi-Register Values
+@code#include "util/decode.h"@endcode
+
+This header file provides functions for assembling 16/32/64-bit integers
+and IEEE 754 floats from consecutive Modbus registers, either straight
+from the big-endian bytes of a response ADU or from register words, and
+for spreading them back over request ADU bytes (mb_encode_bytes()).
+
+Devices disagree on the order of the registers (and sometimes of the
+bytes within them) that make up a wider value. The order is named after
+the bytes of the value, most significant first (A), as they appear on
+the wire:
+
+  - ku8MBOrderABCD: high word first, big-endian bytes (Modbus convention)
+  - ku8MBOrderCDAB: low word first, big-endian bytes ("word swapped")
+  - ku8MBOrderBADC: high word first, little-endian bytes ("byte swapped")
+  - ku8MBOrderDCBA: low word first, little-endian bytes (fully reversed)
+
+For 64-bit values the same rule extends to four registers.
+
+*/
+/*
+
+  decode.h - Decoding of Multi-Register Values
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef _UTIL_DECODE_H_
+#define _UTIL_DECODE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+
+/** @ingroup util_decode
+    Register/byte orders of multi-register values; bit 0 swaps the
+    registers, bit 1 swaps the bytes within each register.
+*/
+static const uint8_t ku8MBOrderABCD = 0;
+static const uint8_t ku8MBOrderCDAB = 1;
+static const uint8_t ku8MBOrderBADC = 2;
+static const uint8_t ku8MBOrderDCBA = 3;
+
+
+/** @ingroup util_decode
+    Assemble a value from consecutive registers in ADU byte form.
+
+    @param const uint8_t *data first byte of the first register
+    @param uint8_t words number of registers (1, 2 or 4)
+    @param uint8_t order ku8MBOrderABCD .. ku8MBOrderDCBA
+    @return raw value, right-aligned
+*/
+static inline uint64_t mb_decode_bytes(const uint8_t *data, uint8_t words, uint8_t order)
+{
+  uint64_t value = 0;
+  uint8_t i, w;
+
+  for (i = 0; i < words; i++)
+  {
+    w = (order & 1) ? (uint8_t) (words - 1 - i) : i;
+    if (order & 2)
+    {
+      value = (value << 16) | (uint16_t) (data[2 * w] | (data[2 * w + 1] << 8));
+    }
+    else
+    {
+      value = (value << 16) | (uint16_t) ((data[2 * w] << 8) | data[2 * w + 1]);
+    }
+  }
+  return value;
+}
+
+
+/** @ingroup util_decode
+    Assemble a value from consecutive register words.
+
+    @param const uint16_t *regs first register
+    @param uint8_t words number of registers (1, 2 or 4)
+    @param uint8_t order ku8MBOrderABCD .. ku8MBOrderDCBA
+    @return raw value, right-aligned
+*/
+static inline uint64_t mb_decode_words(const uint16_t *regs, uint8_t words, uint8_t order)
+{
+  uint64_t value = 0;
+  uint16_t reg;
+  uint8_t i;
+
+  for (i = 0; i < words; i++)
+  {
+    reg = regs[(order & 1) ? words - 1 - i : i];
+    if (order & 2)
+    {
+      reg = (uint16_t) ((reg >> 8) | (reg << 8));
+    }
+    value = (value << 16) | reg;
+  }
+  return value;
+}
+
+
+/** @ingroup util_decode
+    Spread a value over consecutive registers in ADU byte form; the
+    inverse of mb_decode_bytes().
+
+    @param uint8_t *data first byte of the first register
+    @param uint64_t value raw value, right-aligned
+    @param uint8_t words number of registers (1, 2 or 4)
+    @param uint8_t order ku8MBOrderABCD .. ku8MBOrderDCBA
+*/
+static inline void mb_encode_bytes(uint8_t *data, uint64_t value, uint8_t words, uint8_t order)
+{
+  uint16_t reg;
+  uint8_t i, w;
+
+  for (i = 0; i < words; i++)
+  {
+    reg = (uint16_t) (value >> (16 * (words - 1 - i)));
+    w = (order & 1) ? (uint8_t) (words - 1 - i) : i;
+    if (order & 2)
+    {
+      data[2 * w] = (uint8_t) reg;
+      data[2 * w + 1] = (uint8_t) (reg >> 8);
+    }
+    else
+    {
+      data[2 * w] = (uint8_t) (reg >> 8);
+      data[2 * w + 1] = (uint8_t) reg;
+    }
+  }
+}
+
+
+/** @ingroup util_decode
+    Reinterpret the bits of a 32-bit integer as an IEEE 754 float.
+*/
+static inline float mb_float_from_bits(uint32_t bits)
+{
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+
+/** @ingroup util_decode
+    Reinterpret the bits of a 64-bit integer as an IEEE 754 double.
+*/
+static inline double mb_double_from_bits(uint64_t bits)
+{
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+
+#endif /* _UTIL_DECODE_H_ */
@@ -0,0 +1,197 @@
+/*
+
+  application.h - Host stand-in for the Particle Device OS API.
+
+  Library:: ModbusMaster
+
+  Just enough of the Wiring/Device OS API for every source file of the
+  library to build and run under g++ on Linux: time, logging, pins,
+  USARTSerial, mutexes, threads and semaphores. Time is the host's
+  monotonic clock; pins and the UART do nothing (the host runner talks to
+  ModbusSlaveSimulator through ModbusLoopbackSerial).
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#ifndef application_h
+#define application_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/* _____TIME_________________________________________________________________ */
+inline uint32_t micros(void)
+{
+  return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline uint32_t millis(void) { return micros() / 1000; }
+inline void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void delayMicroseconds(uint32_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+
+/* _____PINS_________________________________________________________________ */
+typedef uint16_t pin_t;
+#define LOW    0
+#define HIGH   1
+#define INPUT  0
+#define OUTPUT 1
+inline void pinMode(pin_t, int) {}
+inline void digitalWrite(pin_t, uint8_t) {}
+inline void pinSetFast(pin_t) {}
+inline void pinResetFast(pin_t) {}
+
+/* _____LOGGING______________________________________________________________ */
+enum LogLevel { LOG_LEVEL_ALL = 1, LOG_LEVEL_TRACE = 1, LOG_LEVEL_INFO = 30,
+  LOG_LEVEL_WARN = 40, LOG_LEVEL_ERROR = 50, LOG_LEVEL_NONE = 70 };
+
+class Logger
+{
+  public:
+    void trace(const char *, ...) const {}
+    void info(const char *format, ...) const
+    {
+      va_list args;
+
+      va_start(args, format);
+      vprintf(format, args);
+      va_end(args);
+      putchar('\n');
+    }
+    void warn(const char *, ...) const {}
+    void error(const char *, ...) const {}
+    void dump(LogLevel, const void *, size_t) const {}
+};
+extern Logger Log;
+
+/* _____SERIAL_______________________________________________________________ */
+#define SERIAL_8N1 0
+
+class USARTSerial
+{
+  public:
+    void   begin(unsigned long) {}
+    void   begin(unsigned long, uint32_t) {}
+    int    read(void) { return -1; }
+    int    available(void) { return 0; }
+    int    availableForWrite(void) { return 64; }
+    size_t write(uint8_t) { return 1; }
+    size_t write(const uint8_t *, size_t size) { return size; }
+    void   flush(void) {}
+};
+extern USARTSerial Serial1, Serial2;
+
+/* _____THREADS______________________________________________________________ */
+class Mutex
+{
+  public:
+    void lock(void) { _mutex.lock(); }
+    void unlock(void) { _mutex.unlock(); }
+    bool trylock(void) { return _mutex.try_lock(); }
+
+  private:
+    std::mutex _mutex;
+};
+
+class RecursiveMutex
+{
+  public:
+    void lock(void) { _mutex.lock(); }
+    void unlock(void) { _mutex.unlock(); }
+    bool trylock(void) { return _mutex.try_lock(); }
+
+  private:
+    std::recursive_mutex _mutex;
+};
+
+typedef uint8_t os_thread_prio_t;
+typedef void os_thread_return_t;
+typedef os_thread_return_t (*os_thread_fn_t)(void *);
+#define OS_THREAD_PRIORITY_DEFAULT   2
+#define OS_THREAD_STACK_SIZE_DEFAULT 3072
+inline void os_thread_yield(void) { std::this_thread::yield(); }
+
+class Thread
+{
+  public:
+    Thread() : _valid(false) {}
+    Thread(const char *, os_thread_fn_t function, void *param,
+      os_thread_prio_t = OS_THREAD_PRIORITY_DEFAULT, size_t = OS_THREAD_STACK_SIZE_DEFAULT)
+      : _valid(true)
+    {
+      std::thread(function, param).detach();
+    }
+    bool isValid(void) const { return _valid; }
+
+  private:
+    bool _valid;
+};
+
+#define CONCURRENT_WAIT_FOREVER ((unsigned) -1)
+
+struct os_semaphore
+{
+  std::mutex mutex;
+  std::condition_variable signal;
+  unsigned count, max;
+};
+typedef os_semaphore *os_semaphore_t;
+
+inline int os_semaphore_create(os_semaphore_t *semaphore, unsigned max, unsigned initial)
+{
+  *semaphore = new os_semaphore;
+  (*semaphore)->count = initial;
+  (*semaphore)->max = max;
+  return 0;
+}
+inline int os_semaphore_destroy(os_semaphore_t semaphore)
+{
+  delete semaphore;
+  return 0;
+}
+inline int os_semaphore_take(os_semaphore_t semaphore, unsigned timeout, bool)
+{
+  std::unique_lock<std::mutex> lock(semaphore->mutex);
+
+  if (timeout == CONCURRENT_WAIT_FOREVER)
+  {
+    semaphore->signal.wait(lock, [semaphore] { return semaphore->count > 0; });
+  }
+  else if (!semaphore->signal.wait_for(lock, std::chrono::milliseconds(timeout),
+    [semaphore] { return semaphore->count > 0; }))
+  {
+    return 1;
+  }
+  semaphore->count--;
+  return 0;
+}
+inline int os_semaphore_give(os_semaphore_t semaphore, bool)
+{
+  std::lock_guard<std::mutex> lock(semaphore->mutex);
+
+  if (semaphore->count < semaphore->max)
+  {
+    semaphore->count++;
+  }
+  semaphore->signal.notify_one();
+  return 0;
+}
+#endif
@@ -0,0 +1,357 @@
+/*
+
+  runner.cpp - Host runner: every function code and fault case of the
+  master, and the layers built on it (poll plans, bus scheduling, cache,
+  write batching, read/write exchange, bitsets, retries, adaptive
+  timeouts), against the slave simulator, checked and timed.
+
+  Library:: ModbusMaster
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#include "ModbusMaster-Particle.h"
+#include "ModbusSlaveSimulator.h"
+#include "ModbusBus.h"
+#include "ModbusPollPlan.h"
+#include "ModbusRegisterCache.h"
+#include "ModbusWriteBatch.h"
+#include "ModbusExchange.h"
+
+static ModbusLoopbackSerial bus;      // in-memory RS-485 bus
+static ModbusSlaveSimulator meter(1); // simulated slave with ID 1
+static ModbusSlaveSimulator relay(2); // slower slave with ID 2, same bus
+static ModbusMaster node;
+static unsigned failures;
+
+static ModbusLoopbackSerial line;     // second bus, driven by a worker thread
+static ModbusSlaveSimulator remote(1);
+static ModbusRegisterStore store;
+static ModbusBusWorker worker;
+
+static ModbusPollPlan plan;
+static ModbusBus scheduler;
+static ModbusRegisterCache cache;
+static ModbusWriteBatch batch;
+static ModbusExchange exchange;
+static ModbusBitset before, after, changed;
+static uint16_t words[125];
+static uint8_t served[4];             // transactions per slave on the scheduler
+static uint8_t share;                 // slave 1 transactions among the first six
+static uint8_t written[2];            // write batch callbacks: successes, failures
+
+/**
+Run one case, print its status and duration, and check both the status
+and the effect.
+
+@param name case name
+@param u8Expected expected status; 0xFF for any failure
+@param transaction runs the transaction, returns its status
+@param check verifies the effect of a transaction with the expected status
+*/
+template <typename Transaction, typename Check>
+static void run(const char *name, uint8_t u8Expected, Transaction transaction, Check check)
+{
+  uint32_t u32Start = micros();
+  uint8_t u8Status = transaction();
+  uint32_t u32Elapsed = micros() - u32Start;
+  bool ok;
+
+  if (u8Expected == 0xFF)
+  {
+    ok = u8Status != ModbusMaster::ku8MBSuccess;
+  }
+  else
+  {
+    ok = u8Status == u8Expected && check();
+  }
+  printf("%-4s %-36s %02x %8lu us\n", ok ? "ok" : "FAIL", name, u8Status,
+    (unsigned long) u32Elapsed);
+  failures += !ok;
+}
+
+static bool none(void)
+{
+  return true;
+}
+
+static void count(uint8_t u8Slave, uint8_t u8Status, ModbusMaster &, void *)
+{
+  if (!u8Status)
+  {
+    served[u8Slave]++;
+  }
+}
+
+static void report(uint8_t, uint16_t, uint8_t u8Status, void *)
+{
+  written[u8Status ? 1 : 0]++;
+}
+
+static void drain(void)
+{
+  while (!scheduler.idle())
+  {
+    scheduler.service();
+  }
+}
+
+int main(void)
+{
+  uint16_t i;
+
+  meter.attach(bus);
+  for (i = 0; i < 125; i++)
+  {
+    meter.setHoldingRegister(i, i);
+    meter.setInputRegister(i, 1000 + i);
+    meter.setDiscreteInput(i, i % 3 == 0);
+    meter.setCoil(i, i % 2 == 0);
+  }
+  meter.setLatency(5); // slave processing time
+  meter.setSeed(1);
+  relay.attach(bus);
+  relay.setLatency(30);
+
+  node.begin(1, bus);
+  node.setSpeed(9600);
+  node.setResponseTimeout(50);
+
+  remote.attach(line);
+  remote.setLatency(5);
+  for (i = 0; i < 125; i++)
+  {
+    remote.setHoldingRegister(i, 500 + i);
+  }
+  worker.begin(1, line, store);
+  worker.bus().master().setSpeed(9600);
+  worker.bus().addSlave(1);
+  worker.start();
+
+  // function codes
+  run("0x01 readCoils(0,16)", ModbusMaster::ku8MBSuccess,
+    [] { return node.readCoils(0, 16); },
+    [] { return node.getResponseBuffer(0) == 0x5555; });
+  run("0x02 readDiscreteInputs(0,64)", ModbusMaster::ku8MBSuccess,
+    [] { return node.readDiscreteInputs(0, 64); },
+    [] { return node.getResponseLength() == 4 && node.getResponseBuffer(0) == 0x9249; });
+  run("0x03 readHoldingRegisters(0,64)", ModbusMaster::ku8MBSuccess,
+    [] { return node.readHoldingRegisters(0, 64); },
+    [] { return node.getResponseLength() == 64 && node.getResponseBuffer(63) == 63; });
+  run("0x04 readInputRegisters(0,10)", ModbusMaster::ku8MBSuccess,
+    [] { return node.readInputRegisters(0, 10); },
+    [] { return node.getResponseBuffer(9) == 1009; });
+  run("0x05 writeSingleCoil(3,1)", ModbusMaster::ku8MBSuccess,
+    [] { return node.writeSingleCoil(3, 1); },
+    [] { return meter.getCoil(3); });
+  run("0x06 writeSingleRegister(7,9)", ModbusMaster::ku8MBSuccess,
+    [] { return node.writeSingleRegister(7, 9); },
+    [] { return meter.getHoldingRegister(7) == 9; });
+  run("0x0F writeMultipleCoils(0,16)", ModbusMaster::ku8MBSuccess,
+    [] { node.setTransmitBuffer(0, 0xA5A5); return node.writeMultipleCoils(0, 16); },
+    [] { return meter.getCoil(0) && !meter.getCoil(1) && meter.getCoil(15); });
+  run("0x10 writeMultipleRegisters(20,2)", ModbusMaster::ku8MBSuccess,
+    [] { node.setTransmitBuffer(0, 1); node.setTransmitBuffer(1, 2);
+      return node.writeMultipleRegisters(20, 2); },
+    [] { return meter.getHoldingRegister(20) == 1 && meter.getHoldingRegister(21) == 2; });
+  run("0x16 maskWriteRegister(7,00F0,0001)", ModbusMaster::ku8MBSuccess,
+    [] { return node.maskWriteRegister(7, 0x00F0, 0x0001); },
+    [] { return meter.getHoldingRegister(7) == 0x0001; });
+  run("0x17 readWriteMultiple(0,8,30,2)", ModbusMaster::ku8MBSuccess,
+    [] { node.setTransmitBuffer(0, 300); node.setTransmitBuffer(1, 301);
+      return node.readWriteMultipleRegisters(0, 8, 30, 2); },
+    [] { return meter.getHoldingRegister(31) == 301 && node.getResponseBuffer(6) == 6; });
+
+  // fault injection
+  run("exception reply", ModbusMaster::ku8MBSlaveDeviceFailure,
+    [] { meter.setException(ModbusMaster::ku8MBSlaveDeviceFailure);
+      uint8_t u8Status = node.readHoldingRegisters(0, 1);
+      meter.setException(0);
+      return u8Status; },
+    none);
+  run("corrupted CRC", ModbusMaster::ku8MBInvalidCRC,
+    [] { meter.setCorruptRate(100);
+      uint8_t u8Status = node.readHoldingRegisters(0, 1);
+      meter.setCorruptRate(0);
+      return u8Status; },
+    none);
+  run("dropped bytes", 0xFF,
+    [] { meter.setDropRate(20);
+      uint8_t u8Status = node.readHoldingRegisters(0, 32);
+      meter.setDropRate(0);
+      return u8Status; },
+    none);
+  run("offline slave", ModbusMaster::ku8MBResponseTimedOut,
+    [] { meter.setOnline(false);
+      uint8_t u8Status = node.readHoldingRegisters(0, 1);
+      meter.setOnline(true);
+      return u8Status; },
+    none);
+  run("recovery after faults", ModbusMaster::ku8MBSuccess,
+    [] { return node.readHoldingRegisters(0, 2); },
+    [] { return node.getResponseBuffer(1) == 1; });
+
+  // retries and timeouts
+  run("retry with back-off", ModbusMaster::ku8MBInvalidCRC,
+    [] { node.setRetryPolicy(3, 2, 8);
+      node.clearRetryStats();
+      meter.setCorruptRate(100);
+      uint8_t u8Status = node.readHoldingRegisters(0, 1);
+      meter.setCorruptRate(0);
+      return u8Status; },
+    [] { ModbusRetryStats stats = node.getRetryStats();
+      node.setRetryPolicy(1);
+      return stats.u32Retries == 2 && stats.u32Exhausted == 1; });
+  run("adaptive timeout per slave", ModbusMaster::ku8MBSuccess,
+    [] { uint8_t j, u8Status = ModbusMaster::ku8MBSuccess;
+      node.enableAdaptiveTimeout(20, 1000);
+      for (j = 0; j < 8 && !u8Status; j++)
+      {
+        node.setSlave(1 + j % 2);
+        u8Status = node.readHoldingRegisters(0, 1);
+      }
+      node.setSlave(1);
+      return u8Status; },
+    [] { bool ok = node.getSlaveTimeout(1) == 20 &&
+        node.getSlaveTimeout(2) > 30 && node.getSlaveTimeout(2) < 100;
+      node.disableAdaptiveTimeout();
+      return ok && node.getSlaveTimeout(2) == 50; });
+
+  // bitsets
+  run("bitset diff/next", ModbusMaster::ku8MBSuccess,
+    [] { node.readDiscreteInputs(0, 100);
+      node.getResponseBits(before);
+      meter.setDiscreteInput(1, true);
+      meter.setDiscreteInput(99, false);
+      return node.readDiscreteInputs(0, 100); },
+    [] { return node.getResponseBits(after) == 100 && after.diff(before, changed) == 2 &&
+        changed.next(0) == 1 && changed.next(2) == 99 && changed.next(100) == -1; });
+
+  // poll plans
+  run("poll plan coalescing", ModbusMaster::ku8MBSuccess,
+    [] { plan.setSlave(1);
+      plan.setGapFill(8);
+      plan.add(0x03, 0, ModbusPollPlan::ku8TypeUInt16, 1000);
+      plan.add(0x03, 5, ModbusPollPlan::ku8TypeUInt16, 1000);
+      plan.add(0x03, 40, ModbusPollPlan::ku8TypeUInt16, 1000);
+      plan.add(0x04, 0, ModbusPollPlan::ku8TypeUInt16, 1000);
+      return plan.update(node); },
+    [] { return plan.requests() == 3 && plan.getUInt16(1) == 5 && plan.getUInt16(2) == 40 &&
+        plan.getUInt16(3) == 1000; });
+
+  // bus scheduling
+  run("bus weighted round robin", ModbusMaster::ku8MBSuccess,
+    [] { uint8_t j;
+      scheduler.begin(bus);
+      scheduler.master().setSpeed(9600);
+      scheduler.addSlave(1, 2, 50);
+      scheduler.addSlave(2, 1, 50);
+      for (j = 0; j < 6; j++)
+      {
+        scheduler.submit(1, 0x03, 0, 1, count);
+        scheduler.submit(2, 0x03, 0, 1, count);
+      }
+      while (served[1] + served[2] < 6)
+      {
+        scheduler.service();
+      }
+      share = served[1];
+      drain();
+      return ModbusMaster::ku8MBSuccess; },
+    [] { return share == 4 && served[1] == 6 && served[2] == 6; });
+  run("bus offline demotion", ModbusMaster::ku8MBSlaveOffline,
+    [] { uint8_t j;
+      scheduler.addSlave(3, 1, 20);
+      for (j = 0; j < 3; j++)
+      {
+        scheduler.submit(3, 0x03, 0, 1, count);
+      }
+      drain();
+      return scheduler.submit(3, 0x03, 0, 1, count); },
+    [] { return scheduler.health(3) == ModbusBus::ku8HealthOffline &&
+        scheduler.health(1) == ModbusBus::ku8HealthOnline; });
+
+  // cache, through the worker thread
+  run("cache single flight", ModbusMaster::ku8MBSuccess,
+    [] { std::thread readers[4];
+      uint8_t u8Status[4], j;
+      cache.begin(worker);
+      for (j = 0; j < 4; j++)
+      {
+        readers[j] = std::thread([j, &u8Status] {
+          uint16_t u16Words[10];
+          u8Status[j] = cache.read(1, 0x03, 0, 10, u16Words, 1000);
+        });
+      }
+      for (j = 0; j < 4; j++)
+      {
+        readers[j].join();
+      }
+      return u8Status[0] | u8Status[1] | u8Status[2] | u8Status[3]; },
+    [] { ModbusCacheStats stats = cache.getStats();
+      return stats.u32Misses == 1 && stats.u32Shared + stats.u32Hits == 3 && remote.requests() == 1; });
+  run("cache hit within TTL", ModbusMaster::ku8MBSuccess,
+    [] { return cache.read(1, 0x03, 4, 3, words, 1000); },
+    [] { return words[0] == 504 && words[2] == 506 && remote.requests() == 1; });
+  run("cache refetch after TTL", ModbusMaster::ku8MBSuccess,
+    [] { remote.setHoldingRegister(5, 7);
+      delay(20);
+      return cache.read(1, 0x03, 5, 1, words, 10); },
+    [] { return words[0] == 7 && remote.requests() == 2 && cache.getStats().u32Misses == 2; });
+
+  // write batching
+  run("write batch merging", ModbusMaster::ku8MBSuccess,
+    [] { uint8_t j;
+      for (j = 0; j < 10; j++)
+      {
+        batch.writeRegister(1, 69 - j, 100 + 9 - j, report);
+      }
+      batch.writeRegister(1, 65, 7, report); // same register: last value wins
+      batch.writeCoil(1, 50, true, report);
+      return batch.flush(node); },
+    [] { return batch.requests() == 2 && written[0] == 12 && written[1] == 0 &&
+        meter.getHoldingRegister(60) == 100 && meter.getHoldingRegister(65) == 7 &&
+        meter.getHoldingRegister(69) == 109 && meter.getCoil(50); });
+  run("write batch per-write status", ModbusMaster::ku8MBResponseTimedOut,
+    [] { batch.writeRegister(9, 0, 1, report);
+      batch.writeRegister(9, 1, 1, report);
+      return batch.flush(node); },
+    [] { return written[1] == 2; });
+
+  // read/write exchange
+  run("exchange fused 0x17", ModbusMaster::ku8MBSuccess,
+    [] { uint16_t u16Command[2] = { 11, 12 };
+      exchange.begin(node);
+      return exchange.exchange(1, 80, 2, u16Command, 0, 4, words); },
+    [] { return exchange.support(1) == ModbusExchange::ku8SupportFused &&
+        meter.getHoldingRegister(81) == 12 && words[3] == 3; });
+  run("exchange learns split", ModbusMaster::ku8MBIllegalFunction,
+    [] { uint16_t u16Command[2] = { 11, 12 };
+      relay.setException(ModbusMaster::ku8MBIllegalFunction);
+      uint8_t u8Status = exchange.exchange(2, 80, 2, u16Command, 0, 4, words);
+      relay.setException(0);
+      return u8Status; },
+    [] { return exchange.support(2) == ModbusExchange::ku8SupportSplit; });
+  run("exchange split 0x10 + 0x03", ModbusMaster::ku8MBSuccess,
+    [] { uint16_t u16Command[2] = { 21, 22 };
+      return exchange.exchange(2, 80, 2, u16Command, 80, 2, words); },
+    [] { return exchange.support(2) == ModbusExchange::ku8SupportSplit && exchange.split() == 2 &&
+        relay.getHoldingRegister(81) == 22 && words[1] == 22; });
+
+  // the worker thread never returns: leave without running destructors
+  printf("%u failed\n", failures);
+  fflush(stdout);
+  _Exit(failures ? 1 : 0);
+}
@@ -1,5 +1,6 @@
 #include "Particle.h"
 #include <HttpClient.h>
+#include "ModbusBusWorker.h"
 
 // This firmware provides a minimal implementation of the standard
 // controller functions requested for all Shefa Green controllers. The
@@ -50,6 +51,7 @@ struct ReadingPayload {
     String iso_time;
     // Placeholder for actual measured values
     float dummy_value;
+    String modbus_values;        // JSON object of the RS-485 meter readings
 };
 
 // ----- Persistent configuration ----------------------------------------------
@@ -100,6 +102,42 @@ http_header_t headers[] = {
 // Last time sensor data was pushed to the server
 time_t lastServerPush = 0;
 
+// Modbus RTU meters, all on the RS-485 transceiver on Serial1. The bus is
+// polled by a worker thread and every value lands in modbusStore for
+// GetReadings() to snapshot. Boards with a second transceiver on Serial2
+// can define MODBUS_SERIAL2 to poll it in parallel by a second worker, and
+// give its readings bus 2.
+const uint32_t MODBUS_BAUD    = 9600;
+const uint32_t MODBUS_POLL_MS = 1000;    // refresh period of every reading
+#ifdef MODBUS_SERIAL2
+const uint8_t  MODBUS_BUSES   = 2;
+#else
+const uint8_t  MODBUS_BUSES   = 1;
+#endif
+
+ModbusRegisterStore modbusStore;
+ModbusBusWorker modbusBus[MODBUS_BUSES]; // index 0 = Serial1, 1 = Serial2
+ModbusPollPlan ecPlan;                   // EC controller, ID 1
+ModbusPollPlan phPlan;                   // pH controller, ID 2
+ModbusPollPlan orpPlan;                  // ORP controller, ID 3
+
+struct ModbusReading {
+    const char *name;       // JSON key
+    uint8_t bus;            // 1 = Serial1, 2 = Serial2
+    uint8_t slave;          // Modbus slave ID
+    uint16_t reg;           // holding register
+    float divisor;          // raw value / divisor = engineering units
+    ModbusPollPlan *plan;   // plan polling the slave
+};
+
+const ModbusReading MODBUS_READINGS[] = {
+    { "ec_temp", 1, 1, 72,  10.0f,   &ecPlan  },   // degC
+    { "ec",      1, 1, 75,  1000.0f, &ecPlan  },   // mS/cm
+    { "ph",      1, 2, 75,  100.0f,  &phPlan  },
+    { "orp",     1, 3, 169, 1.0f,    &orpPlan },   // mV; manual says 170
+};
+const uint8_t MODBUS_READING_COUNT = sizeof(MODBUS_READINGS) / sizeof(MODBUS_READINGS[0]);
+
 // ----- Utility functions ------------------------------------------------------
 
 String iso8601FromTime(time_t ts) {
@@ -112,6 +150,73 @@ String iso8601FromTime(time_t ts) {
     return String(buf);
 }
 
+// Summarise the Modbus instrumentation as compact JSON: transaction counts,
+// bytes on the wire, bus utilisation and the mean/p95/max latency of each
+// transaction phase in microseconds. Sized to fit a cloud variable.
+// With several buses the counters are summed; busy_pct is their average
+// utilisation.
+String modbusStatsJson() {
+    ModbusMasterStats stats, busStats;
+    modbusBus[0].getStats(stats);
+    for (uint8_t i = 1; i < MODBUS_BUSES; i++) {
+        modbusBus[i].getStats(busStats);
+        stats.merge(busStats);
+    }
+
+    uint32_t elapsed = millis() - stats.u32Since;
+    uint32_t errors = 0;
+    for (uint8_t i = 0; i < ModbusMasterStats::ku8Statuses; i++) {
+        errors += stats.u32Errors[i];
+    }
+    float utilisation = elapsed ? (float)stats.u64BusyTime / (10.0f * elapsed * MODBUS_BUSES) : 0.0f;
+
+    const ModbusLatencyHistogram *phases[] = {
+        &stats.transmit, &stats.turnaround, &stats.receive, &stats.total
+    };
+    const char *names[] = { "tx", "turn", "rx", "total" };
+
+    String json = String::format(
+        "{\"window_s\":%lu,\"transactions\":%lu,\"attempts\":%lu,\"errors\":%lu,"
+        "\"timeouts\":%lu,\"crc\":%lu,\"bytes_tx\":%lu,\"bytes_rx\":%lu,\"busy_pct\":%.1f",
+        (unsigned long)(elapsed / 1000), (unsigned long)stats.u32Transactions,
+        (unsigned long)stats.u32Attempts, (unsigned long)errors,
+        (unsigned long)stats.u32Errors[ModbusMasterStats::statusIndex(ModbusMaster::ku8MBResponseTimedOut)],
+        (unsigned long)stats.u32Errors[ModbusMasterStats::statusIndex(ModbusMaster::ku8MBInvalidCRC)],
+        (unsigned long)stats.u32BytesSent, (unsigned long)stats.u32BytesReceived, utilisation);
+    for (uint8_t i = 0; i < 4; i++) {
+        json += String::format(",\"%s_us\":[%lu,%lu,%lu]", names[i],
+            (unsigned long)phases[i]->mean(), (unsigned long)phases[i]->percentile(95),
+            (unsigned long)phases[i]->u32Max);
+    }
+    json += "}";
+    return json;
+}
+
+// Latest meter values as a JSON object keyed by reading name. All values come
+// from one snapshot of the register store; a reading whose last poll failed
+// (or that was never polled) is reported as null.
+String modbusValuesJson() {
+    ModbusRegisterStore::Value values[ModbusRegisterStore::ku8MaxValues];
+    uint8_t count = modbusStore.snapshot(values, ModbusRegisterStore::ku8MaxValues);
+
+    String json = "{";
+    for (uint8_t i = 0; i < MODBUS_READING_COUNT; i++) {
+        const ModbusReading &reading = MODBUS_READINGS[i];
+        const ModbusRegisterStore::Value *value = ModbusRegisterStore::find(values, count,
+            reading.bus, reading.slave, 0x03, reading.reg);
+        if (i) {
+            json += ",";
+        }
+        if (value && value->u8Status == ModbusMaster::ku8MBSuccess) {
+            json += String::format("\"%s\":%.3f", reading.name, value->dValue / reading.divisor);
+        } else {
+            json += String::format("\"%s\":null", reading.name);
+        }
+    }
+    json += "}";
+    return json;
+}
+
 void loadPersistent() {
     EEPROM.get(EEPROM_ADDR, persistent);
 
@@ -148,9 +253,9 @@ bool sendToServer(const ReadingPayload &r, int &httpStatus, const char *source)
 
     // Build JSON body
     String body = String::format(
-        "{\"deviceId\":\"%s\",\"firmwareVersion\":\"%s\",\"timestamp\":%lu,\"serverInterval\":%.2f,\"displayInterval\":%.2f,\"dummy_value\":%.2f}",
+        "{\"deviceId\":\"%s\",\"firmwareVersion\":\"%s\",\"timestamp\":%lu,\"serverInterval\":%.2f,\"displayInterval\":%.2f,\"dummy_value\":%.2f,\"modbus\":%s}",
         r.device_id.c_str(), r.firmware_version.c_str(), (unsigned long)r.unix_ts,
-        r.server_interval, r.display_interval, r.dummy_value);
+        r.server_interval, r.display_interval, r.dummy_value, r.modbus_values.c_str());
 
     request.body = body;
 
@@ -175,6 +280,7 @@ ReadingPayload GetReadings() {
     r.unix_ts = Time.now();
     r.iso_time = iso8601FromTime(r.unix_ts);
     r.dummy_value = 0.0f; // replace with real sensor data
+    r.modbus_values = modbusValuesJson();
     return r;
 }
 
@@ -273,6 +379,26 @@ void setup() {
     loadPersistent();
     persistent.boot_count++;
     EEPROM.put(EEPROM_ADDR, persistent);
+
+    modbusBus[0].begin(1, Serial1, modbusStore);
+#ifdef MODBUS_SERIAL2
+    modbusBus[1].begin(2, Serial2, modbusStore);
+#endif
+    // EC temperature and conductivity (72 and 75) share one request
+    ecPlan.setGapFill(2);
+    for (uint8_t i = 0; i < MODBUS_READING_COUNT; i++) {
+        const ModbusReading &reading = MODBUS_READINGS[i];
+        reading.plan->add(0x03, reading.reg, ModbusPollPlan::ku8TypeUInt16, MODBUS_POLL_MS);
+        modbusBus[reading.bus - 1].attachPlan(reading.slave, *reading.plan);
+    }
+    for (uint8_t i = 0; i < MODBUS_BUSES; i++) {
+        modbusBus[i].bus().master().setSpeed(MODBUS_BAUD, SERIAL_8N1);
+        // learn each meter's response time: a meter that stopped answering
+        // costs ~50 ms per poll instead of the full 500 ms default
+        modbusBus[i].bus().master().enableAdaptiveTimeout();
+        modbusBus[i].start();
+    }
+    Particle.variable("modbusStats", modbusStatsJson);
 }
 
 void loop() {